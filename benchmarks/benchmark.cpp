@@ -0,0 +1,396 @@
+/** \file benchmark.cpp
+ *  \brief Timing of the core CPU code paths with machine readable output.
+ *
+ *  Each benchmark is run repeatedly until both a minimum number of
+ *  iterations and a minimum total time have been reached.  Results are
+ *  printed as a table and, optionally, written as JSON so that runs can be
+ *  compared across releases.
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+#include "libmolgrid/libmolgrid.h"
+#include "libmolgrid/grid_maker.h"
+#include "libmolgrid/transform.h"
+#include "libmolgrid/atom_typer.h"
+#include "libmolgrid/coord_cache.h"
+#include "libmolgrid/example_provider.h"
+#include "libmolgrid/molcache.h"
+
+#ifndef LIBMOLGRID_VERSION
+#define LIBMOLGRID_VERSION "unknown"
+#endif
+#ifndef LIBMOLGRID_DATA_DIR
+#define LIBMOLGRID_DATA_DIR "test/data"
+#endif
+
+namespace libmolgrid {
+  extern const char *GIT_REVISION;
+}
+
+using namespace libmolgrid;
+using namespace std;
+namespace po = boost::program_options;
+
+struct Options {
+    double min_time = 0.5; //seconds
+    unsigned min_iters = 3;
+    unsigned threads = 1;
+    string data_dir = LIBMOLGRID_DATA_DIR;
+};
+
+/// a named piece of work; setup is untimed and returns the function to time
+struct Benchmark {
+    string name;
+    size_t items; //items processed per iteration, for throughput
+    function<function<void()>()> setup;
+};
+
+struct Result {
+    string name;
+    size_t iterations = 0;
+    double mean = 0, min = 0, max = 0, stddev = 0; //milliseconds per iteration
+    double items_per_second = 0;
+};
+
+typedef chrono::steady_clock Clock;
+
+static Result run(const Benchmark& b, const Options& opt) {
+  function<void()> f = b.setup();
+  f(); //warm up caches and allocations
+
+  vector<double> times;
+  double total = 0;
+  while(times.size() < opt.min_iters || total < opt.min_time) {
+    auto start = Clock::now();
+    f();
+    double secs = chrono::duration<double>(Clock::now() - start).count();
+    times.push_back(secs);
+    total += secs;
+  }
+
+  Result r;
+  r.name = b.name;
+  r.iterations = times.size();
+  r.mean = total / times.size() * 1000.0;
+  r.min = *min_element(times.begin(), times.end()) * 1000.0;
+  r.max = *max_element(times.begin(), times.end()) * 1000.0;
+  double var = 0;
+  for(double t : times) {
+    var += (t * 1000.0 - r.mean) * (t * 1000.0 - r.mean);
+  }
+  r.stddev = sqrt(var / times.size());
+  r.items_per_second = b.items / (r.mean / 1000.0);
+  return r;
+}
+
+//random atoms of a molecule roughly filling a grid of dimension dim
+static CoordinateSet make_atoms(size_t natoms, unsigned ntypes, float dim, bool vector_types) {
+  default_random_engine engine(natoms * 31 + ntypes);
+  uniform_real_distribution<float> coord(-dim / 2, dim / 2);
+  uniform_int_distribution<int> type(0, ntypes - 1);
+  uniform_real_distribution<float> radius(1.0, 2.0);
+  vector<float3> c(natoms);
+  vector<int> t(natoms);
+  vector<float> r(natoms);
+  for(size_t i = 0; i < natoms; i++) {
+    c[i] = make_float3(coord(engine), coord(engine), coord(engine));
+    t[i] = type(engine);
+    r[i] = radius(engine);
+  }
+  CoordinateSet ret(c, t, r, ntypes);
+  if(vector_types) ret.make_vector_types();
+  return ret;
+}
+
+static string param_name(const string& base, size_t natoms, float res, unsigned ntypes) {
+  stringstream ss;
+  ss << base << "/atoms:" << natoms << "/res:" << res << "/types:" << ntypes;
+  return ss.str();
+}
+
+static void add_gridmaker_benchmarks(vector<Benchmark>& benchmarks, const Options& opt) {
+  const float dim = 23.5;
+  for(size_t natoms : {100, 1000, 10000}) {
+    for(float res : {0.5f, 0.25f}) {
+      for(unsigned ntypes : {14, 28}) {
+        for(bool vec : {false, true}) {
+          string kind = vec ? "vector" : "index";
+          auto grid_setup = [=](bool backward) -> function<void()> {
+            auto gmaker = make_shared<GridMaker>(res, dim);
+            gmaker->set_num_threads(opt.threads);
+            auto atoms = make_shared<CoordinateSet>(make_atoms(natoms, ntypes, dim, vec));
+            float3 gdims = gmaker->get_grid_dims();
+            auto grid = make_shared<MGrid4f>(ntypes, gdims.x, gdims.y, gdims.z);
+            float3 center = make_float3(0, 0, 0);
+            if(!backward) {
+              return [=]() { gmaker->forward(center, *atoms, grid->cpu()); };
+            }
+            //backward from a gradient that is the density itself
+            gmaker->forward(center, *atoms, grid->cpu());
+            auto agrad = make_shared<MGrid2f>(natoms, 3);
+            auto tgrad = make_shared<MGrid2f>(natoms, ntypes);
+            if(vec)
+              return [=]() { gmaker->backward(center, *atoms, grid->cpu(), agrad->cpu(), tgrad->cpu()); };
+            return [=]() { gmaker->backward(center, *atoms, grid->cpu(), agrad->cpu()); };
+          };
+          benchmarks.push_back({param_name("gridmaker_forward_" + kind, natoms, res, ntypes), natoms,
+              [=]() { return grid_setup(false); }});
+          benchmarks.push_back({param_name("gridmaker_backward_" + kind, natoms, res, ntypes), natoms,
+              [=]() { return grid_setup(true); }});
+        }
+      }
+    }
+  }
+}
+
+static void add_transform_benchmarks(vector<Benchmark>& benchmarks, const Options& opt) {
+  for(size_t natoms : {100, 1000, 10000, 100000}) {
+    benchmarks.push_back({"transform_forward/atoms:" + itoa(natoms), natoms, [=]() -> function<void()> {
+      auto atoms = make_shared<CoordinateSet>(make_atoms(natoms, 14, 23.5, false));
+      auto out = make_shared<CoordinateSet>(atoms->clone());
+      auto transform = make_shared<Transform>(atoms->center(), 2.0, true);
+      return [=]() { transform->forward(*atoms, *out); };
+    }});
+  }
+}
+
+//distinct structure files named in a types file, interned since caches are keyed by pointer
+static vector<const char*> read_files(const string& types, unsigned column) {
+  vector<const char*> files;
+  ifstream in(types.c_str());
+  if(!in) throw invalid_argument("Could not read " + types);
+  string line;
+  while(getline(in, line)) {
+    stringstream ss(line);
+    string tok;
+    for(unsigned i = 0; i <= column && ss >> tok; i++) {
+    }
+    if(tok.size()) {
+      const char *name = string_cache.get(tok);
+      if(find(files.begin(), files.end(), name) == files.end()) files.push_back(name);
+    }
+  }
+  return files;
+}
+
+static void add_io_benchmarks(vector<Benchmark>& benchmarks, const Options& opt) {
+  string types = opt.data_dir + "/small.types";
+  string structs = opt.data_dir + "/structs";
+  if(!boost::filesystem::exists(types)) {
+    cerr << "Skipping data benchmarks, " << types << " not found\n";
+    return;
+  }
+
+  vector<const char*> recs = read_files(types, 3);
+  vector<const char*> ligs = read_files(types, 4);
+  vector<const char*> all(recs);
+  all.insert(all.end(), ligs.begin(), ligs.end());
+
+  benchmarks.push_back({"coordcache_set_coords/gninatypes", all.size(), [=]() -> function<void()> {
+    ExampleProviderSettings settings;
+    settings.cache_structs = false; //measure reading files, not copying from memory
+    settings.data_root = structs;
+    auto cache = make_shared<CoordCache>(make_shared<GninaIndexTyper>(), settings);
+    auto c = make_shared<CoordinateSet>();
+    return [=]() {
+      for(const char *fname : all) cache->set_coords(fname, *c);
+    };
+  }});
+
+  benchmarks.push_back({"coordcache_set_coords/memory", all.size(), [=]() -> function<void()> {
+    ExampleProviderSettings settings;
+    settings.data_root = structs;
+    auto cache = make_shared<CoordCache>(make_shared<GninaIndexTyper>(), settings);
+    auto c = make_shared<CoordinateSet>();
+    for(const char *fname : all) cache->set_coords(fname, *c); //warm cache
+    return [=]() {
+      for(const char *fname : all) cache->set_coords(fname, *c);
+    };
+  }});
+
+  benchmarks.push_back({"coordcache_set_coords/molcache2", all.size(), [=]() -> function<void()> {
+    ExampleProviderSettings settings;
+    auto rcache = make_shared<CoordCache>(make_shared<GninaIndexTyper>(), settings, opt.data_dir + "/rec.molcache2");
+    auto lcache = make_shared<CoordCache>(make_shared<GninaIndexTyper>(), settings, opt.data_dir + "/lig.molcache2");
+    auto c = make_shared<CoordinateSet>();
+    return [=]() {
+      for(const char *fname : recs) rcache->set_coords(fname, *c);
+      for(const char *fname : ligs) lcache->set_coords(fname, *c);
+    };
+  }});
+
+  benchmarks.push_back({"coordcache_set_coords/molcache3", all.size(), [=]() -> function<void()> {
+    ExampleProviderSettings settings;
+    settings.data_root = structs;
+    auto typer = make_shared<GninaIndexTyper>();
+    boost::filesystem::path fname = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("%%%%-%%%%.molcache3");
+    {
+      CoordCache reader(typer, settings);
+      MolCache3Writer writer(fname.string(), typer);
+      CoordinateSet c;
+      for(const char *name : all) {
+        reader.set_coords(name, c);
+        writer.add(name, c);
+      }
+    }
+    auto cache = make_shared<CoordCache>(typer, settings, fname.string());
+    boost::filesystem::remove(fname); //stays mapped
+    auto c = make_shared<CoordinateSet>();
+    return [=]() {
+      for(const char *name : all) cache->set_coords(name, *c);
+    };
+  }});
+
+  vector<string> molfiles;
+  for(const char *fname : read_files(opt.data_dir + "/smallmol.types", 4)) molfiles.push_back(structs + "/" + fname);
+  for(unsigned nthreads : {1, 0}) {
+    benchmarks.push_back({"read_coordinate_sets/threads:" + (nthreads ? itoa(nthreads) : string("all")), molfiles.size(),
+      [=]() -> function<void()> {
+        auto typer = make_shared<GninaIndexTyper>();
+        return [=]() { read_coordinate_sets(molfiles, *typer, true, nthreads); };
+    }});
+  }
+
+  benchmarks.push_back({"examplerefprovider_nextref/shuffle", 1000, [=]() -> function<void()> {
+    ExampleProviderSettings settings;
+    settings.shuffle = true;
+    auto provider = make_shared<UniformExampleRefProvider>(settings);
+    provider->populate(types, -1);
+    provider->setup();
+    auto ref = make_shared<ExampleRef>();
+    return [=]() {
+      for(unsigned i = 0; i < 1000; i++) provider->nextref(*ref);
+    };
+  }});
+
+  for(unsigned batch_size : {1, 16, 64}) {
+    benchmarks.push_back({"exampleprovider_next_batch/molcache2/batch:" + itoa(batch_size), batch_size,
+      [=]() -> function<void()> {
+        ExampleProviderSettings settings;
+        settings.shuffle = true;
+        settings.recmolcache = opt.data_dir + "/rec.molcache2";
+        settings.ligmolcache = opt.data_dir + "/lig.molcache2";
+        auto provider = make_shared<ExampleProvider>(settings);
+        provider->populate(types);
+        auto batch = make_shared<vector<Example> >();
+        return [=]() { provider->next_batch(*batch, batch_size); };
+    }});
+  }
+}
+
+static string json_escape(const string& s) {
+  string ret;
+  for(char c : s) {
+    if(c == '"' || c == '\\') ret += '\\';
+    ret += c;
+  }
+  return ret;
+}
+
+static void write_json(ostream& out, const vector<Result>& results, const Options& opt) {
+  time_t now = time(nullptr);
+  char date[64];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+  out << setprecision(6);
+  out << "{\n  \"context\": {\n";
+  out << "    \"date\": \"" << date << "\",\n";
+  out << "    \"libmolgrid_version\": \"" << LIBMOLGRID_VERSION << "\",\n";
+  out << "    \"git_revision\": \"" << json_escape(GIT_REVISION) << "\",\n";
+  out << "    \"threads\": " << opt.threads << ",\n";
+  out << "    \"hardware_concurrency\": " << thread::hardware_concurrency() << ",\n";
+  out << "    \"min_time\": " << opt.min_time << "\n";
+  out << "  },\n  \"benchmarks\": [\n";
+  for(unsigned i = 0, n = results.size(); i < n; i++) {
+    const Result& r = results[i];
+    out << "    {\"name\": \"" << json_escape(r.name) << "\", \"iterations\": " << r.iterations
+        << ", \"time_unit\": \"ms\", \"mean\": " << r.mean << ", \"min\": " << r.min << ", \"max\": " << r.max
+        << ", \"stddev\": " << r.stddev << ", \"items_per_second\": " << r.items_per_second << "}"
+        << (i + 1 < n ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  string filter = ".*";
+  string json;
+  bool list = false;
+
+  po::options_description desc("Options");
+  desc.add_options()
+      ("filter", po::value<string>(&filter), "regular expression selecting benchmarks to run")
+      ("json", po::value<string>(&json), "write results as JSON to this file ('-' for stdout)")
+      ("min_time", po::value<double>(&opt.min_time), "minimum seconds to run each benchmark")
+      ("min_iters", po::value<unsigned>(&opt.min_iters), "minimum iterations of each benchmark")
+      ("threads", po::value<unsigned>(&opt.threads), "threads used by GridMaker (0 for all cores)")
+      ("data", po::value<string>(&opt.data_dir), "directory with small.types and molcache2 files")
+      ("list", po::bool_switch(&list), "list benchmarks without running them")
+      ("help", "print this message");
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  } catch (po::error& e) {
+    cerr << e.what() << "\n" << desc;
+    return 1;
+  }
+  if(vm.count("help")) {
+    cout << desc;
+    return 0;
+  }
+
+  vector<Benchmark> benchmarks;
+  add_gridmaker_benchmarks(benchmarks, opt);
+  add_transform_benchmarks(benchmarks, opt);
+  add_io_benchmarks(benchmarks, opt);
+
+  regex re(filter);
+  vector<Result> results;
+  ostream& table = json == "-" ? cerr : cout;
+  for(const Benchmark& b : benchmarks) {
+    if(!regex_search(b.name, re)) continue;
+    if(list) {
+      cout << b.name << "\n";
+      continue;
+    }
+    Result r = run(b, opt);
+    table << left << setw(64) << r.name << right << fixed << setprecision(4) << setw(12) << r.mean << " ms"
+        << setw(10) << r.iterations << " iters" << setprecision(1) << setw(14) << r.items_per_second << " items/s\n";
+    table.flush();
+    results.push_back(r);
+  }
+
+  if(json == "-") {
+    write_json(cout, results, opt);
+  } else if(json.size()) {
+    ofstream out(json.c_str());
+    if(!out) {
+      cerr << "Could not write " << json << "\n";
+      return 1;
+    }
+    write_json(out, results, opt);
+  }
+  return 0;
+}
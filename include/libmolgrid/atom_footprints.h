@@ -0,0 +1,90 @@
+/** \file atom_footprints.h - per-atom grid footprints recorded by forward for reuse in backward
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#ifndef ATOM_FOOTPRINTS_H_
+#define ATOM_FOOTPRINTS_H_
+
+#include <vector>
+#include <cuda_runtime.h>
+
+namespace libmolgrid {
+
+/** \brief Densities of every atom at the grid points it overlaps.
+ *
+ * Filled by GridMaker::forward (CPU) when training so that backward and
+ * backward_relevance can skip recomputing the bounds, distances and densities
+ * of each atom.  For each atom that overlaps the grid the box of grid points
+ * within its density radius is stored along with the density and the
+ * derivative of the density at each of these points.  Storage is kept between
+ * calls, so a single object can be reused for every example of a training run.
+ * Memory is proportional to the number of atoms times the volume of the
+ * largest atom's bounding box (two floats per grid point), and is bounded by
+ * max_points grid points (by default 2^26, or 512MB).  If the atoms'
+ * boxes together have more points, no footprints are stored and forward and
+ * backward compute the densities of each atom directly, as without footprints.
+ *
+ * Footprints are only valid for the coordinates, grid center and gridding
+ * parameters (resolution, dimension, radius scale, gaussian radius multiple
+ * and binary) they were computed with.
+ */
+class AtomFootprints {
+    friend class GridMaker;
+
+    struct footprint {
+      unsigned atom; ///index of atom in coordinates
+      uint2 bounds[3]; ///range of grid points overlapped along each axis
+      size_t offset; ///start of values in density and gradient
+    };
+
+    std::vector<footprint> footprints; ///atoms that overlap the grid, in atom order
+    std::vector<float> density; ///density at every point of each atom's box
+    std::vector<float> gradient; ///derivative of density with respect to distance, divided by distance
+    float3 grid_origin = make_float3(0, 0, 0);
+    unsigned dim = 0;
+    float resolution = 0;
+    float radius_scale = 0;
+    float gaussian_radius_multiple = 0;
+    bool binary = false;
+    size_t natoms = 0;
+    size_t max_points = 1 << 26; ///most grid points stored
+    bool complete = false; ///false if the footprints had too many points to store
+
+  public:
+    AtomFootprints() {}
+    AtomFootprints(size_t maxpoints): max_points(maxpoints) {}
+
+    /// number of atoms in the coordinates the footprints were computed from
+    size_t num_atoms() const { return natoms; }
+
+    /// number of atoms that overlap the grid, 0 if footprints were not stored
+    size_t num_footprints() const { return footprints.size(); }
+
+    /// whether the last forward stored footprints, rather than exceeding max_points
+    bool recorded() const { return complete; }
+
+    /// most grid points (each two floats) footprints will be stored for
+    size_t get_max_points() const { return max_points; }
+    void set_max_points(size_t maxpoints) { max_points = maxpoints; }
+
+    /// bytes of memory currently reserved
+    size_t memory_size() const {
+      return footprints.capacity() * sizeof(footprint) + (density.capacity() + gradient.capacity()) * sizeof(float);
+    }
+
+    /// forget recorded footprints, keeping allocated storage
+    void clear() {
+      footprints.clear();
+      density.clear();
+      gradient.clear();
+      natoms = 0;
+      dim = 0;
+      complete = false;
+    }
+};
+
+} /* namespace libmolgrid */
+
+#endif /* ATOM_FOOTPRINTS_H_ */
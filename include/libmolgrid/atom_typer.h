@@ -11,6 +11,9 @@
 
 #include <openbabel/atom.h>
 #include <openbabel/elements.h>
+#include <openbabel/mol.h>
+#include <cstdint>
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <iostream>
@@ -19,6 +22,9 @@
 
 namespace libmolgrid {
 
+/// number of atomic numbers (including zero) covered by per-element lookup tables
+static const unsigned NumElementEntries = 119;
+
 /***** Base classes **********/
 
 /** \brief Base class for all atom typers */
@@ -34,8 +40,18 @@ class AtomTyper {
     virtual std::pair<int,float> get_atom_type_index(OpenBabel::OBAtom *a) const { throw std::logic_error("Unimplemented atom typing function called"); }
     virtual std::pair<int,float> get_int_type(int t) const { throw std::logic_error("Unimplemented atom typing function called"); }
 
+    /** \brief Set the index type and radius of every atom of mol, in atom order.
+     * Ignored atoms have negative types.  The default calls get_atom_type_index
+     * for each atom; typers override this to type a molecule without a virtual
+     * call per atom.
+     */
+    virtual void type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const;
+
     virtual std::vector<std::string> get_type_names() const { throw std::logic_error("Base class AtomTyper function called"); }
     virtual bool is_vector_typer() const { throw std::logic_error("Base class AtomTyper function called"); }
+
+    /// false if typing must not be done from background threads (e.g., python callbacks)
+    virtual bool is_thread_safe() const { return true; }
 };
 
 /** \brief Base class for generating numerical types along with atomic radius */
@@ -172,11 +188,19 @@ class GninaIndexTyper: public AtomIndexTyper {
     bool use_covalent = false;
     static const info default_data[NumTypes];
     const info *data = NULL; //data to use
+    //type of each element before adjusting for bonding, indexed by atomic number
+    //and whether the atom is a polar hydrogen, aromatic carbon, or acceptor
+    int8_t element_types[NumElementEntries][2];
+
+    //type of element anum by looking up its autodock name in data
+    int lookup_element_type(unsigned anum, bool flag) const;
+    //type and radius of a, shared by per-atom and per-molecule typing
+    std::pair<int,float> type_atom(OpenBabel::OBAtom* a) const;
 
   public:
 
     //Create a gnina typer.  If usec is true, use the gnina determined covalent radius.
-    GninaIndexTyper(bool usec = false, const info *d = default_data): use_covalent(usec), data(d) {}
+    GninaIndexTyper(bool usec = false, const info *d = default_data);
     virtual ~GninaIndexTyper() {}
 
     /// return number of types
@@ -185,6 +209,9 @@ class GninaIndexTyper: public AtomIndexTyper {
     ///return type index of a
     virtual std::pair<int,float> get_atom_type_index(OpenBabel::OBAtom* a) const;
 
+    ///type all the atoms of mol
+    virtual void type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const;
+
     /// basically look up the radius of the given gnina type
     virtual std::pair<int,float> get_int_type(int t) const;
 
@@ -208,8 +235,12 @@ class GninaIndexTyper: public AtomIndexTyper {
 class ElementIndexTyper: public AtomIndexTyper {
     unsigned last_elem;
     const float default_radius = 1.6;
+    float element_radii[NumElementEntries]; //covalent radius indexed by atomic number
+
+    //type and radius of element elem
+    std::pair<int,float> element_type(unsigned elem) const;
   public:
-    ElementIndexTyper(unsigned maxe = 84): last_elem(maxe) {}
+    ElementIndexTyper(unsigned maxe = 84);
     virtual ~ElementIndexTyper() {}
 
     /// return number of types
@@ -218,6 +249,9 @@ class ElementIndexTyper: public AtomIndexTyper {
     ///return type index of a
     virtual std::pair<int,float> get_atom_type_index(OpenBabel::OBAtom* a) const;
 
+    ///type all the atoms of mol
+    virtual void type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const;
+
     ///look up covalent radius of element or provide default
     virtual std::pair<int,float> get_int_type(int t) const;
 
@@ -267,14 +301,38 @@ class CallbackIndexTyper: public AtomIndexTyper {
 
 /** \brief Wrap an atom typer with a mapper
  *
+ * The mapped type of every type of the wrapped typer and the result of
+ * get_int_type for gnina types and atomic numbers are computed on
+ * construction, so typing looks them up in flat tables.
  */
 template<class Mapper, class Typer>
 class MappedAtomIndexTyper: public AtomIndexTyper {
   protected:
     Mapper mapper;
     Typer typer;
+    std::vector<int> mapped_types; //mapped type of each type of typer
+    std::vector<std::pair<int,float> > int_types; //get_int_type of small non-negative values
+
+    //map type t of typer
+    int map_type(int t) const {
+      if(t >= 0 && t < (int)mapped_types.size()) return mapped_types[t];
+      return mapper.Mapper::get_new_type(t);
+    }
+
   public:
-    MappedAtomIndexTyper(const Mapper& map, const Typer& typr): mapper(map), typer(typr) {}
+    MappedAtomIndexTyper(const Mapper& map, const Typer& typr): mapper(map), typer(typr) {
+      unsigned ntypes = typer.Typer::num_types();
+      mapped_types.reserve(ntypes);
+      for(unsigned t = 0; t < ntypes; t++) {
+        mapped_types.push_back(mapper.Mapper::get_new_type(t));
+      }
+      unsigned nint = std::max(ntypes, NumElementEntries);
+      int_types.reserve(nint);
+      for(unsigned t = 0; t < nint; t++) {
+        auto res_rad = typer.Typer::get_int_type(t);
+        int_types.push_back(std::make_pair(map_type(res_rad.first), res_rad.second));
+      }
+    }
     virtual ~MappedAtomIndexTyper() {}
 
     /// return number of types
@@ -284,18 +342,25 @@ class MappedAtomIndexTyper: public AtomIndexTyper {
 
     ///return type index of a
     virtual std::pair<int,float> get_atom_type_index(OpenBabel::OBAtom* a) const {
-      auto res_rad = typer.get_atom_type_index(a);
+      auto res_rad = typer.Typer::get_atom_type_index(a);
       //remap the type
-      int ret = mapper.get_new_type(res_rad.first);
-      return std::make_pair(ret, res_rad.second);
+      return std::make_pair(map_type(res_rad.first), res_rad.second);
     }
 
     //map the type
     virtual std::pair<int,float> get_int_type(int t) const {
-      auto res_rad = typer.get_int_type(t);
+      if(t >= 0 && t < (int)int_types.size()) return int_types[t];
+      auto res_rad = typer.Typer::get_int_type(t);
       //remap the type
-      int ret = mapper.get_new_type(res_rad.first);
-      return std::make_pair(ret, res_rad.second);
+      return std::make_pair(map_type(res_rad.first), res_rad.second);
+    }
+
+    ///type mol with the typer and map the types, calling both directly rather than virtually
+    virtual void type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const {
+      typer.Typer::type_molecule(mol, types, radii);
+      for(int& t : types) {
+        t = map_type(t);
+      }
     }
 
     //return vector of string representations of types
@@ -0,0 +1,76 @@
+/** \file cell_list.h - uniform grid spatial index over atom coordinates
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#ifndef CELL_LIST_H_
+#define CELL_LIST_H_
+
+#include <vector>
+#include <cuda_runtime.h>
+#include "libmolgrid/grid.h"
+#include "libmolgrid/coordinateset.h"
+
+namespace libmolgrid {
+
+/** \brief Bin atoms into a uniform grid of cubic cells.
+ *
+ * Build once for a (large) set of coordinates and reuse it to quickly find the
+ * atoms that can contribute to any number of (small) grids cut from it.
+ * The cell list only stores atom indices; it must be rebuilt if the
+ * coordinates change.  Atoms with non-finite coordinates are not placed in
+ * any cell and are never returned by query.
+ */
+class CellList {
+    float cell_size = 4.0; ///side length of a cell in Angstroms
+    float3 origin = make_float3(0, 0, 0); ///minimum corner of the cell grid
+    unsigned ncells[3] = {0, 0, 0}; ///number of cells along each axis
+    float max_radius = 0; ///largest atomic radius
+    size_t natoms = 0;
+    std::vector<unsigned> cell_start; ///offset into atoms of each cell, ncells+1 entries
+    std::vector<unsigned> atoms; ///atom indices grouped by cell, ascending within a cell
+
+  public:
+    CellList() {}
+
+    /** \brief Construct cell list
+     * @param[in] coords coordinates (Nx3)
+     * @param[in] radii atomic radii (N)
+     * @param[in] csize cell side length in Angstroms; may be increased for sparse inputs
+     */
+    CellList(const Grid<float, 2, false>& coords, const Grid<float, 1, false>& radii, float csize = 4.0) {
+      build(coords, radii, csize);
+    }
+
+    /// construct cell list over the atoms of a coordinate set
+    explicit CellList(const CoordinateSet& c, float csize = 4.0) {
+      build(c.coords.cpu(), c.radii.cpu(), csize);
+    }
+
+    /// (re)build the cell list for the provided coordinates and radii
+    void build(const Grid<float, 2, false>& coords, const Grid<float, 1, false>& radii, float csize = 4.0);
+
+    /// number of atoms indexed
+    size_t num_atoms() const { return natoms; }
+
+    /// largest atomic radius of indexed atoms
+    float get_max_radius() const { return max_radius; }
+
+    /// side length of cells
+    float get_cell_size() const { return cell_size; }
+
+    /** \brief Find atoms that may lie within an axis aligned box.
+     * Every atom whose coordinates are inside the box is returned, along with
+     * some nearby atoms that share a cell with the box.  Indices are returned in
+     * increasing order so that accumulation order matches iterating over all atoms.
+     * @param[in] lo minimum corner of box
+     * @param[in] hi maximum corner of box
+     * @param[out] out indices of atoms
+     */
+    void query(const float3& lo, const float3& hi, std::vector<unsigned>& out) const;
+};
+
+} /* namespace libmolgrid */
+
+#endif /* CELL_LIST_H_ */
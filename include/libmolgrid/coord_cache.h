@@ -10,28 +10,79 @@
 #include "libmolgrid/coordinateset.h"
 #include "libmolgrid/atom_typer.h"
 #include "libmolgrid/example.h"
+#include "libmolgrid/molcache.h"
 #include <boost/iostreams/device/mapped_file.hpp>
+#include <atomic>
+#include <functional>
+#include <mutex>
 
 namespace libmolgrid {
 
 /** \brief Load and cache molecular coordinates and atom types.
  *
- *  Precalculated molcache2 files are supported and are
+ *  Precalculated molcache2 and molcache3 files are supported and are
  *  memory mapped for efficient memory usage when running multiple
- *  training runs.
+ *  training runs.  Names are looked up in the on-disk index of molcache3
+ *  files and, if it has been created, of molcache2 files, so opening a
+ *  cache does not depend on the number of molecules.  molcache3 files are already typed, so coordinates are
+ *  returned as views of the memory map, and must have been created with
+ *  the same atom typer.
+ *
+ *  If struct_cache_dir is set, molecules read with openbabel are typed once and
+ *  stored there in a binary form that later runs and other processes reuse
+ *  until the molecule file is modified.  Modification is detected from the
+ *  file's size and modification time, at the resolution the filesystem records
+ *  (nanoseconds on most).  Entries that are truncated or inconsistent are ignored.
+ *
+ *  Coordinates returned from the in-memory cache share its memory, which is
+ *  copied the first time the returned set is modified.
+ *
+ *  set_coords may be called from multiple threads.  Copies of a CoordCache
+ *  share the same in-memory cache, so concurrent loaders only hold one copy
+ *  of each molecule.
  */
 class CoordCache {
-    using MemCache = std::unordered_map<const char*, CoordinateSet>;
-    MemCache memcache;
+    /** \brief Concurrent map from file names to coordinates.
+     * Names are spread over independently locked shards.  Each entry is
+     * loaded exactly once; other threads that want it wait for the load and
+     * then read it without locking.
+     */
+    class MemCache {
+        struct Entry {
+            std::mutex mtx; //held while loading
+            std::atomic<bool> ready{false};
+            CoordinateSet coords; //immutable once ready
+        };
+        struct Shard {
+            std::mutex mtx;
+            std::unordered_map<const char*, Entry> entries; //nodes are never moved
+        };
+        static const unsigned NUM_SHARDS = 64;
+        Shard shards[NUM_SHARDS];
+
+      public:
+        /// return the cached coordinates of fname, calling load to set them if this is the first request
+        const CoordinateSet& get(const char *fname, const std::function<void(CoordinateSet&)>& load);
+    };
+
+    std::shared_ptr<MemCache> memcache = std::make_shared<MemCache>();
     std::shared_ptr<AtomTyper> typer;
     std::string data_root;
     std::string molcache;
     bool use_cache = true; //is possible to disable caching
     bool addh = true; //protonate
+    std::string struct_cache_dir; //persistent cache of openbabel typed molecules, if set
+    std::string typer_identity; //identifies typer in struct_cache_dir keys
+
+    //for memory mapped cache, shared by copies
+    std::shared_ptr<MolCache2> molcache2;
+    std::shared_ptr<MolCache3> molcache3;
 
-    //for memory mapped cache
-    boost::iostreams::mapped_file_source cache_map;
-    std::unordered_map<const char*, size_t> offsets; //map from names to position in cache_map
+    //read fname from disk
+    void load_coords(const char *fname, CoordinateSet& coord) const;
+    //read/write the struct_cache_dir entry for molecule file fullname, returning false on a miss
+    bool read_struct_cache(const std::string& fullname, CoordinateSet& coord) const;
+    void write_struct_cache(const std::string& fullname, const CoordinateSet& coord) const;
 
   public:
     CoordCache() {}
@@ -49,6 +100,7 @@ class CoordCache {
     size_t type_size() const { return typer->num_types(); }
 
     std::vector<std::string> get_type_names() const { return typer->get_type_names(); }
+    bool is_thread_safe() const { return typer->is_thread_safe(); }
 };
 
 } /* namespace libmolgrid */
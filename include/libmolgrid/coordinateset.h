@@ -10,6 +10,8 @@
 #define COORDINATESET_H_
 
 
+#include <mutex>
+#include <string>
 #include <vector>
 #include <openbabel/mol.h>
 #include "libmolgrid/managed_grid.h"
@@ -94,6 +96,13 @@ struct CoordinateSet {
   ///return mean of coordinates
   float3 center() const;
 
+  ///remove atoms whose coordinates are farther than maxdist from c, returns number of atoms removed
+  ///storage is only reallocated if atoms are removed, so views of the original data remain valid
+  unsigned crop(const float3& c, float maxdist);
+
+  ///return largest atomic radius
+  float max_radius() const;
+
   void togpu(bool copy=true) { coords.togpu(copy); type_index.togpu(copy); type_vector.togpu(copy); radii.togpu(copy);}
   void tocpu(bool copy=true) { coords.tocpu(copy); type_index.tocpu(copy); type_vector.tocpu(copy); radii.tocpu(copy);}
 
@@ -131,6 +140,34 @@ extern template size_t CoordinateSet::copyTo(Grid<float, 2, true>& c, Grid<float
 extern template size_t CoordinateSet::copyTo(Grid<float, 2, false>& c, Grid<float, 2, false>& t, Grid<float, 1, false>& r) const;
 extern template size_t CoordinateSet::copyTo(Grid<float, 2, true>& c, Grid<float, 2, true>& t, Grid<float, 1, true>& r) const;
 
+/** \brief Mutex held by libmolgrid around every call that parses, protonates
+ * or types a molecule with openbabel.  OpenBabel 2 keeps perception state
+ * (aromaticity, atom types, protonation model) in process-wide globals that
+ * these calls modify, so they must not run concurrently.  Code that uses
+ * openbabel in threads alongside libmolgrid should hold this mutex as well.
+ */
+std::mutex& openbabel_mutex();
+
+/** \brief Read and type the molecule in file fname, adding hydrogens if addh
+ * is true.  The file is read without locking; parsing, protonation and typing
+ * are done while holding openbabel_mutex.
+ */
+CoordinateSet read_coordinate_set(const std::string& fname, const AtomTyper& typer, bool addh = true);
+
+/** \brief Read and type the molecules in fnames using nthreads threads (0 for
+ * all available), adding hydrogens if addh is true.  The typed atoms of all
+ * the molecules are stored in a single set of coordinate, type and radii
+ * buffers.  The returned coordinate sets, in the order of fnames, share these
+ * buffers and are copied on write.  Intended for bulk ingestion, such as
+ * building molcaches or screening large libraries.
+ *
+ * Only reading the files happens in parallel.  Because openbabel is not thread
+ * safe, parsing, protonation and typing hold openbabel_mutex, so when these
+ * dominate (small files on fast storage) extra threads give little speedup.
+ */
+std::vector<CoordinateSet> read_coordinate_sets(const std::vector<std::string>& fnames, const AtomTyper& typer,
+    bool addh = true, unsigned nthreads = 0);
+
 }
 
 
@@ -12,6 +12,9 @@
 #ifndef EXAMPLE_H_
 #define EXAMPLE_H_
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <unordered_set>
 #include "libmolgrid/coordinateset.h"
@@ -32,12 +35,22 @@ namespace libmolgrid {
     EXSET(float, stratify_step, 0, "step size for value stratification, together with min and max determines number of bins") \
     EXSET(int, group_batch_size, 1, "slice time series (groups) by batches of this size") \
     EXSET(int, max_group_size, 0, "maximum group size, all groups are padded out to this size; example file must contain group number in first column") \
+    EXSET(bool, stream_examples, false, "memory map example files and parse each line when it is drawn, so only line positions are kept in memory; can not be combined with balancing, stratification, or grouping") \
+    EXSET(int, num_parse_threads, 0, "number of threads used to parse example files (0 for all cores)") \
     EXSET(bool, cache_structs, true, "retain coordinates in memory for faster training") \
     EXSET(bool, add_hydrogens, true, "protonate read in molecule using openbabel") \
     EXSET(bool, duplicate_first, false, "clone the first coordinate set to be paired with each of the remaining (receptor-ligand pairs)") \
+    EXSET(float, crop_dimension, 0, "if positive, drop atoms of all but the last coordinate set that cannot contribute to a grid of this dimension centered on the last coordinate set") \
+    EXSET(float, crop_radius_multiple, 1.5, "extend crop distance by this multiple of the largest atomic radius; must be at least radius_scale times the final radius multiple of the GridMaker") \
+    EXSET(float, crop_padding, 0, "additional crop distance, e.g., sqrt(3) times the random translation applied to examples") \
+    EXSET(int, num_prefetch_threads, 0, "number of background threads that load batches ahead of next_batch; 0 loads examples on demand; atom typers must not be python callbacks") \
+    EXSET(int, prefetch_batches, 4, "maximum number of batches loaded ahead of next_batch when prefetching") \
+    EXSET(std::string, molcache_load, "willneed", "how molcache files are brought into memory: none (as accessed), willneed (read ahead in a background thread), populate (read in when opened), or hugepages (copied into private huge page backed memory when opened)") \
+    EXSET(bool, log_molcache_load, false, "print the time taken to load molcache files to stderr") \
     EXSET(std::string, data_root, "", "prefix for data files") \
-    EXSET(std::string, recmolcache, "", "precalculated molcache2 file for receptor (first molecule); if doesn't exist, will look in data _root") \
-    EXSET(std::string, ligmolcache, "", "precalculated molcache2 file for ligand; if doesn't exist, will look in data_root")
+    EXSET(std::string, struct_cache_dir, "", "if set, directory in which the typed coordinates of molecules read with openbabel are stored so later runs can skip openbabel; entries are keyed by file path, modification time, protonation and atom typer") \
+    EXSET(std::string, recmolcache, "", "precalculated molcache2 or molcache3 file for receptor (first molecule); if doesn't exist, will look in data _root") \
+    EXSET(std::string, ligmolcache, "", "precalculated molcache2 or molcache3 file for ligand; if doesn't exist, will look in data_root")
 
 /** Description of how examples should be provided
  * This provides configuration to example refs, extractors, and the provider itself
@@ -74,6 +87,15 @@ struct Example {
      */
     CoordinateSet merge_coordinates(unsigned start = 0, bool unique_index_types=true) const;
 
+    /** \brief Combine all coordinate sets into c, reusing the memory of c when it is large enough.
+     * The result has the same contents as merge_coordinates(start, unique_index_types).  Since its
+     * memory is overwritten, c must not share memory with another coordinate set.
+     * @param[out] c combined coordinate set
+     * @param[in] start ignore coordinates sets prior to this index (default zero)
+     * @param[in] unique_indexed_types if true, different coordinate sets will have unique, non-overlapping types
+     */
+    void merge_coordinates(CoordinateSet& c, unsigned start = 0, bool unique_index_types=true) const;
+
     /** \brief Combine all coordinate sets into one.
      * All coordinate sets must have index typing
      * @param[out] coords  combined coordinates
@@ -140,17 +162,62 @@ struct ExampleRef {
     ExampleRef(const std::string& line, int numlabels, bool hasgroup=false);
 };
 
+/** \brief The fields of a line of an example file, without interning file names.
+ * File names are (pointer, length) pairs into the parsed text.
+ */
+struct ExampleLine {
+    std::vector<float> labels;
+    std::vector<std::pair<const char*, size_t> > files;
+    int group = -1;
 
-//for memory efficiency, only store a given string once and use the const char*
+    /** \brief Parse the line [begin,end) - should have numlabels labels (negative to auto detect).
+     * Labels are read exactly as with a stringstream.  The text must be followed by
+     * a character that is not part of a number, such as whitespace or a terminating zero.
+     */
+    void parse(const char *begin, const char *end, int numlabels, bool hasgroup=false);
+
+  private:
+    std::vector<std::pair<const char*, size_t> > tokens;
+};
+
+
+/** \brief For memory efficiency, only store a given string once and use the const char*.
+ * Strings are copied into arenas and never move, so returned pointers remain
+ * valid for the life of the cache and equal strings have equal pointers.
+ * The table is split into independently locked shards, each looked up with
+ * a single probe sequence, so get may be called from multiple threads.
+ */
 class StringCache {
-  std::unordered_set<std::string> strings;
-public:
-  const char* get(const std::string& s)
-  {
-    strings.insert(s);
-    //we assume even as the set is resized that strings never get allocated
-    return strings.find(s)->c_str();
-  }
+    struct Slot {
+        uint64_t hash;
+        const char *str; //null if empty
+        size_t len;
+    };
+    struct Shard {
+        std::mutex mtx;
+        std::vector<Slot> table; //open addressing, at most half full
+        size_t count = 0;
+        std::vector<std::unique_ptr<char[]> > arenas;
+        char *next = nullptr; //unused part of last arena
+        size_t left = 0;
+
+        const char *copy(const char *s, size_t len);
+    };
+    static const unsigned NUM_SHARDS = 64;
+    Shard shards[NUM_SHARDS];
+    std::atomic<size_t> memory{0};
+    std::atomic<size_t> num_strings{0};
+
+  public:
+    /// return the interned copy of the len characters at s
+    const char* get(const char *s, size_t len);
+    const char* get(const std::string& s) { return get(s.c_str(), s.length()); }
+
+    /// number of distinct strings
+    size_t size() const { return num_strings; }
+
+    /// bytes allocated for strings and the table
+    size_t memory_usage() const { return memory; }
 };
 
 extern StringCache string_cache;
@@ -28,22 +28,41 @@ namespace libmolgrid {
 
  Can take multiple atom typers, in which case they are applied in order, with the last being repeated.
 
+ If crop_dimension is set, atoms of all but the last coordinate set that are too
+ far from the center of the last coordinate set to touch a grid of that dimension
+ (under any rotation) are discarded before the example is returned.  This assumes
+ the grid is centered on the last coordinate set, as is the default.  With
+ duplicate_first, each copy of the receptor is instead cropped around the
+ ligand it is paired with.
+
  */
 class ExampleExtractor {
 
     std::vector<CoordCache> coord_caches; //different typers have duplicated caches
     bool duplicate_poses = false;
+    float crop_dimension = 0; //if positive, crop all but last set to grid of this size
+    float crop_radius_multiple = 1.5;
+    float crop_padding = 0;
 
     size_t count_types(unsigned n) const;
+    void apply_settings(const ExampleProviderSettings& settings) {
+      duplicate_poses = settings.duplicate_first;
+      crop_dimension = settings.crop_dimension;
+      crop_radius_multiple = settings.crop_radius_multiple;
+      crop_padding = settings.crop_padding;
+    }
+    void crop(CoordinateSet& c, const float3& center) const;
   public:
 
     ExampleExtractor(const ExampleProviderSettings& settings, std::shared_ptr<AtomTyper> t) {
       coord_caches.push_back(CoordCache(t, settings, settings.recmolcache));
+      apply_settings(settings);
     }
 
     ExampleExtractor(const ExampleProviderSettings& settings, std::shared_ptr<AtomTyper> t1, std::shared_ptr<AtomTyper> t2) {
       coord_caches.push_back(CoordCache(t1, settings, settings.recmolcache));
       coord_caches.push_back(CoordCache(t2, settings, settings.ligmolcache));
+      apply_settings(settings);
     }
 
     ExampleExtractor(const ExampleProviderSettings& settings,
@@ -58,6 +77,7 @@ class ExampleExtractor {
           coord_caches.push_back(CoordCache(typrs[i], settings));
         }
       }
+      apply_settings(settings);
     }
 
     virtual ~ExampleExtractor() {}
@@ -76,6 +96,14 @@ class ExampleExtractor {
     ///return names of types for explicitly typed examples
     ///type names are prepended by coordinate set index
     virtual std::vector<std::string> get_type_names() const;
+
+    /// false if any atom typer can not be used from background threads
+    bool is_thread_safe() const {
+      for(const CoordCache& c : coord_caches) {
+        if(!c.is_thread_safe()) return false;
+      }
+      return true;
+    }
 };
 
 } /* namespace libmolgrid */
@@ -9,20 +9,44 @@
 #ifndef EXAMPLE_PROVIDER_H_
 #define EXAMPLE_PROVIDER_H_
 
+#include <deque>
+#include <mutex>
 #include "libmolgrid/example.h"
 #include "libmolgrid/exampleref_providers.h"
 #include "libmolgrid/example_extractor.h"
 
 namespace libmolgrid {
 
+class ExamplePrefetcher;
+
 /** \brief Given a file of examples, provide Example classes one at a time
  * This contains an exampleref provider, which can be configured using a
  * single settings object if so desired, and an example extractor.
+ *
+ * If num_prefetch_threads is set, next_batch loads up to prefetch_batches
+ * batches in background threads while the caller works on the current one.
+ * Example references are still drawn in the calling thread, so the sequence
+ * of examples is the same as without prefetching for a given random seed.
+ * Calling next or skip, or changing the batch size, stops the background
+ * threads; examples that were already drawn are returned first.  Atom typers
+ * that are not thread safe (python callbacks) can not be used with prefetching.
+ *
+ * next, next_batch and skip may be called concurrently from multiple threads,
+ * which share the provider's coordinate caches.  Copies share the example ref
+ * provider and the lock guarding it.
  */
 class ExampleProvider {
     std::shared_ptr<ExampleRefProvider> provider;
+    std::shared_ptr<std::mutex> ref_mutex; //guards provider, drawn and prefetcher; shared by copies
     ExampleExtractor extractor;
     ExampleProviderSettings init_settings; //save settings created with
+
+    std::unique_ptr<ExamplePrefetcher> prefetcher; //null if not prefetching
+    std::deque<ExampleRef> drawn; //refs taken from provider that have not been returned
+
+    void nextref(ExampleRef& ref);
+    void stop_prefetching();
+    void check_prefetch_typers() const;
   public:
 
     /// return provider as specifyed by settings
@@ -43,7 +67,11 @@ class ExampleProvider {
 
     /// use provided provider
     ExampleProvider(std::shared_ptr<ExampleRefProvider> p, const ExampleExtractor& e);
-    virtual ~ExampleProvider() {}
+
+    /// copies share the example ref provider but not prefetched examples
+    ExampleProvider(const ExampleProvider& rhs);
+    ExampleProvider& operator=(const ExampleProvider& rhs);
+    virtual ~ExampleProvider();
 
     ///load example file file fname and setup provider
     virtual void populate(const std::string& fname, int num_labels=-1);
@@ -14,17 +14,25 @@
 #include <type_traits>
 #include <unordered_map>
 #include <boost/lexical_cast.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include "libmolgrid/libmolgrid.h"
 #include "libmolgrid/example.h"
 
 namespace libmolgrid {
 
-/// abstract class for storing training example references
+/** \brief abstract class for storing training example references
+ * Example files are parsed in chunks by multiple threads; the refs are added
+ * in the order of the lines of the files regardless of the number of threads.
+ */
 class ExampleRefProvider {
+  protected:
+    unsigned num_parse_threads = 0; //0 for all cores
+    size_t parse_chunk_size = 1 << 20; //minimum bytes of text parsed per thread
+    size_t parse_block_size = 64 << 20; //maximum bytes of a file read at once
 
   public:
     ExampleRefProvider() {}
-    ExampleRefProvider(const ExampleProviderSettings& settings) {}
+    ExampleRefProvider(const ExampleProviderSettings& settings): num_parse_threads(std::max(settings.num_parse_threads, 0)) {}
     virtual void addref(const ExampleRef& ex) = 0;
     virtual void setup() = 0; //essentially shuffle if necessary
     virtual void nextref(ExampleRef& ex) = 0;
@@ -37,18 +45,37 @@ class ExampleRefProvider {
     virtual size_t num_labels() const = 0;  
     ///read in all the example refs from lines, but does not setup
     virtual int populate(std::istream& lines, int numlabels);
+    ///read in all the example refs of file fname, but does not setup
+    virtual int populate(const std::string& fname, int numlabels);
+    ///read in all the example refs of fnames, parsing the files concurrently, but does not setup
+    virtual int populate(const std::vector<std::string>& fnames, int numlabels);
+    ///set the minimum bytes parsed per thread and the maximum bytes read at once when populating
+    void set_parse_sizes(size_t chunk, size_t block) { parse_chunk_size = chunk; parse_block_size = block; }
 };
 
 
-///single array of examples, possibly shuffled
+/** \brief single array of examples, possibly shuffled
+ * Examples are stored as flat tables of file names and labels rather than as
+ * individual ExampleRefs.  If every example has the same number of files and
+ * labels, the tables have a fixed stride; otherwise the start of each
+ * example is recorded.  Shuffling permutes an array of example indices.
+ */
 class UniformExampleRefProvider: public ExampleRefProvider
 {
-  std::vector<ExampleRef> all;
+  std::vector<const char*> files; //file names of all examples
+  std::vector<float> labels; //labels of all examples
+  std::vector<int> groups;
+  std::vector<size_t> file_start, label_start; //only if strides are not fixed, size()+1 entries
+  size_t file_stride = 0, label_stride = 0;
+  std::vector<uint32_t> order; //indices of examples in the order they are provided
   size_t current = 0;
   size_t nlabels = 0;
 
   bool randomize = false;
 
+  size_t files_begin(size_t i) const { return file_start.size() ? file_start[i] : i * file_stride; }
+  size_t labels_begin(size_t i) const { return label_start.size() ? label_start[i] : i * label_stride; }
+
 public:
   UniformExampleRefProvider() {}
   UniformExampleRefProvider(const ExampleProviderSettings& settings): ExampleRefProvider(settings),
@@ -58,8 +85,47 @@ public:
   void addref(const ExampleRef& ex);
   virtual size_t num_labels() const { return nlabels; }
   void setup();
+  /// set ex to the next example, reusing the memory of its vectors
+  void nextref(ExampleRef& ex);
+  unsigned size() const { return groups.size(); }
+};
+
+
+/** \brief Single array of examples that are parsed only when drawn.
+ * Example files are memory mapped and only the position of each line is
+ * kept in memory (8 bytes per example), so files larger than memory can be
+ * used.  Shuffling permutes the line positions.  Examples must be read from
+ * files with populate(fname, numlabels); they can not be added as refs.
+ */
+class StreamingExampleRefProvider: public ExampleRefProvider
+{
+  static const unsigned FILE_BITS = 16; //high bits of line position select the file
+  static const uint64_t OFFSET_MASK = (1ULL << (64 - FILE_BITS)) - 1;
+
+  std::vector<boost::iostreams::mapped_file_source> files;
+  std::vector<int> file_numlabels; //numlabels each file was populated with
+  std::vector<uint64_t> lines; //file index and offset of each line
+  size_t current = 0;
+  size_t nlabels = 0;
+
+  bool randomize = false;
+
+  ExampleRef parse(uint64_t line) const;
+
+public:
+  StreamingExampleRefProvider() {}
+  StreamingExampleRefProvider(const ExampleProviderSettings& settings): ExampleRefProvider(settings),
+      current(0), randomize(settings.shuffle) {
+  }
+
+  void addref(const ExampleRef& ex);
+  virtual int populate(std::istream& lines, int numlabels);
+  virtual int populate(const std::string& fname, int numlabels);
+  virtual int populate(const std::vector<std::string>& fnames, int numlabels);
+  virtual size_t num_labels() const { return nlabels; }
+  void setup();
   void nextref(ExampleRef& ex);
-  unsigned size() const { return all.size(); }
+  unsigned size() const { return lines.size(); }
 };
 
 
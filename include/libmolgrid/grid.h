@@ -328,10 +328,20 @@ class Grid<Dtype,1,isCUDA> {
 typedef Grid<float, SIZE, false> Grid##SIZE##f; \
 typedef Grid<double, SIZE, false> Grid##SIZE##d; \
 typedef Grid<float, SIZE, true> Grid##SIZE##fCUDA; \
-typedef Grid<double, SIZE, true> Grid##SIZE##dCUDA;
+typedef Grid<double, SIZE, true> Grid##SIZE##dCUDA; \
+typedef Grid<__half, SIZE, false> Grid##SIZE##h; \
+typedef Grid<__half, SIZE, true> Grid##SIZE##hCUDA;
 
 BOOST_PP_REPEAT_FROM_TO(1,LIBMOLGRID_MAX_GRID_DIM, EXPAND_GRID_DEFINITIONS, 0);
 
+#ifdef LIBMOLGRID_BFLOAT16
+#define EXPAND_BF16_GRID_DEFINITIONS(Z,SIZE,_) \
+typedef Grid<__nv_bfloat16, SIZE, false> Grid##SIZE##bf; \
+typedef Grid<__nv_bfloat16, SIZE, true> Grid##SIZE##bfCUDA;
+
+BOOST_PP_REPEAT_FROM_TO(1,LIBMOLGRID_MAX_GRID_DIM, EXPAND_BF16_GRID_DEFINITIONS, 0);
+#endif
+
 }
 
 #endif /* GRID_H_ */
@@ -12,11 +12,15 @@
 #include <vector>
 #include <array>
 #include <algorithm>
+#include <type_traits>
 #include <cuda_runtime.h>
 #include "libmolgrid/coordinateset.h"
 #include "libmolgrid/grid.h"
 #include "libmolgrid/example.h"
 #include "libmolgrid/transform.h"
+#include "libmolgrid/cell_list.h"
+#include "libmolgrid/atom_footprints.h"
+#include "libmolgrid/sparse_grid.h"
 
 namespace libmolgrid {
 
@@ -29,6 +33,10 @@ namespace libmolgrid {
  * must be passed the grid_center (which may have changed due to
  * transformations performed directly on the atom coordinates externally to
  * this class)
+ *
+ * forward can also output half precision (__half) and bfloat16 grids.
+ * Densities are accumulated in fp32 and only rounded when stored, so these
+ * grids equal the rounded float grid.
  */
 class GridMaker {
   protected:
@@ -44,6 +52,7 @@ class GridMaker {
     float D,E; //precalculate coefficients for backprop
     bool binary; /// use binary occupancy instead of real-valued atom density
     unsigned dim; /// grid width in points
+    unsigned num_threads = 1; /// number of threads to use for cpu grid generation (0 for all available)
 
     template<typename Dtype, bool isCUDA>
     void check_index_args(const Grid<float, 2, isCUDA>& coords,
@@ -54,6 +63,71 @@ class GridMaker {
     void check_vector_args(const Grid<float, 2, isCUDA>& coords,
         const Grid<float, 2, isCUDA>& type_vector, const Grid<float, 1, isCUDA>& radii,
         Grid<Dtype, 4, isCUDA>& out) const;
+
+    //grid a batch of examples on the cpu, each example by a single thread
+    template <typename Dtype>
+    void forward_batch(const std::vector<Example>& in, Grid<Dtype, 5, false>& out,
+        float random_translation, bool random_rotation, std::false_type) const;
+
+    //grid a batch of examples on the gpu one at a time
+    template <typename Dtype>
+    void forward_batch(const std::vector<Example>& in, Grid<Dtype, 5, true>& out,
+        float random_translation, bool random_rotation, std::true_type) const {
+      for(unsigned i = 0, n = in.size(); i < n; i++) {
+        Grid<Dtype, 4, true> g(out[i]);
+        forward<Dtype,true>(in[i],g, random_translation, random_rotation);
+      }
+    }
+
+    //set cpu densities of index typed atoms for the slab of grid points with first spatial index in [imin,imax)
+    //only the natoms atoms listed in atoms are considered, or the first natoms atoms if atoms is null
+    //out is either the whole grid or holds just the imax-imin planes of the slab for every type
+    template<typename Dtype>
+    void set_atoms_cpu(size_t imin, size_t imax, const float3& grid_origin, const unsigned *atoms, size_t natoms,
+        const Grid<float, 2, false>& coords, const Grid<float, 1, false>& type_index,
+        const Grid<float, 1, false>& radii, Grid<Dtype, 4, false>& out) const;
+
+    //set cpu densities of vector typed atoms for the slab of grid points with first spatial index in [imin,imax)
+    template<typename Dtype>
+    void set_atoms_cpu(size_t imin, size_t imax, const float3& grid_origin, const unsigned *atoms, size_t natoms,
+        const Grid<float, 2, false>& coords, const Grid<float, 2, false>& type_vector,
+        const Grid<float, 1, false>& radii, Grid<Dtype, 4, false>& out) const;
+
+    //return the atoms that may overlap the grid at grid_origin and update natoms to their number
+    //returns null (all natoms atoms) if cells is null; buffer holds the returned indices
+    const unsigned* select_atoms_cpu(const float3& grid_origin, const CellList *cells, size_t& natoms,
+        std::vector<unsigned>& buffer) const;
+
+    //compute footprints of the listed atoms (in increasing order) that overlap the grid at grid_origin,
+    //returns false without storing them if they would exceed the footprints' max_points
+    bool record_footprints_cpu(const float3& grid_origin, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& radii, const std::vector<unsigned>& atoms, AtomFootprints& fp) const;
+
+    //throw if footprints weren't computed for natoms atoms and the grid at grid_origin
+    void check_footprints(const AtomFootprints& fp, const float3& grid_origin, size_t natoms) const;
+
+    //cpu implementations, cells may be null
+    template <typename Dtype>
+    void forward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+        const CellList *cells, Grid<Dtype, 4, false>& out) const;
+    template <typename Dtype>
+    void forward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+        const CellList *cells, Grid<Dtype, 4, false>& out) const;
+    template <typename Dtype>
+    void backward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList *cells,
+        const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const;
+    template <typename Dtype>
+    void backward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const CellList *cells,
+        const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const;
+    template <typename Dtype>
+    void backward_relevance_cpu(float3 grid_center,  const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList *cells,
+        const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 1, false>& relevance) const;
   public:
 
     GridMaker(float res = 0, float d = 0, bool bin = false, float rscale=1.0, float grm = 1.0) :
@@ -95,6 +169,11 @@ class GridMaker {
     ///set if density is binary
     CUDA_CALLABLE_MEMBER void set_binary(bool b) { binary = b; }
 
+    ///return number of threads used for cpu grid generation (0 for all available)
+    CUDA_CALLABLE_MEMBER unsigned get_num_threads() const { return num_threads; }
+    ///set number of threads used for cpu grid generation (0 for all available); the result does not depend on this
+    CUDA_CALLABLE_MEMBER void set_num_threads(unsigned n) { num_threads = n; }
+
     ///return multiplier of radius where density goes to zero
     CUDA_CALLABLE_MEMBER float get_radiusmultiple() const { return radius_scale*final_radius_multiple; }
 
@@ -119,6 +198,47 @@ class GridMaker {
       }
     }
 
+    /* \brief Generate grid tensor from atomic data, only considering atoms near the grid.  Grid (CPU) must be properly sized.
+     * @param[in] center of grid
+     * @param[in] coordinate set
+     * @param[in] cells cell list built from in
+     * @param[out] a 4D grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const CoordinateSet& in, const CellList& cells, Grid<Dtype, 4, false>& out) const {
+      if(in.has_indexed_types()) {
+        forward(grid_center, in.coords.cpu(), in.type_index.cpu(), in.radii.cpu(), cells, out);
+      } else {
+        forward(grid_center, in.coords.cpu(), in.type_vector.cpu(), in.radii.cpu(), cells, out);
+      }
+    }
+
+    /* \brief Generate grid tensor from atomic data and record the footprint of
+     * every atom for use in backward.  Grid (CPU) must be properly sized.
+     * @param[in] center of grid
+     * @param[in] coordinate set
+     * @param[out] footprints densities of each atom, reused by backward
+     * @param[out] a 4D grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const CoordinateSet& in, AtomFootprints& footprints, Grid<Dtype, 4, false>& out) const {
+      if(in.has_indexed_types()) {
+        forward(grid_center, in.coords.cpu(), in.type_index.cpu(), in.radii.cpu(), footprints, out);
+      } else {
+        forward(grid_center, in.coords.cpu(), in.type_vector.cpu(), in.radii.cpu(), footprints, out);
+      }
+    }
+
+    /* \brief Generate a channel-sparse grid from atomic data.  Only the channels
+     * of types that have an atom overlapping the grid are computed and stored;
+     * out is resized as needed. (CPU)
+     * @param[in] center of grid
+     * @param[in] coordinate set
+     * @param[out] sparse grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const CoordinateSet& in, ChannelSparseGrid<Dtype>& out) const;
+
     /* \brief Generate grid tensor from atomic data.  Grid (GPU) must be properly sized.
      * @param[in] center of grid
      * @param[in] coordinate set
@@ -163,7 +283,8 @@ class GridMaker {
      * Coordinates may be optionally translated/rotated.  Do not use this function
      * if it is desirable to retain the transformation used (e.g., when backpropagating).
      * The center of the last coordinate set before transformation
-     * will be used as the grid center.
+     * will be used as the grid center.  On the CPU, examples are gridded
+     * concurrently using get_num_threads() threads.
      *
      * @param[in] ex example
      * @param[in] transform transformation to apply
@@ -174,14 +295,12 @@ class GridMaker {
     template <typename Dtype, bool isCUDA>
     void forward(const std::vector<Example>& in, Grid<Dtype, 5, isCUDA>& out, float random_translation=0.0, bool random_rotation = false) const {
       if(in.size() != out.dimension(0)) throw std::out_of_range("output grid dimension does not match size of example vector");
-      for(unsigned i = 0, n = in.size(); i < n; i++) {
-        Grid<Dtype, 4, isCUDA> g(out[i]);
-        forward<Dtype,isCUDA>(in[i],g, random_translation, random_rotation);
-      }
+      forward_batch(in, out, random_translation, random_rotation, std::integral_constant<bool, isCUDA>());
     }
 
 
     /* \brief Generate grid tensor from CPU atomic data.  Grid must be properly sized.
+     * Work is split across get_num_threads() threads.
      * @param[in] center of grid
      * @param[in] coordinates (Nx3)
      * @param[in] type indices (N integers stored as floats)
@@ -193,6 +312,34 @@ class GridMaker {
         const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
         Grid<Dtype, 4, false>& out) const;
 
+    /* \brief Generate grid tensor from CPU atomic data, only considering atoms
+     * the cell list places near the grid.  Grid must be properly sized.
+     * @param[in] center of grid
+     * @param[in] coordinates (Nx3)
+     * @param[in] type indices (N integers stored as floats)
+     * @param[in] radii (N)
+     * @param[in] cells cell list built from coordinates and radii
+     * @param[out] a 4D grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+        const CellList& cells, Grid<Dtype, 4, false>& out) const;
+
+    /* \brief Generate grid tensor from CPU atomic data and record the footprint
+     * of every atom for use in backward.  Grid must be properly sized.
+     * @param[in] center of grid
+     * @param[in] coordinates (Nx3)
+     * @param[in] type indices (N integers stored as floats)
+     * @param[in] radii (N)
+     * @param[out] footprints densities of each atom, reused by backward
+     * @param[out] a 4D grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+        AtomFootprints& footprints, Grid<Dtype, 4, false>& out) const;
+
     /* \brief Generate grid tensor from GPU atomic data.  Grid must be properly sized.
      * @param[in] center of grid
      * @param[in] coordinates (Nx3)
@@ -207,6 +354,7 @@ class GridMaker {
         
         
     /* \brief Generate grid tensor from CPU atomic data.  Grid must be properly sized.
+     * Work is split across get_num_threads() threads.
      * @param[in] center of grid
      * @param[in] coordinates (Nx3)
      * @param[in] type vectors (NxT)
@@ -218,6 +366,34 @@ class GridMaker {
         const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
         Grid<Dtype, 4, false>& out) const;
 
+    /* \brief Generate grid tensor from CPU atomic data, only considering atoms
+     * the cell list places near the grid.  Grid must be properly sized.
+     * @param[in] center of grid
+     * @param[in] coordinates (Nx3)
+     * @param[in] type vectors (NxT)
+     * @param[in] radii (N)
+     * @param[in] cells cell list built from coordinates and radii
+     * @param[out] a 4D grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+        const CellList& cells, Grid<Dtype, 4, false>& out) const;
+
+    /* \brief Generate grid tensor from CPU atomic data with type vectors and
+     * record the footprint of every atom for use in backward.  Grid must be properly sized.
+     * @param[in] center of grid
+     * @param[in] coordinates (Nx3)
+     * @param[in] type vectors (NxT)
+     * @param[in] radii (N)
+     * @param[out] footprints densities of each atom, reused by backward
+     * @param[out] a 4D grid
+     */
+    template <typename Dtype>
+    void forward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+        AtomFootprints& footprints, Grid<Dtype, 4, false>& out) const;
+
     /* \brief Generate grid tensor from GPU atomic data.  Grid must be properly sized.
      * @param[in] center of grid
      * @param[in] coordinates (Nx3)
@@ -268,6 +444,84 @@ class GridMaker {
       }
     }
 
+    /* \brief Generate atom and type gradients from grid gradients, only considering atoms near the grid. (CPU)
+     * Gradients of all other atoms are zero.
+     * Vector types are required.
+     * @param[in] center of grid
+     * @param[in] in coordinate set
+     * @param[in] cells cell list built from in
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     * @param[out] type_gradients only set if input has type vectors
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const CoordinateSet& in, const CellList& cells, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 2, false>& atomic_gradients, Grid<Dtype, 2, false>& type_gradients) const {
+      if(in.has_vector_types()) {
+        backward(grid_center, in.coords.cpu(), in.type_vector.cpu(), in.radii.cpu(), cells, diff, atomic_gradients, type_gradients);
+      } else {
+        throw std::invalid_argument("Vector types missing from coordinate set");
+      }
+    }
+
+    /* \brief Generate atom gradients from grid gradients, only considering atoms near the grid. (CPU)
+     * Gradients of all other atoms are zero.
+     * Index types are required
+     * @param[in] center of grid
+     * @param[in] in coordinate set
+     * @param[in] cells cell list built from in
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const CoordinateSet& in, const CellList& cells, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 2, false>& atomic_gradients) const {
+      if(in.has_indexed_types()) {
+        backward(grid_center, in.coords.cpu(), in.type_index.cpu(), in.radii.cpu(), cells, diff, atomic_gradients);
+      } else {
+        throw std::invalid_argument("Index types missing from coordinate set");
+      }
+    }
+
+    /* \brief Generate atom and type gradients from grid gradients using the
+     * footprints recorded by forward. (CPU)
+     * Vector types are required.
+     * @param[in] center of grid
+     * @param[in] in coordinate set
+     * @param[in] footprints recorded by forward with the same center and coordinates
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     * @param[out] type_gradients only set if input has type vectors
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const CoordinateSet& in, const AtomFootprints& footprints, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 2, false>& atomic_gradients, Grid<Dtype, 2, false>& type_gradients) const {
+      if(in.has_vector_types()) {
+        backward(grid_center, in.coords.cpu(), in.type_vector.cpu(), in.radii.cpu(), footprints, diff, atomic_gradients, type_gradients);
+      } else {
+        throw std::invalid_argument("Vector types missing from coordinate set");
+      }
+    }
+
+    /* \brief Generate atom gradients from grid gradients using the footprints
+     * recorded by forward. (CPU)
+     * Index types are required
+     * @param[in] center of grid
+     * @param[in] in coordinate set
+     * @param[in] footprints recorded by forward with the same center and coordinates
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const CoordinateSet& in, const AtomFootprints& footprints, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 2, false>& atomic_gradients) const {
+      if(in.has_indexed_types()) {
+        backward(grid_center, in.coords.cpu(), in.type_index.cpu(), in.radii.cpu(), footprints, diff, atomic_gradients);
+      } else {
+        throw std::invalid_argument("Index types missing from coordinate set");
+      }
+    }
+
     /* \brief Generate atom and type gradients from grid gradients. (GPU)
      * Must provide atom coordinates that defined the original grid in forward
      * Vector types are required.
@@ -319,6 +573,36 @@ class GridMaker {
         const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
         const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const;
 
+    /* \brief Generate atom gradients from grid gradients, only considering atoms
+     * the cell list places near the grid; gradients of all other atoms are zero. (CPU)
+     * @param[in] center of grid
+     * @param[in] coordinates (Nx3)
+     * @param[in] type indices (N integers stored as floats)
+     * @param[in] radii (N)
+     * @param[in] cells cell list built from coordinates and radii
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList& cells,
+        const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const;
+
+    /* \brief Generate atom gradients from grid gradients using the footprints
+     * recorded by forward; gradients of atoms outside the grid are zero. (CPU)
+     * @param[in] center of grid
+     * @param[in] coordinates (Nx3)
+     * @param[in] type indices (N integers stored as floats)
+     * @param[in] radii (N)
+     * @param[in] footprints recorded by forward with the same center and coordinates
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+        const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const;
+
     /* \brief Generate atom gradients from grid gradients. (GPU)
      * Must provide atom coordinates, types, and radii that defined the original grid in forward
      * @param[in] center of grid
@@ -349,6 +633,40 @@ class GridMaker {
         const Grid<Dtype, 4, false>& diff,
         Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const;
 
+    /* \brief Generate atom and type gradients from grid gradients, only considering atoms
+     * the cell list places near the grid; gradients of all other atoms are zero. (CPU)
+     * @param[in] center of grid
+     * @param[in] coordinates  (Nx3)
+     * @param[in] type vectors (NxT)
+     * @param[in] radii (N)
+     * @param[in] cells cell list built from coordinates and radii
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     * @param[out] type_gradients vector quantities for each atom
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 2, false>& type_vectors, const Grid<float, 1, false>& radii, const CellList& cells,
+        const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const;
+
+    /* \brief Generate atom and type gradients from grid gradients using the footprints
+     * recorded by forward; gradients of atoms outside the grid are zero. (CPU)
+     * @param[in] center of grid
+     * @param[in] coordinates  (Nx3)
+     * @param[in] type vectors (NxT)
+     * @param[in] radii (N)
+     * @param[in] footprints recorded by forward with the same center and coordinates
+     * @param[in] diff a 4D grid of gradients
+     * @param[out] atomic_gradients vector quantities for each atom
+     * @param[out] type_gradients vector quantities for each atom
+     */
+    template <typename Dtype>
+    void backward(float3 grid_center, const Grid<float, 2, false>& coords,
+        const Grid<float, 2, false>& type_vectors, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+        const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const;
+
     /* \brief Generate atom gradients from grid gradients. (GPU)
      * Must provide atom coordinates, types, and radii that defined the original grid in forward
      * @param[in] center of grid
@@ -385,6 +703,46 @@ class GridMaker {
       }
     }
 
+    /* \brief Propagate relevance (in diff) onto atoms, only considering atoms near the grid. (CPU)
+     * Relevance of all other atoms is zero.  Index types are required.
+     * @param[in] center of grid
+     * @param[in] in coordinate set
+     * @param[in] cells cell list built from in
+     * @param[in] density a 4D grid of densities (used in forward)
+     * @param[in] diff a 4D grid of relevance
+     * @param[out] relevance score for each atom
+     */
+    template <typename Dtype>
+    void backward_relevance(float3 grid_center, const CoordinateSet& in, const CellList& cells,
+        const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 1, false>& relevance) const {
+      if(in.has_indexed_types()) {
+        backward_relevance(grid_center, in.coords.cpu(), in.type_index.cpu(), in.radii.cpu(), cells, density, diff, relevance);
+      } else {
+        throw std::invalid_argument("Index types missing from coordinate set in backward relevance");
+      }
+    }
+
+    /* \brief Propagate relevance (in diff) onto atoms using the footprints recorded by forward. (CPU)
+     * Index types are required.
+     * @param[in] center of grid
+     * @param[in] in coordinate set
+     * @param[in] footprints recorded by forward with the same center and coordinates
+     * @param[in] density a 4D grid of densities (used in forward)
+     * @param[in] diff a 4D grid of relevance
+     * @param[out] relevance score for each atom
+     */
+    template <typename Dtype>
+    void backward_relevance(float3 grid_center, const CoordinateSet& in, const AtomFootprints& footprints,
+        const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 1, false>& relevance) const {
+      if(in.has_indexed_types()) {
+        backward_relevance(grid_center, in.coords.cpu(), in.type_index.cpu(), in.radii.cpu(), footprints, density, diff, relevance);
+      } else {
+        throw std::invalid_argument("Index types missing from coordinate set in backward relevance");
+      }
+    }
+
     /* \brief Propagate relevance (in diff) onto atoms. (GPU)
      * Index types are required.
      * @param[in] center of grid
@@ -420,6 +778,40 @@ class GridMaker {
         const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
         Grid<Dtype, 1, false>& relevance) const;
 
+    /* \brief Propagate relevance (in diff) onto atoms, only considering atoms
+     * the cell list places near the grid; relevance of all other atoms is zero. (CPU)
+     * @param[in] center of grid
+     * @param[in] coords coordinates
+     * @param[in] type_index
+     * @param[in] radii
+     * @param[in] cells cell list built from coordinates and radii
+     * @param[in] density a 4D grid of densities (used in forward)
+     * @param[in] diff a 4D grid of relevance
+     * @param[out] relevance score for each atom
+     */
+    template <typename Dtype>
+    void backward_relevance(float3 grid_center,  const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList& cells,
+        const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 1, false>& relevance) const;
+
+    /* \brief Propagate relevance (in diff) onto atoms using the footprints
+     * recorded by forward; relevance of atoms outside the grid is zero. (CPU)
+     * @param[in] center of grid
+     * @param[in] coords coordinates
+     * @param[in] type_index
+     * @param[in] radii
+     * @param[in] footprints recorded by forward with the same center and coordinates
+     * @param[in] density a 4D grid of densities (used in forward)
+     * @param[in] diff a 4D grid of relevance
+     * @param[out] relevance score for each atom
+     */
+    template <typename Dtype>
+    void backward_relevance(float3 grid_center,  const Grid<float, 2, false>& coords,
+        const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+        const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+        Grid<Dtype, 1, false>& relevance) const;
+
     /* \brief Propagate relevance (in diff) onto atoms. (GPU)
      * Index types are required.
      * @param[in] center of grid
@@ -469,9 +861,11 @@ class GridMaker {
     template <typename Dtype>
     float3 calc_atom_gradient_cpu(const float3& grid_origin, const Grid1f& coord, const Grid<Dtype, 3, false>& diff, float radius) const;
 
-    //calculate gradient of type for type vector case
+    //calculate atomic gradient and gradients of all types for type vector case in a single pass - cpu
+    //tmult and tgrad have one entry per channel of diff
     template <typename Dtype>
-    float calc_type_gradient_cpu(const float3& grid_origin, const Grid1f& coord, const Grid<Dtype, 3, false>& diff, float radius) const;
+    float3 calc_atom_type_gradients_cpu(const float3& grid_origin, const Grid1f& coord, const float *tmult,
+        const Grid<Dtype, 4, false>& diff, float radius, float *tgrad) const;
 
 
     //calculate atomic relevance for single atom - cpu
@@ -498,6 +892,19 @@ class GridMaker {
     CUDA_CALLABLE_MEMBER float calc_point(float ax, float ay, float az, float ar,
         const float3& grid_coords) const;
 
+    /* \brief Calculate non-binary atom density along a row of grid points in the last dimension (CPU).
+     * Uses the widest SIMD instructions supported by the processor, so values
+     * may differ from calc_point in the last few bits.
+     * @param[in] az atomic coordinate in the last dimension
+     * @param[in] ar atomic radius
+     * @param[in] dxy2 squared distance between the atom and the row in the first two dimensions
+     * @param[in] origin grid origin in the last dimension
+     * @param[in] kbegin index of the first grid point of the row
+     * @param[in] n number of grid points
+     * @param[out] vals densities at the n grid points
+     */
+    void calc_row_cpu(float az, float ar, float dxy2, float origin, unsigned kbegin, unsigned n, float *vals) const;
+
     //accumulate gradient from grid point x,y,z for provided atom at ax,ay,az
     CUDA_CALLABLE_MEMBER void accumulate_atom_gradient(float ax, float ay, float az,
             float x, float y, float z, float radius, float gridval, float3& agrad) const;
@@ -11,6 +11,18 @@
 #include <iostream>
 #include <boost/lexical_cast.hpp>
 #include <cuda_runtime.h>
+#include <cuda_fp16.h>
+
+//bfloat16 grids require CUDA 11
+#if CUDART_VERSION >= 11000
+#include <cuda_bf16.h>
+#define LIBMOLGRID_BFLOAT16
+#endif
+
+//host arithmetic operators for __half and __nv_bfloat16 require CUDA 12.2
+#if CUDART_VERSION >= 12020
+#define LIBMOLGRID_HOST_REDUCED_OPS
+#endif
 
 // dimensionalities up to but not including LIBMOLGRID_MAX_GRID_DIM are pre-instantiated
 #define LIBMOLGRID_MAX_GRID_DIM 9
@@ -24,6 +24,8 @@ template<typename Dtype>
 struct mgrid_buffer_data {
     Dtype *gpu_ptr;
     bool sent_to_gpu;
+    Dtype *host_ptr; //current cpu memory, changes when external memory is copied on write
+    bool readonly; //host_ptr is external memory that must be copied before it is modified
 };
 
 /** \brief ManagedGrid base class */
@@ -39,8 +41,8 @@ class ManagedGridBase {
 
     //two different views of the same memory
     mutable gpu_grid_t gpu_grid; //treated as a cache
-    cpu_grid_t cpu_grid;
-    std::shared_ptr<Dtype> cpu_ptr; //shared pointer lets us not worry about copying the grid
+    mutable cpu_grid_t cpu_grid; //updated by sync_cpu
+    mutable std::shared_ptr<Dtype> cpu_ptr; //shared pointer lets us not worry about copying the grid
     size_t capacity = 0; //amount of memory allocated (for resizing)
 
     using buffer_data = mgrid_buffer_data<Dtype>;
@@ -72,6 +74,44 @@ class ManagedGridBase {
       gpu_info = (buffer_data*)buffer;
       gpu_info->gpu_ptr = nullptr;
       gpu_info->sent_to_gpu = false;
+      gpu_info->host_ptr = cpu_data;
+      gpu_info->readonly = false;
+    }
+
+    //use sz elements of external memory at data as the cpu pointer without copying it,
+    //owner is kept alive until the last grid sharing the memory is destroyed
+    void set_external_cpu(std::shared_ptr<const void> owner, const Dtype *data, size_t sz) {
+      buffer_data *info = new buffer_data{nullptr, false, const_cast<Dtype*>(data), sz > 0};
+      cpu_ptr = std::shared_ptr<Dtype>(info->host_ptr, [info, owner](Dtype *ptr) {
+        if(info->host_ptr != ptr) free(info->host_ptr); //copied on write
+        if(info->gpu_ptr != nullptr) cudaFree(info->gpu_ptr);
+        delete info;
+      });
+      cpu_grid.set_buffer(cpu_ptr.get());
+      gpu_info = info;
+    }
+
+    //point this grid at the current cpu memory of the buffer, which another grid
+    //sharing the buffer may have replaced by copying external memory on write
+    void sync_cpu() const {
+      if(gpu_info && gpu_info->host_ptr != cpu_ptr.get()) {
+        size_t offset = cpu_grid.data() - cpu_ptr.get(); //might be subgrid
+        cpu_ptr = std::shared_ptr<Dtype>(cpu_ptr, gpu_info->host_ptr);
+        cpu_grid.set_buffer(gpu_info->host_ptr + offset);
+      }
+    }
+
+    //copy external memory before cpu data is modified, contents are only preserved if copy is true
+    void make_writable(bool copy=true) const {
+      sync_cpu();
+      if(gpu_info && gpu_info->readonly) {
+        Dtype *mem = (Dtype*)malloc(capacity*sizeof(Dtype));
+        if(!mem) throw std::runtime_error("Could not allocate "+itoa(capacity*sizeof(Dtype))+" bytes of CPU memory in ManagedGrid");
+        if(copy) memcpy(mem, gpu_info->host_ptr, capacity*sizeof(Dtype));
+        gpu_info->host_ptr = mem;
+        gpu_info->readonly = false;
+        sync_cpu();
+      }
     }
 
     //allocate and set gpu_ptr and grid, does not initialize memory, should not be called if memory is already allocated
@@ -99,11 +139,19 @@ class ManagedGridBase {
       gpu_info->sent_to_gpu = false;
     }
 
+    template<typename... I, typename = typename std::enable_if<sizeof...(I) == NumDims>::type>
+    ManagedGridBase(std::shared_ptr<const void> owner, const Dtype *data, I... sizes):
+      gpu_grid(nullptr, sizes...), cpu_grid(nullptr, sizes...) {
+      capacity = this->size();
+      set_external_cpu(owner, data, capacity);
+    }
+
     //helper for clone, allocate new memory and copies contents of current ptr into it
     void clone_ptrs() {
       if(capacity == 0) {
         return;
       }
+      sync_cpu();
 
       //duplicate cpu memory and set sent_to_gpu
       std::shared_ptr<Dtype> old = cpu_ptr;
@@ -136,7 +184,10 @@ class ManagedGridBase {
     /// set contents to zero
     inline void fill_zero() {
       if(ongpu()) gpu_grid.fill_zero();
-      else cpu_grid.fill_zero();
+      else {
+        make_writable(false); //contents are overwritten, so external memory needn't be copied
+        cpu_grid.fill_zero();
+      }
     }
 
     /** \brief Initializer list indexing
@@ -145,6 +196,7 @@ class ManagedGridBase {
     template<typename... I>
     inline Dtype& operator()(I... indices) {
       tocpu();
+      make_writable();
       return cpu_grid(indices...);
     }
 
@@ -158,6 +210,7 @@ class ManagedGridBase {
     size_t copyTo(cpu_grid_t& dest) const {
       size_t sz = std::min(size(), dest.size());
       if(sz == 0) return 0;
+      sync_cpu();
       if(ongpu()) {
         LMG_CUDA_CHECK(cudaMemcpy(dest.data(), gpu_grid.data(), sz*sizeof(Dtype), cudaMemcpyDeviceToHost));
       } else { //host ot host
@@ -170,6 +223,7 @@ class ManagedGridBase {
     size_t copyTo(gpu_grid_t& dest) const {
       size_t sz = std::min(size(), dest.size());
       if(sz == 0) return 0;
+      sync_cpu();
       if(ongpu()) {
         LMG_CUDA_CHECK(cudaMemcpy(dest.data(),gpu_grid.data(),sz*sizeof(Dtype),cudaMemcpyDeviceToDevice));
       } else {
@@ -194,6 +248,7 @@ class ManagedGridBase {
       if(ongpu()) {
        LMG_CUDA_CHECK(cudaMemcpy(gpu_grid.data(), src.data(), sz*sizeof(Dtype), cudaMemcpyHostToDevice));
       } else {
+        make_writable();
         memcpy(cpu_grid.data(),src.data(),sz*sizeof(Dtype));
       }
       return sz;
@@ -206,6 +261,7 @@ class ManagedGridBase {
       if(ongpu()) {
         LMG_CUDA_CHECK(cudaMemcpy(gpu_grid.data(),src.data(),sz*sizeof(Dtype),cudaMemcpyDeviceToDevice));
       } else {
+        make_writable();
         LMG_CUDA_CHECK(cudaMemcpy(cpu_grid.data(),src.data(),sz*sizeof(Dtype),cudaMemcpyDeviceToHost));
       }
       return sz;
@@ -226,6 +282,8 @@ class ManagedGridBase {
       size_t sz = size()-off;
       sz = std::min(sz, src.size());
       if(sz == 0) return 0;
+      src.sync_cpu();
+      if(!ongpu()) make_writable();
       if(src.ongpu()) {
         if(ongpu()) {
           LMG_CUDA_CHECK(cudaMemcpy(gpu_grid.data()+off,src.gpu_grid.data(),sz*sizeof(Dtype),cudaMemcpyDeviceToDevice));
@@ -251,6 +309,7 @@ class ManagedGridBase {
     template<typename... I, typename = typename std::enable_if<sizeof...(I) == NumDims>::type>
     ManagedGrid<Dtype, NumDims> resized(I... sizes) {
       cpu_grid_t g(nullptr, sizes...);
+      sync_cpu();
       if(g.size() <= capacity) {
         //no need to allocate and copy; capacity stays the same
         ManagedGrid<Dtype, NumDims> tmp;
@@ -279,11 +338,12 @@ class ManagedGridBase {
     /** \brief Return CPU Grid view.  GPU code should no longer access this memory.
      */
     const cpu_grid_t& cpu() const { tocpu(); return cpu_grid; }
-    cpu_grid_t& cpu() { tocpu(); return cpu_grid; }
+    cpu_grid_t& cpu() { tocpu(); make_writable(); return cpu_grid; }
 
     /** \brief Transfer data to GPU */
     void togpu(bool dotransfer=true) const {
       if(capacity == 0) return;
+      sync_cpu();
       //check that memory is allocated - even if data is on gpu, may still need to set this mgrid's gpu_grid
       if(gpu_grid.data() == nullptr) {
         if(gpu_info->gpu_ptr == nullptr) {
@@ -300,7 +360,9 @@ class ManagedGridBase {
 
     /** \brief Transfer data to CPU.  If not dotransfer, data is not copied back. */
     void tocpu(bool dotransfer=true) const {
+      sync_cpu();
       if(ongpu() && capacity > 0 && dotransfer) {
+        make_writable(false); //overwritten by gpu data
         LMG_CUDA_CHECK(cudaMemcpy(cpu_ptr.get(),gpu_info->gpu_ptr,capacity*sizeof(Dtype),cudaMemcpyDeviceToHost));
       }
       if(gpu_info) gpu_info->sent_to_gpu = false;
@@ -325,6 +387,8 @@ class ManagedGridBase {
 
     //pointer equality
     bool operator==(const ManagedGridBase<Dtype, NumDims>& rhs) const {
+      sync_cpu();
+      rhs.sync_cpu();
       return cpu_ptr == rhs.cpu_ptr;
     }
   protected:
@@ -352,6 +416,13 @@ class ManagedGridBase {
  * should be accessed.  This can be done with cpu and gpu methods or by an
  * explicit cast to Grid.
  *
+ * A ManagedGrid can also wrap read-only external CPU memory, such as a
+ * memory mapped file, which is only copied if the grid is modified.  Every
+ * ManagedGrid sharing the memory switches to the copy, but Grid views taken
+ * before the copy (e.g. from a const cpu()) still point at the external
+ * memory and do not see later changes.  Grid views obtained from a const
+ * ManagedGrid must not be written to.
+ *
  * There are two class specialization to support bracket indexing.
  */
 template<typename Dtype, std::size_t NumDims>
@@ -367,6 +438,19 @@ class ManagedGrid :  public ManagedGridBase<Dtype, NumDims> {
     ManagedGrid(I... sizes): ManagedGridBase<Dtype,NumDims>(sizes...) {
     }
 
+    /** \brief Wrap existing CPU memory without copying it.
+     * The memory is treated as read only and is copied the first time this
+     * grid, or any grid sharing its memory, is accessed in a way that permits
+     * modification (e.g., non-const cpu() or data()); fill_zero allocates
+     * without copying.  Other ManagedGrids sharing the memory use the copy
+     * from then on, but Grid views taken earlier keep pointing at data.
+     * owner is kept alive until the last grid referencing the memory is destroyed.
+     */
+    template<typename... I, typename = typename std::enable_if<sizeof...(I) == NumDims>::type>
+    ManagedGrid(std::shared_ptr<const void> owner, const Dtype *data, I... sizes):
+      ManagedGridBase<Dtype,NumDims>(owner, data, sizes...) {
+    }
+
     /** \brief Bracket indexing.
      *
      *  Accessing data this way will be safe (indices are checked) and convenient,
@@ -405,8 +489,14 @@ class ManagedGrid<Dtype, 1> : public ManagedGridBase<Dtype, 1> {
     ManagedGrid(size_t sz): ManagedGridBase<Dtype, 1>(sz) {
     }
 
+    /// wrap existing CPU memory without copying it, see ManagedGrid
+    ManagedGrid(std::shared_ptr<const void> owner, const Dtype *data, size_t sz):
+      ManagedGridBase<Dtype, 1>(owner, data, sz) {
+    }
+
     inline Dtype& operator[](size_t i) {
       this->tocpu();
+      this->make_writable();
       return this->cpu_grid[i];
     }
 
@@ -417,6 +507,7 @@ class ManagedGrid<Dtype, 1> : public ManagedGridBase<Dtype, 1> {
 
     inline Dtype& operator()(size_t a) {
       this->tocpu();
+      this->make_writable();
       return this->cpu_grid(a);
     }
 
@@ -442,10 +533,18 @@ class ManagedGrid<Dtype, 1> : public ManagedGridBase<Dtype, 1> {
 
 #define EXPAND_MGRID_DEFINITIONS(Z,SIZE,_) \
 typedef ManagedGrid<float, SIZE> MGrid##SIZE##f; \
-typedef ManagedGrid<double, SIZE> MGrid##SIZE##d;
+typedef ManagedGrid<double, SIZE> MGrid##SIZE##d; \
+typedef ManagedGrid<__half, SIZE> MGrid##SIZE##h;
 
 
 BOOST_PP_REPEAT_FROM_TO(1,LIBMOLGRID_MAX_GRID_DIM, EXPAND_MGRID_DEFINITIONS, 0);
 
+#ifdef LIBMOLGRID_BFLOAT16
+#define EXPAND_BF16_MGRID_DEFINITIONS(Z,SIZE,_) \
+typedef ManagedGrid<__nv_bfloat16, SIZE> MGrid##SIZE##bf;
+
+BOOST_PP_REPEAT_FROM_TO(1,LIBMOLGRID_MAX_GRID_DIM, EXPAND_BF16_MGRID_DEFINITIONS, 0);
+#endif
+
 }
 #endif /* MANAGED_GRID_H_ */
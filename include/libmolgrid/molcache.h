@@ -0,0 +1,242 @@
+/** \file molcache.h - reading and writing precalculated molcache3 files
+ *
+ * A molcache3 file stores molecules that have already been typed so their
+ * coordinates can be used directly from a memory map.  The file consists of:
+ *
+ *  - a 64 byte MolCache3Header
+ *  - one block per molecule, each starting on a 64 byte boundary, containing
+ *    the number of atoms, the length of the name, the name, and then the
+ *    coordinates (x,y,z), type indices and radii of the atoms as float arrays
+ *    that each start on a 64 byte boundary
+ *  - a description of the atom typer used (number of types and type names)
+ *  - an open addressing hash index of MolCacheSlot keyed by molcache_hash of
+ *    the molecule name
+ *
+ * A molcache2 file (version -1) is untyped: after the version and the file
+ * position of its trailer come the atoms of each molecule, and the trailer
+ * lists the name and position of every molecule.  Rather than reading the
+ * trailer, it may be indexed by a molcache2 index file (named by appending
+ * .index) consisting of a 64 byte MolCache2IndexHeader followed by a hash
+ * index of MolCacheSlot that point to the trailer records of the molcache2
+ * file.
+ *
+ * All values are little endian.
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#ifndef MOLCACHE_H_
+#define MOLCACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include "libmolgrid/atom_typer.h"
+#include "libmolgrid/coordinateset.h"
+
+namespace libmolgrid {
+
+/// version stored in the first four bytes of molcache3 files (molcache2 uses -1)
+static const int32_t MOLCACHE3_VERSION = -3;
+/// alignment of molecule blocks and the arrays within them
+static const size_t MOLCACHE3_ALIGN = 64;
+
+/// header at the start of a molcache3 file
+struct MolCache3Header {
+    int32_t version = MOLCACHE3_VERSION;
+    uint32_t num_types = 0; ///number of types of the atom typer
+    uint64_t typer_hash = 0; ///molcache_hash of the typer description
+    uint64_t num_molecules = 0;
+    uint64_t index_offset = 0; ///file position of hash index
+    uint64_t num_slots = 0; ///number of slots in hash index, a power of two
+    uint64_t typer_offset = 0; ///file position of typer description
+    uint64_t typer_length = 0;
+    uint64_t reserved = 0;
+};
+
+/// entry of a molcache hash index; an offset of zero marks an empty slot
+struct MolCacheSlot {
+    uint64_t hash;
+    uint64_t offset; ///file position of molecule block (molcache3) or trailer record (molcache2)
+};
+
+/// 64-bit FNV-1a hash used for molcache names and typer descriptions
+uint64_t molcache_hash(const char *data, size_t len);
+
+/// bytes of each atom of a molcache2 file (x, y, z and smina type)
+static const size_t MOLCACHE2_ATOM_SIZE = 3 * sizeof(float) + sizeof(int32_t);
+
+/// version stored in the first four bytes of molcache2 index files
+static const int32_t MOLCACHE2_INDEX_VERSION = -2;
+
+/// header at the start of a molcache2 index file
+struct MolCache2IndexHeader {
+    int32_t version = MOLCACHE2_INDEX_VERSION;
+    uint32_t reserved = 0;
+    uint64_t molcache_size = 0; ///size of the indexed molcache2 file
+    int64_t molcache_mtime = 0; ///modification time of the indexed molcache2 file
+    uint64_t trailer_offset = 0; ///file position of the molcache2 trailer
+    uint64_t num_molecules = 0;
+    uint64_t num_slots = 0; ///number of slots in hash index, a power of two
+    uint64_t padding[2] = {0, 0};
+};
+
+/// identifies an atom typer by its number of types and their names
+std::string molcache3_typer_description(const AtomTyper& typer);
+
+/// how the pages of a memory mapped molcache are brought into memory
+enum MolCacheLoad {
+  MolCacheLoadNone, ///read from disk as molecules are accessed
+  MolCacheLoadWillNeed, ///read ahead (MADV_WILLNEED) in a background thread
+  MolCacheLoadPopulate, ///read in completely when mapped (MAP_POPULATE)
+  MolCacheLoadHugePages ///copied into private memory backed by transparent huge pages, or mapped as with none if that memory can't be allocated
+};
+
+/// convert the name of a load policy (none, willneed, populate, hugepages) to a MolCacheLoad
+MolCacheLoad parse_molcache_load(const std::string& name);
+
+/** \brief Read only memory map of a molcache file, loaded according to a MolCacheLoad policy.
+ * If log is true, the time taken to load the file is printed to stderr; for
+ * willneed only the time to request readahead is known.
+ */
+class MolCacheMap {
+    const char *ptr = nullptr;
+    size_t len = 0;
+    std::thread loader; //read ahead thread
+    std::atomic<bool> stop_loading{false};
+
+  public:
+    MolCacheMap(const std::string& fname, MolCacheLoad load = MolCacheLoadNone, bool log = false);
+    MolCacheMap(const MolCacheMap&) = delete;
+    MolCacheMap& operator=(const MolCacheMap&) = delete;
+    ~MolCacheMap();
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+};
+
+/** \brief Read only access to a memory mapped molcache3 file.
+ * Construction only reads the header; names are looked up in the on-disk
+ * index when requested.  Lookups may be performed concurrently.
+ */
+class MolCache3 {
+    MolCacheMap map;
+    MolCache3Header header;
+    const MolCacheSlot *slots = nullptr;
+
+  public:
+    /// location of a molecule's data within the map
+    struct entry {
+        unsigned natoms = 0;
+        const float *coords = nullptr; ///natoms x 3
+        const float *types = nullptr;
+        const float *radii = nullptr;
+    };
+
+    /// map fname, which must be a molcache3 file, loading it according to load
+    explicit MolCache3(const std::string& fname, MolCacheLoad load = MolCacheLoadNone, bool log = false);
+
+    /// number of molecules
+    size_t size() const { return header.num_molecules; }
+
+    /// number of types of the atom typer used to create the file
+    unsigned num_types() const { return header.num_types; }
+
+    /// description of the atom typer used to create the file
+    std::string typer_description() const;
+
+    /// throw an exception if typer is not the one used to create the file
+    void check_typer(const AtomTyper& typer) const;
+
+    /// find the molecule name, returning false if it is not present
+    bool find(const char *name, entry& e) const;
+
+    /// pointer to the start of the mapped file
+    const char *data() const { return map.data(); }
+
+    /// size of the mapped file
+    size_t file_size() const { return map.size(); }
+};
+
+/** \brief Read only access to a memory mapped molcache2 file.
+ * If an up to date index file (fname.index) exists it is memory mapped and
+ * construction takes constant time.  Otherwise the trailer of the file is
+ * scanned once to build the same index in memory.  If a name appears more
+ * than once in the trailer, its last record is used.  Lookups may be
+ * performed concurrently.
+ */
+class MolCache2 {
+    MolCacheMap map;
+    boost::iostreams::mapped_file_source index_map;
+    std::vector<MolCacheSlot> index; //used if there is no index file
+    const MolCacheSlot *slots = nullptr;
+    uint64_t num_slots = 0;
+    uint64_t num_molecules = 0;
+
+  public:
+    /// map fname, which must be a molcache2 file, loading it according to load
+    explicit MolCache2(const std::string& fname, MolCacheLoad load = MolCacheLoadNone, bool log = false);
+
+    /// number of distinct molecule names
+    size_t size() const { return num_molecules; }
+
+    /// true if the index was read from an index file rather than built
+    bool has_index_file() const { return index_map.is_open(); }
+
+    /// find the molecule name, setting data to the start of its atoms (preceded by their number);
+    /// throws if the atoms do not lie within the file
+    bool find(const char *name, const char *& data) const;
+
+    /// pointer to the start of the mapped file
+    const char *data() const { return map.data(); }
+
+    /// size of the mapped file
+    size_t file_size() const { return map.size(); }
+
+    /// name of the index file of molcache2 file fname
+    static std::string index_file_name(const std::string& fname) { return fname + ".index"; }
+
+    /// create the index file of molcache2 file fname, returning the number of molecules indexed
+    static size_t create_index(const std::string& fname);
+};
+
+/** \brief Create a molcache3 file from typed coordinate sets.
+ * Molecules are appended to the file as they are added; the index is
+ * written by close (or the destructor).
+ */
+class MolCache3Writer {
+    std::ofstream out;
+    std::string fname;
+    std::shared_ptr<AtomTyper> typer;
+    std::vector<MolCacheSlot> entries;
+    std::unordered_set<std::string> names;
+    uint64_t pos = 0; ///current file position
+
+    void write(const void *data, size_t n);
+    void pad();
+
+  public:
+    /// create fname for molecules typed with t, which must be an index typer
+    MolCache3Writer(const std::string& fname, std::shared_ptr<AtomTyper> t);
+    ~MolCache3Writer();
+
+    /// add c under name; returns false, without adding, if name is already present
+    bool add(const std::string& name, const CoordinateSet& c);
+
+    /// number of molecules added
+    size_t size() const { return entries.size(); }
+
+    /// write the typer description and index and close the file
+    void close();
+};
+
+} /* namespace libmolgrid */
+
+#endif /* MOLCACHE_H_ */
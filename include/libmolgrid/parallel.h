@@ -0,0 +1,72 @@
+/*
+ * parallel.h
+ *
+ *  Simple fork-join helpers for multithreaded CPU code paths.
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+namespace libmolgrid {
+
+/// return number of threads to actually use for a requested thread count, where 0 means all hardware threads
+inline unsigned effective_threads(unsigned nthreads) {
+  if(nthreads == 0) {
+    nthreads = std::thread::hardware_concurrency();
+    if(nthreads == 0) nthreads = 1;
+  }
+  return nthreads;
+}
+
+/** \brief Statically partition the range [0,n) into contiguous chunks and
+ * process each chunk in its own thread.  The calling thread processes the
+ * first chunk.  Chunk boundaries depend only on n and the number of threads.
+ * If any chunk throws, the first exception is rethrown in the calling thread
+ * after all threads have finished.
+ * @param[in] nthreads number of threads to use (0 for all available)
+ * @param[in] n size of range
+ * @param[in] f function called as f(begin, end, chunk) for each chunk
+ */
+template<typename Func>
+void parallel_for(unsigned nthreads, size_t n, Func f) {
+  size_t nchunks = std::min<size_t>(effective_threads(nthreads), n);
+  if(nchunks <= 1) {
+    f(size_t(0), n, 0U);
+    return;
+  }
+
+  std::vector<std::exception_ptr> errors(nchunks);
+  auto run = [&](unsigned c) {
+    size_t begin = n * c / nchunks;
+    size_t end = n * (c + 1) / nchunks;
+    try {
+      f(begin, end, c);
+    } catch (...) {
+      errors[c] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nchunks - 1);
+  for (unsigned c = 1; c < nchunks; c++) {
+    threads.emplace_back(run, c);
+  }
+  run(0);
+  for (auto& t : threads) {
+    t.join();
+  }
+  for (auto& e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+} /* namespace libmolgrid */
+
+#endif /* PARALLEL_H_ */
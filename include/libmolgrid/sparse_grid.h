@@ -0,0 +1,85 @@
+/** \file sparse_grid.h - grids that only store their non-empty channels
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#ifndef SPARSE_GRID_H_
+#define SPARSE_GRID_H_
+
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include "libmolgrid/libmolgrid.h"
+#include "libmolgrid/grid.h"
+#include "libmolgrid/managed_grid.h"
+
+namespace libmolgrid {
+
+/** \brief A 4D grid of which only the channels that may be non-zero are stored.
+ *
+ * Filled by GridMaker::forward (CPU).  With wide type schemes most channels
+ * of a grid are empty, so storing only the occupied ones reduces both memory
+ * and the cost of zeroing and copying grids.  values holds the stored
+ * channels, in increasing order of their index in the dense grid, which is
+ * given by channels.  Storage is kept between calls, so a single object can
+ * be reused for every example.
+ */
+template <typename Dtype>
+class ChannelSparseGrid {
+    friend class GridMaker;
+
+    std::vector<unsigned> channels; ///index in the dense grid of each stored channel
+    ManagedGrid<Dtype, 4> values{0, 0, 0, 0}; ///stored channels
+    unsigned nchannels = 0; ///number of channels of the dense grid
+    size_t reserved = 0; ///elements allocated for values
+
+    //stored values in the memory of a cpu or gpu dense grid
+    const Grid<Dtype, 4, false>& stored_values(std::false_type) const { return values.cpu(); }
+    const Grid<Dtype, 4, true>& stored_values(std::true_type) const { return values.gpu(); }
+
+  public:
+    ChannelSparseGrid() {}
+
+    /// number of channels of the dense grid
+    unsigned num_channels() const { return nchannels; }
+
+    /// number of stored channels
+    unsigned num_stored() const { return channels.size(); }
+
+    /// index in the dense grid of each stored channel
+    const std::vector<unsigned>& get_channels() const { return channels; }
+
+    /// values of the stored channels (num_stored x dim x dim x dim)
+    const ManagedGrid<Dtype, 4>& get_values() const { return values; }
+
+    /// dense shape, num_channels x dim x dim x dim
+    std::vector<size_t> dense_shape() const {
+      return {nchannels, values.dimension(1), values.dimension(2), values.dimension(3)};
+    }
+
+    /// copy into the dense grid out, zeroing the channels that aren't stored
+    template <bool isCUDA>
+    void densify(Grid<Dtype, 4, isCUDA>& out) const {
+      if(out.dimension(0) != nchannels || out.dimension(1) != values.dimension(1) ||
+          out.dimension(2) != values.dimension(2) || out.dimension(3) != values.dimension(3))
+        throw std::invalid_argument("Dense grid has the wrong shape: "+itoa(out.dimension(0))+"x"+itoa(out.dimension(1))+"x"
+            +itoa(out.dimension(2))+"x"+itoa(out.dimension(3))+" vs "+itoa(nchannels)+"x"+itoa(values.dimension(1))+"x"
+            +itoa(values.dimension(2))+"x"+itoa(values.dimension(3)));
+      out.fill_zero();
+      const Grid<Dtype, 4, isCUDA>& src = stored_values(std::integral_constant<bool, isCUDA>());
+      for(unsigned i = 0, n = channels.size(); i < n; i++) {
+        Grid<Dtype, 3, isCUDA> dst = out[channels[i]];
+        dst.copyFrom(src[i]);
+      }
+    }
+
+    /// bytes of memory currently reserved
+    size_t memory_size() const {
+      return channels.capacity() * sizeof(unsigned) + reserved * sizeof(Dtype);
+    }
+};
+
+} /* namespace libmolgrid */
+
+#endif /* SPARSE_GRID_H_ */
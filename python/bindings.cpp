@@ -9,6 +9,7 @@
 #include "libmolgrid/transform.h"
 #include "libmolgrid/atom_typer.h"
 #include "libmolgrid/example_provider.h"
+#include "libmolgrid/molcache.h"
 #include "libmolgrid/grid_maker.h"
 #include "libmolgrid/grid_io.h"
 
@@ -193,6 +194,9 @@ class PythonCallbackIndexTyper: public CallbackIndexTyper {
     }, ntypes, list_to_vec<std::string>(names)), callback(c) {
     }
 
+    /// python can only be called from threads holding the GIL
+    virtual bool is_thread_safe() const { return false; }
+
     ///call callback
     // note I'm unwrapping and rewrapping the obatom in python mostly to test the code
     std::pair<int,float> get_atom_type_index(object a) const {
@@ -226,6 +230,9 @@ class PythonCallbackVectorTyper: public CallbackVectorTyper {
           ntypes, list_to_vec<std::string>(lnames)), callback(c) {
     }
 
+    /// python can only be called from threads holding the GIL
+    virtual bool is_thread_safe() const { return false; }
+
     ///call callback - for python return vector by reference
     virtual tuple get_atom_type_vector(object a) const {
       OpenBabel::OBAtom *atom = (OpenBabel::OBAtom *)extract_swig_wrapped_pointer(a.ptr());
@@ -379,6 +386,8 @@ BOOST_PYTHON_MODULE(molgrid)
   bool numpy_supported = init_numpy();
 
   def("set_random_seed", +[](long s) {random_engine.seed(s);}); //set random seed
+  def("string_cache_memory_usage", +[]() -> size_t { return string_cache.memory_usage(); },
+      "Return bytes used to store the interned file names of examples");
   def("get_gpu_enabled", +[]()->bool {return python_gpu_enabled;},
       "Get if generated grids are on GPU by default.");
   def("set_gpu_enabled", +[](bool val) {python_gpu_enabled = val;},
@@ -625,6 +634,8 @@ MAKE_ALL_GRIDS()
       .def("size", &CoordinateSet::size)
       .def("num_types", &CoordinateSet::num_types)
       .def("center", &CoordinateSet::center)
+      .def("crop", &CoordinateSet::crop, "remove atoms farther than maxdist from center, returning number removed")
+      .def("max_radius", &CoordinateSet::max_radius)
       .def("clone", &CoordinateSet::clone)
       .def("togpu", &CoordinateSet::togpu, "set memory affinity to GPU")
       .def("tocpu", &CoordinateSet::tocpu, "set memory affinity to CPU")
@@ -639,6 +650,15 @@ MAKE_ALL_GRIDS()
       .def_readwrite("max_type", &CoordinateSet::max_type)
       .def_readonly("src", &CoordinateSet::src);
 
+  def("read_coordinate_sets", +[](list fnames, const AtomTyper& typer, bool addh, unsigned nthreads) {
+        //python callbacks can only be called from the thread holding the interpreter lock
+        if(dynamic_cast<const PythonCallbackIndexTyper*>(&typer) || dynamic_cast<const PythonCallbackVectorTyper*>(&typer))
+          nthreads = 1;
+        return read_coordinate_sets(list_to_vec<std::string>(fnames), typer, addh, nthreads);
+      }, (arg("files"), arg("typer"), arg("add_hydrogens") = true, arg("nthreads") = 0),
+      "Read and type the molecules in a list of files using multiple threads (0 for all available), returning a CoordinateSet for each file. "
+      "Only file reading is parallel: openbabel is not thread safe, so parsing, protonation and typing are serialized.");
+
 
   //mostly exposing this for documentation purposes
 #undef EXSET
@@ -683,6 +703,46 @@ MAKE_ALL_GRIDS()
       .def("next_batch", static_cast< std::vector<Example> (ExampleProvider::*)(unsigned)>(&ExampleProvider::next_batch),
           (arg("batch_size")));
 
+  class_<MolCache3Writer, boost::noncopyable>("MolCache3Writer", "Create a molcache3 file of coordinates typed with typer",
+      init<const std::string&, std::shared_ptr<AtomTyper> >((arg("file_name"), arg("typer"))))
+      .def("add", &MolCache3Writer::add, (arg("name"), arg("coords")), "add coordinates under name, returns false if name is already present")
+      .def("close", &MolCache3Writer::close, "write index and close file")
+      .def("size", &MolCache3Writer::size);
+
+  def("create_molcache2_index", &MolCache2::create_index, (arg("file_name")),
+      "Create an index file of a molcache2 file so it can be opened without reading the names of all molecules, returns number of molecules");
+
+
+  class_<CellList>("CellList", "Spatial index of atoms for efficiently gridding small regions of large coordinate sets",
+      init<const CoordinateSet&, float>((arg("coords"), arg("cell_size")=4.0)))
+      .def("num_atoms", &CellList::num_atoms)
+      .def("get_max_radius", &CellList::get_max_radius)
+      .def("get_cell_size", &CellList::get_cell_size);
+
+  class_<AtomFootprints>("AtomFootprints", "Densities of each atom recorded by GridMaker.forward for reuse in backward when training on the CPU")
+      .def(init<size_t>((arg("max_points")), "Store footprints of at most max_points grid points, falling back to computing densities directly when exceeded"))
+      .def("num_atoms", &AtomFootprints::num_atoms)
+      .def("num_footprints", &AtomFootprints::num_footprints)
+      .def("recorded", &AtomFootprints::recorded)
+      .def("get_max_points", &AtomFootprints::get_max_points)
+      .def("set_max_points", &AtomFootprints::set_max_points)
+      .def("memory_size", &AtomFootprints::memory_size)
+      .def("clear", &AtomFootprints::clear);
+
+  class_<ChannelSparseGrid<float> >("ChannelSparseGrid", "Grid that only stores the channels of types with atoms near it, filled by GridMaker.forward")
+      .def("num_channels", &ChannelSparseGrid<float>::num_channels)
+      .def("num_stored", &ChannelSparseGrid<float>::num_stored)
+      .def("get_channels", +[](const ChannelSparseGrid<float>& self) {
+          list ret;
+          for(unsigned c : self.get_channels()) ret.append(c);
+          return ret;
+        }, "index in the dense grid of each stored channel")
+      .def("values", &ChannelSparseGrid<float>::get_values, return_value_policy<copy_const_reference>(), "stored channels")
+      .def("densify", +[](const ChannelSparseGrid<float>& self, Grid<float, 4, false> out) { self.densify(out); }, (arg("out")),
+          "copy into dense grid out, zeroing the channels that aren't stored")
+      .def("densify", +[](const ChannelSparseGrid<float>& self, Grid<float, 4, true> out) { self.densify(out); }, (arg("out")),
+          "copy into dense grid out, zeroing the channels that aren't stored")
+      .def("memory_size", &ChannelSparseGrid<float>::memory_size);
 
   //grid maker
   class_<GridMaker>("GridMaker",
@@ -695,6 +755,8 @@ MAKE_ALL_GRIDS()
       .def("set_dimension", &GridMaker::set_dimension)
       .def("get_binary", &GridMaker::get_binary)
       .def("set_binary", &GridMaker::set_binary)
+      .def("get_num_threads", &GridMaker::get_num_threads)
+      .def("set_num_threads", &GridMaker::set_num_threads)
       //grids need to be passed by value
       .def("forward", +[](GridMaker& self, const Example& ex, Grid<float, 4, false> g, float random_translate, bool random_rotate){
             self.forward(ex, g, random_translate, random_rotate); },
@@ -710,6 +772,9 @@ MAKE_ALL_GRIDS()
             (arg("examples"),arg("grid"),arg("random_translation")=0.0,arg("random_rotation")=false))
       .def("forward", +[](GridMaker& self, float3 center, const CoordinateSet& c, Grid<float, 4, false> g){ self.forward(center, c, g); })
       .def("forward", +[](GridMaker& self, float3 center, const CoordinateSet& c, Grid<float, 4, true> g){ self.forward(center, c, g); })
+      .def("forward", +[](GridMaker& self, float3 center, const CoordinateSet& c, const CellList& cells, Grid<float, 4, false> g){ self.forward(center, c, cells, g); })
+      .def("forward", +[](GridMaker& self, float3 center, const CoordinateSet& c, AtomFootprints& footprints, Grid<float, 4, false> g){ self.forward(center, c, footprints, g); })
+      .def("forward", +[](GridMaker& self, float3 center, const CoordinateSet& c, ChannelSparseGrid<float>& out){ self.forward(center, c, out); })
       .def("forward", +[](GridMaker& self, const Example& ex, const Transform& t, Grid<float, 4, false> g){ self.forward(ex, t, g); })
       .def("forward", +[](GridMaker& self, const Example& ex, const Transform& t, Grid<float, 4, true> g){ self.forward(ex, t, g); })
       .def("forward", +[](GridMaker& self, float3 grid_center, const Grid<float, 2, false>& coords,
@@ -730,6 +795,18 @@ MAKE_ALL_GRIDS()
       .def("backward", +[](GridMaker& self, float3 grid_center, const CoordinateSet& in,
           const Grid<float, 4, false>& diff, Grid<float, 2, false> atomic_gradients) {
           self.backward(grid_center, in, diff, atomic_gradients); })
+      .def("backward", +[](GridMaker& self, float3 grid_center, const CoordinateSet& in, const CellList& cells,
+          const Grid<float, 4, false>& diff, Grid<float, 2, false> atomic_gradients, Grid<float, 2, false> type_gradients){
+          self.backward(grid_center, in, cells, diff, atomic_gradients, type_gradients);})
+      .def("backward", +[](GridMaker& self, float3 grid_center, const CoordinateSet& in, const CellList& cells,
+          const Grid<float, 4, false>& diff, Grid<float, 2, false> atomic_gradients) {
+          self.backward(grid_center, in, cells, diff, atomic_gradients); })
+      .def("backward", +[](GridMaker& self, float3 grid_center, const CoordinateSet& in, const AtomFootprints& footprints,
+          const Grid<float, 4, false>& diff, Grid<float, 2, false> atomic_gradients, Grid<float, 2, false> type_gradients){
+          self.backward(grid_center, in, footprints, diff, atomic_gradients, type_gradients);})
+      .def("backward", +[](GridMaker& self, float3 grid_center, const CoordinateSet& in, const AtomFootprints& footprints,
+          const Grid<float, 4, false>& diff, Grid<float, 2, false> atomic_gradients) {
+          self.backward(grid_center, in, footprints, diff, atomic_gradients); })
       .def("backward", +[](GridMaker& self, float3 grid_center, const CoordinateSet& in, const Grid<float, 4, true>& diff,
           Grid<float, 2, true> atomic_gradients, Grid<float, 2, true> type_gradients){
           self.backward(grid_center, in, diff, atomic_gradients, type_gradients);})
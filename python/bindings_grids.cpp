@@ -252,7 +252,7 @@ void define_mgrid(const char* name) {
 
   class_<GridType> C(name, init<Types...>());
   add_grid_members(C);
-  C.def("cpu",static_cast<const typename GridType::cpu_grid_t& (GridType::*)() const>(&GridType::cpu), return_value_policy<copy_const_reference>())
+  C.def("cpu",static_cast<typename GridType::cpu_grid_t& (GridType::*)()>(&GridType::cpu), return_value_policy<copy_non_const_reference>())
       .def("gpu",static_cast<const typename GridType::gpu_grid_t& (GridType::*)() const>(&GridType::gpu), return_value_policy<copy_const_reference>())
       .def("clone", &GridType::clone)
       .def("copyTo", +[](const GridType& self, GridType dest) {return self.copyTo(dest);})
@@ -28,6 +28,19 @@ using namespace std;
 
 namespace libmolgrid {
 
+//type each atom with get_atom_type_index
+void AtomTyper::type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const {
+  types.clear();
+  radii.clear();
+  types.reserve(mol->NumAtoms());
+  radii.reserve(mol->NumAtoms());
+  FOR_ATOMS_OF_MOL(a, mol) {
+    auto t_r = get_atom_type_index(&*a);
+    types.push_back(t_r.first);
+    radii.push_back(t_r.second);
+  }
+}
+
 /**************  GninaIndexTyper  ********************/
 
 const GninaIndexTyper::info GninaIndexTyper::default_data[GninaIndexTyper::NumTypes] = { //el, ad, xs
@@ -76,55 +89,81 @@ std::string GninaIndexTyper::gnina_type_name(int t) {
 }
 
 
-///return type index and radius of a
-std::pair<int,float> GninaIndexTyper::get_atom_type_index(OpenBabel::OBAtom* a) const {
-
-  //this function is more convoluted than it needs to be for historical reasons
-  //and a general fear of breaking backwards compatibility
-  bool Hbonded = false;
-  bool heteroBonded = false;
-
-
-  FOR_NBORS_OF_ATOM(neigh, a){
-    if (neigh->GetAtomicNum() == 1)
-      Hbonded = true;
-    else if (neigh->GetAtomicNum() != 6)
-      heteroBonded = true; //hetero anything that is not hydrogen and not carbon
+//the flag of a that changes its autodock name: polar hydrogen, aromatic carbon, or acceptor nitrogen or sulfur
+static bool gnina_element_flag(OpenBabel::OBAtom* a) {
+  switch(a->GetAtomicNum()) {
+  case 1:
+    return a->IsPolarHydrogen();
+  case 6:
+    return a->IsAromatic();
+  case 7:
+  case 16:
+    return a->IsHbondAcceptor();
   }
+  return false;
+}
 
-  const char *element_name = GET_SYMBOL(a->GetAtomicNum());
-  std::string ename(element_name);
-
+//autodock name of element anum given its gnina_element_flag
+static string gnina_element_name(unsigned anum, bool flag) {
   //massage the element name in some cases
-  switch(a->GetAtomicNum()) {
+  switch(anum) {
   case 1:
-    ename =  a->IsPolarHydrogen() ? "HD" : "H";
-    break;
+    return flag ? "HD" : "H";
   case 6:
-    if(a->IsAromatic()) ename = "A";
+    if(flag) return "A";
     break;
   case 7:
-    if(a->IsHbondAcceptor()) ename = "NA";
+    if(flag) return "NA";
     break;
   case 8:
-    ename = "OA";
-    break;
+    return "OA";
   case 16:
-    if(a->IsHbondAcceptor()) ename = "SA";
+    if(flag) return "SA";
     break;
   case 34:
-    ename = "S"; //historically selenium is treated as sulfur  ¯\_(ツ)_/¯
-    break;
+    return "S"; //historically selenium is treated as sulfur  ¯\_(ツ)_/¯
+  }
+  return GET_SYMBOL(anum);
+}
+
+GninaIndexTyper::GninaIndexTyper(bool usec, const info *d): use_covalent(usec), data(d) {
+  for(unsigned anum = 0; anum < NumElementEntries; anum++) {
+    for(unsigned flag = 0; flag < 2; flag++) {
+      element_types[anum][flag] = lookup_element_type(anum, flag);
+    }
   }
+}
 
-  //lookup type in data based on ename
-  int ret = GenericMetal; //default catchall type
+int GninaIndexTyper::lookup_element_type(unsigned anum, bool flag) const {
+  string ename = gnina_element_name(anum, flag);
   for(int i = 0; i < NumTypes; i++) {
     if(data[i].adname == ename) {
-      ret = i;
-      break;
+      return i;
     }
   }
+  return GenericMetal; //default catchall type
+}
+
+///return type index and radius of a
+inline std::pair<int,float> GninaIndexTyper::type_atom(OpenBabel::OBAtom* a) const {
+
+  //this function is more convoluted than it needs to be for historical reasons
+  //and a general fear of breaking backwards compatibility
+  bool Hbonded = false;
+  bool heteroBonded = false;
+
+
+  FOR_NBORS_OF_ATOM(neigh, a){
+    if (neigh->GetAtomicNum() == 1)
+      Hbonded = true;
+    else if (neigh->GetAtomicNum() != 6)
+      heteroBonded = true; //hetero anything that is not hydrogen and not carbon
+  }
+
+  unsigned anum = a->GetAtomicNum();
+  bool flag = gnina_element_flag(a);
+  int ret = anum < NumElementEntries ? element_types[anum][flag] : lookup_element_type(anum, flag);
+
   //adjust based on bonding
   switch (ret) {
   case AliphaticCarbonXSHydrophobe: // C_C_C_H, //hydrophobic according to xscale
@@ -163,6 +202,22 @@ std::pair<int,float> GninaIndexTyper::get_atom_type_index(OpenBabel::OBAtom* a)
 
 }
 
+std::pair<int,float> GninaIndexTyper::get_atom_type_index(OpenBabel::OBAtom* a) const {
+  return type_atom(a);
+}
+
+void GninaIndexTyper::type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const {
+  types.clear();
+  radii.clear();
+  types.reserve(mol->NumAtoms());
+  radii.reserve(mol->NumAtoms());
+  FOR_ATOMS_OF_MOL(a, mol) {
+    auto t_r = type_atom(&*a);
+    types.push_back(t_r.first);
+    radii.push_back(t_r.second);
+  }
+}
+
 //look up radius for passed type
 pair<int,float> GninaIndexTyper::get_int_type(int t) const {
   int ret = GenericMetal;
@@ -187,21 +242,43 @@ std::vector<std::string> GninaIndexTyper::get_type_names() const {
 
 /************** Element IndexTyper  ********************/
 
+ElementIndexTyper::ElementIndexTyper(unsigned maxe): last_elem(maxe) {
+  for(unsigned elem = 0; elem < NumElementEntries; elem++) {
+    element_radii[elem] = GET_COVALENT_RAD(elem);
+  }
+}
+
 /// return number of types
 unsigned ElementIndexTyper::num_types() const {
   return last_elem;
 }
 
-///return type index of a
-std::pair<int,float> ElementIndexTyper::get_atom_type_index(OpenBabel::OBAtom* a) const {
-  unsigned elem = a->GetAtomicNum();
-  float radius = GET_COVALENT_RAD(elem);
+inline std::pair<int,float> ElementIndexTyper::element_type(unsigned elem) const {
+  float radius = elem < NumElementEntries ? element_radii[elem] : GET_COVALENT_RAD(elem);
   if(elem >= last_elem) elem = 0; //truncate
   return make_pair((int)elem,radius);
 }
 
+///return type index of a
+std::pair<int,float> ElementIndexTyper::get_atom_type_index(OpenBabel::OBAtom* a) const {
+  return element_type(a->GetAtomicNum());
+}
+
+void ElementIndexTyper::type_molecule(OpenBabel::OBMol *mol, std::vector<int>& types, std::vector<float>& radii) const {
+  types.clear();
+  radii.clear();
+  types.reserve(mol->NumAtoms());
+  radii.reserve(mol->NumAtoms());
+  FOR_ATOMS_OF_MOL(a, mol) {
+    auto t_r = element_type(a->GetAtomicNum());
+    types.push_back(t_r.first);
+    radii.push_back(t_r.second);
+  }
+}
+
 //return element with radius
 std::pair<int,float> ElementIndexTyper::get_int_type(int elem) const {
+  if(elem >= 0) return element_type(elem);
   float radius = GET_COVALENT_RAD(elem);
   if(elem >= (int)last_elem) elem = 0; //truncate
   return make_pair((int)elem,radius);
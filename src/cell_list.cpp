@@ -0,0 +1,124 @@
+/*
+ * cell_list.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#include "libmolgrid/cell_list.h"
+#include "libmolgrid/libmolgrid.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace libmolgrid {
+
+using namespace std;
+
+//don't let outlying atoms produce an enormous, mostly empty cell grid
+#define MAX_CELLS_PER_ATOM 8
+
+//cell containing a coordinate offset from the origin, clamped to [0,n-1]; NaN maps to 0
+static inline unsigned cell_index(float offset, float csize, unsigned n) {
+  float c = floor(offset/csize);
+  if(!(c > 0)) return 0;
+  if(c >= n-1) return n-1;
+  return c;
+}
+
+static inline bool finite_atom(const Grid<float, 2, false>& coords, size_t i) {
+  return isfinite(coords(i,0)) && isfinite(coords(i,1)) && isfinite(coords(i,2));
+}
+
+void CellList::build(const Grid<float, 2, false>& coords, const Grid<float, 1, false>& radii, float csize) {
+  if(csize <= 0) throw invalid_argument("Cell size must be positive: "+ftoa(csize));
+  natoms = coords.dimension(0);
+  if(natoms > 0 && coords.dimension(1) != 3) throw invalid_argument("Need x,y,z for coordinates in cell list");
+  if(radii.size() != natoms) throw invalid_argument("Radii dimension doesn't equal number of coordinates: "+itoa(radii.size())+" vs "+itoa(natoms));
+
+  cell_size = csize;
+  max_radius = 0;
+  atoms.clear();
+  cell_start.clear();
+  if(natoms == 0) {
+    ncells[0] = ncells[1] = ncells[2] = 0;
+    return;
+  }
+
+  //atoms with non-finite coordinates can't overlap a grid and aren't placed in any cell
+  size_t nfinite = 0;
+  float3 lo = make_float3(INFINITY, INFINITY, INFINITY);
+  float3 hi = make_float3(-INFINITY, -INFINITY, -INFINITY);
+  for(size_t i = 0; i < natoms; i++) {
+    if(!finite_atom(coords, i)) continue;
+    nfinite++;
+    lo.x = min(lo.x, coords(i,0)); hi.x = max(hi.x, coords(i,0));
+    lo.y = min(lo.y, coords(i,1)); hi.y = max(hi.y, coords(i,1));
+    lo.z = min(lo.z, coords(i,2)); hi.z = max(hi.z, coords(i,2));
+    max_radius = max(max_radius, radii(i));
+  }
+  if(nfinite == 0) {
+    ncells[0] = ncells[1] = ncells[2] = 0;
+    return;
+  }
+  origin = lo;
+
+  //counts are computed in double so widely spread atoms can't overflow them
+  size_t maxcells = nfinite*MAX_CELLS_PER_ATOM;
+  while(true) {
+    double nx = floor((hi.x-lo.x)/cell_size)+1;
+    double ny = floor((hi.y-lo.y)/cell_size)+1;
+    double nz = floor((hi.z-lo.z)/cell_size)+1;
+    if(nx*ny*nz <= maxcells) {
+      ncells[0] = nx; ncells[1] = ny; ncells[2] = nz;
+      break;
+    }
+    cell_size *= 2;
+  }
+  size_t total = (size_t)ncells[0]*ncells[1]*ncells[2];
+
+  //counting sort of atoms into cells; atoms stay in increasing order within a cell
+  vector<unsigned> cellof(natoms);
+  cell_start.assign(total+1, 0);
+  for(size_t i = 0; i < natoms; i++) {
+    if(!finite_atom(coords, i)) continue;
+    unsigned cx = cell_index(coords(i,0)-origin.x, cell_size, ncells[0]);
+    unsigned cy = cell_index(coords(i,1)-origin.y, cell_size, ncells[1]);
+    unsigned cz = cell_index(coords(i,2)-origin.z, cell_size, ncells[2]);
+    cellof[i] = (cx*ncells[1]+cy)*ncells[2]+cz;
+    cell_start[cellof[i]+1]++;
+  }
+  for(size_t c = 0; c < total; c++) {
+    cell_start[c+1] += cell_start[c];
+  }
+  atoms.resize(nfinite);
+  vector<unsigned> pos(cell_start.begin(), cell_start.end()-1);
+  for(size_t i = 0; i < natoms; i++) {
+    if(finite_atom(coords, i)) atoms[pos[cellof[i]]++] = i;
+  }
+}
+
+void CellList::query(const float3& lo, const float3& hi, std::vector<unsigned>& out) const {
+  out.clear();
+  if(atoms.empty()) return;
+
+  float blo[3] = {lo.x-origin.x, lo.y-origin.y, lo.z-origin.z};
+  float bhi[3] = {hi.x-origin.x, hi.y-origin.y, hi.z-origin.z};
+  unsigned cmin[3], cmax[3];
+  for(unsigned d = 0; d < 3; d++) {
+    float extent = ncells[d]*cell_size;
+    if(bhi[d] < 0 || blo[d] > extent || !(blo[d] <= bhi[d])) return; //box misses every atom (or is NaN)
+    cmin[d] = cell_index(blo[d], cell_size, ncells[d]);
+    cmax[d] = cell_index(bhi[d], cell_size, ncells[d]);
+  }
+
+  for(unsigned x = cmin[0]; x <= cmax[0]; x++) {
+    for(unsigned y = cmin[1]; y <= cmax[1]; y++) {
+      unsigned c = (x*ncells[1]+y)*ncells[2];
+      out.insert(out.end(), atoms.begin()+cell_start[c+cmin[2]], atoms.begin()+cell_start[c+cmax[2]+1]);
+    }
+  }
+  sort(out.begin(), out.end());
+}
+
+} /* namespace libmolgrid */
@@ -10,21 +10,50 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem.hpp>
-#include <openbabel/obconversion.h>
 #include <cuda_runtime.h>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <typeinfo>
+#include <sys/stat.h>
 
 
 namespace libmolgrid {
 
 using namespace std;
-using namespace OpenBabel;
 
-unsigned do_not_optimize_away;
+/* Identify typer by its class, type names, and the types and radii it
+ * assigns to gnina types or elements, so entries of struct_cache_dir are not
+ * used with a typer that would type atoms differently.
+ */
+static string typer_identity(const AtomTyper& typer) {
+  if(dynamic_cast<const CallbackIndexTyper*>(&typer) || dynamic_cast<const CallbackVectorTyper*>(&typer))
+    throw invalid_argument("struct_cache_dir can not be used with callback atom typers");
+
+  stringstream id;
+  id << typeid(typer).name() << "\n" << molcache3_typer_description(typer);
+  id << setprecision(9);
+  if(typer.is_vector_typer()) {
+    for(float r : dynamic_cast<const AtomVectorTyper&>(typer).get_vector_type_radii()) {
+      id << r << "\n";
+    }
+  } else {
+    for(int t = 0; t < 119; t++) {
+      auto t_r = typer.get_int_type(t);
+      id << t_r.first << " " << t_r.second << "\n";
+    }
+  }
+  return id.str();
+}
 
 //read in molcache if present
 CoordCache::CoordCache(std::shared_ptr<AtomTyper> t, const ExampleProviderSettings& settings,
     const std::string& mc): typer(t), data_root(settings.data_root), molcache(mc),
         use_cache(settings.cache_structs), addh(settings.add_hydrogens) {
+  if(settings.struct_cache_dir.length() > 0) {
+    struct_cache_dir = settings.struct_cache_dir;
+    typer_identity = libmolgrid::typer_identity(*typer);
+  }
   if(molcache.length() > 0) {
     static_assert(sizeof(size_t) == 8, "size_t must be 8 bytes");
 
@@ -36,56 +65,80 @@ CoordCache::CoordCache(std::shared_ptr<AtomTyper> t, const ExampleProviderSettin
     if(!mcache) throw invalid_argument("Could not open file: "+molcache);
     int version = 0;
     mcache.read((char*)&version,sizeof(int));
-    if(version != -1) {
-      throw invalid_argument(molcache+" is not a valid molcache2 file");
+    MolCacheLoad load = parse_molcache_load(settings.molcache_load);
+    if(version == MOLCACHE3_VERSION) {
+      //typed and indexed on disk, nothing to read in
+      molcache3 = make_shared<MolCache3>(molcache, load, settings.log_molcache_load);
+      molcache3->check_typer(*typer);
+      return;
     }
-    size_t start = 0;
-    mcache.read((char*)&start, sizeof(size_t));
-    mcache.seekg(start);
-
-    //open memory map for moldata
-    cache_map.open(molcache.c_str(),start);
-    if(!cache_map.is_open()) throw logic_error("Could not memory map "+molcache);
-
-    //read in name + offset
-    unsigned char len = 0;
-    char molname[256];
-    size_t offset = 0;
-
-    while(mcache.read((char*)&len, 1)) {
-      //read name then offset
-      mcache.read(molname, len);
-      molname[len] = 0;
-      mcache.read((char*)&offset, sizeof(size_t));
-
-      string mname(molname);
-      offsets[string_cache.get(mname)] = offset;
+    if(version != -1) {
+      throw invalid_argument(molcache+" is not a valid molcache2 or molcache3 file");
     }
+    //names are looked up in the index file if present, otherwise it is built from the trailer
+    molcache2 = make_shared<MolCache2>(molcache, load, settings.log_molcache_load);
+  }
 
-    //prefetch into file cache
-    unsigned sum = 0;
-    for(unsigned i = 0, n = cache_map.size(); i < n; i += 1024) {
-      sum += cache_map.data()[i];
-    }
-    do_not_optimize_away = sum;
+}
+
+namespace {
+//atom record of gninatypes and molcache2 files
+struct info {
+  float x,y,z;
+  int type;
+};
+}
+
+//set coord to share the memory of c, which is copied on write, keeping owner alive
+static void set_view(const std::shared_ptr<const void>& owner, const CoordinateSet& c, CoordinateSet& coord) {
+  coord.coords = MGrid2f(owner, c.coords.cpu().data(), c.coords.dimension(0), c.coords.dimension(1));
+  coord.type_index = MGrid1f(owner, c.type_index.cpu().data(), c.type_index.dimension(0));
+  coord.type_vector = MGrid2f(owner, c.type_vector.cpu().data(), c.type_vector.dimension(0), c.type_vector.dimension(1));
+  coord.radii = MGrid1f(owner, c.radii.cpu().data(), c.radii.dimension(0));
+  coord.max_type = c.max_type;
+  coord.src = c.src;
+}
+
+const CoordinateSet& CoordCache::MemCache::get(const char *fname, const std::function<void(CoordinateSet&)>& load) {
+  //interned names are heap allocated, so discard alignment bits
+  uintptr_t h = reinterpret_cast<uintptr_t>(fname);
+  Shard& shard = shards[((h >> 4) ^ (h >> 12)) % NUM_SHARDS];
+
+  Entry *e = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    e = &shard.entries[fname];
   }
 
+  if(!e->ready.load(std::memory_order_acquire)) {
+    std::lock_guard<std::mutex> lock(e->mtx);
+    if(!e->ready.load(std::memory_order_relaxed)) {
+      load(e->coords); //on exception the entry stays unset and the next request retries
+      e->ready.store(true, std::memory_order_release);
+    }
+  }
+  return e->coords;
 }
 
 //set coords using the cache
 void CoordCache::set_coords(const char *fname, CoordinateSet& coord) {
 
-  struct info {
-    float x,y,z;
-    int type;
-  };
-
+  MolCache3::entry e;
+  if(molcache3 && molcache3->find(fname, e)) {
+    //already typed, so use memory map directly; copied on write
+    coord.coords = MGrid2f(molcache3, e.coords, e.natoms, 3);
+    coord.type_index = MGrid1f(molcache3, e.types, e.natoms);
+    coord.radii = MGrid1f(molcache3, e.radii, e.natoms);
+    if(coord.type_vector.size() > 0) coord.type_vector = MGrid2f(0, 0);
+    coord.max_type = molcache3->num_types();
+    coord.src = fname;
+    return;
+  }
 
-  if(offsets.count(fname)) {
-    size_t off = offsets[fname];
-    const char *data = cache_map.data()+off;
+  const char *data = nullptr;
+  if(molcache2 && molcache2->find(fname, data)) {
     unsigned natoms = *(unsigned*)data;
-    info *atoms = (info*)(data+sizeof(unsigned));
+    const info *atoms = (const info*)(data+sizeof(unsigned));
 
     if(typer->is_vector_typer())
       throw invalid_argument("Vector typer used with molcache files");
@@ -95,7 +148,7 @@ void CoordCache::set_coords(const char *fname, CoordinateSet& coord) {
     vector<int> t; t.reserve(natoms);
     for(unsigned i = 0; i < natoms; i++)
     {
-      info& atom = atoms[i];
+      const info& atom = atoms[i];
       auto t_r = typer->get_int_type(atom.type);
       if(t_r.first >= 0) { //ignore neg
         t.push_back(t_r.first);
@@ -107,64 +160,195 @@ void CoordCache::set_coords(const char *fname, CoordinateSet& coord) {
     coord = CoordinateSet(c, t, r, typer->num_types());
     coord.src = fname;
   }
-  else if(memcache.count(fname)) {
-    coord = memcache[fname].clone(); //always copy out of cache
+  else if(use_cache) {
+    //cached sets are never modified, so return a view that is copied only if written to
+    const CoordinateSet& c = memcache->get(fname, [&](CoordinateSet& c) { load_coords(fname, c); });
+    set_view(memcache, c, coord);
   } else {
-    std::string fullname = fname;
-    if(data_root.length()) {
-      boost::filesystem::path p = boost::filesystem::path(data_root) / boost::filesystem::path(fname);
-      fullname = p.string();
-    }
-    //check for custom gninatypes file
-    if(boost::algorithm::ends_with(fname,".gninatypes"))
-    {
-      if(typer->is_vector_typer())
-        throw invalid_argument("Vector typer used with gninatypes files");
-
-      ifstream in(fullname.c_str());
-      if(!in) throw invalid_argument("Could not read "+fullname);
-
-      vector<float3> c;
-      vector<float> r;
-      vector<int> t;
-      info atom;
-
-      while(in.read((char*)&atom, sizeof(atom)))
-      {
-        auto t_r = typer->get_int_type(atom.type);
-        if(t_r.first >= 0) { //ignore neg
-          t.push_back(t_r.first);
-          r.push_back(t_r.second);
-          c.push_back(make_float3(atom.x,atom.y,atom.z));
-        }
-      }
+    load_coords(fname, coord);
+  }
+}
 
-      coord = CoordinateSet(c, t, r, typer->num_types());
-      coord.src = fname;
-    }
-    else if(!boost::algorithm::ends_with(fname,"none")) //reserved word
+void CoordCache::load_coords(const char *fname, CoordinateSet& coord) const {
+  std::string fullname = fname;
+  if(data_root.length()) {
+    boost::filesystem::path p = boost::filesystem::path(data_root) / boost::filesystem::path(fname);
+    fullname = p.string();
+  }
+  //check for custom gninatypes file
+  if(boost::algorithm::ends_with(fname,".gninatypes"))
+  {
+    if(typer->is_vector_typer())
+      throw invalid_argument("Vector typer used with gninatypes files");
+
+    ifstream in(fullname.c_str());
+    if(!in) throw invalid_argument("Could not read "+fullname);
+
+    vector<float3> c;
+    vector<float> r;
+    vector<int> t;
+    info atom;
+
+    while(in.read((char*)&atom, sizeof(atom)))
     {
-      //read mol from file and set mol info (atom coords and grid positions)
-      OBConversion conv;
-      OBMol mol;
-      if(!conv.ReadFile(&mol, fullname.c_str()))
-        throw invalid_argument("Could not read " + fullname);
-
-      if(addh) {
-        mol.AddHydrogens();
+      auto t_r = typer->get_int_type(atom.type);
+      if(t_r.first >= 0) { //ignore neg
+        t.push_back(t_r.first);
+        r.push_back(t_r.second);
+        c.push_back(make_float3(atom.x,atom.y,atom.z));
       }
+    }
 
-      coord = CoordinateSet(&mol, *typer);
+    coord = CoordinateSet(c, t, r, typer->num_types());
+    coord.src = fname;
+  }
+  else if(!boost::algorithm::ends_with(fname,"none")) //reserved word
+  {
+    if(struct_cache_dir.length() > 0 && read_struct_cache(fullname, coord)) {
       coord.src = fname;
-    } else {
-      coord = CoordinateSet();
+      return;
     }
+    //read mol from file and set mol info (atom coords and grid positions);
+    //openbabel is not thread safe, so this holds openbabel_mutex
+    coord = read_coordinate_set(fullname, *typer, addh);
+    coord.src = fname;
+    if(struct_cache_dir.length() > 0) write_struct_cache(fullname, coord);
+  } else {
+    coord = CoordinateSet();
+  }
+}
+
+
+namespace {
+//header of struct_cache_dir entries, followed by the key and then the grids of the set
+struct struct_cache_header {
+  char magic[8] = {'L', 'M', 'G', 'S', 'E', 'T', '0', '1'};
+  uint32_t max_type = 0;
+  uint32_t key_length = 0;
+  uint64_t natoms = 0; //rows of coords
+  uint64_t type_index_size = 0;
+  uint64_t type_vector_rows = 0;
+  uint64_t type_vector_cols = 0;
+  uint64_t radii_size = 0;
+};
 
-    if(use_cache) { //save coord
-      memcache[fname] = coord;
+//key of molecule file fullname, or empty if it can't be accessed; entry is set to the path of its cache file;
+//the modification time has nanosecond resolution where the filesystem provides it, so
+//a file rewritten within the same second at the same size only hits on coarse filesystems
+string struct_cache_key(const string& dir, const string& fullname, bool addh, const string& typer_identity, string& entry) {
+  namespace fs = boost::filesystem;
+  fs::path path = fs::absolute(fullname);
+  struct stat st;
+  if(stat(path.string().c_str(), &st) != 0) return "";
+#ifdef __APPLE__
+  long mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+  long mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+
+  stringstream key;
+  key << path.string() << "\n" << st.st_mtime << "." << setfill('0') << setw(9) << mtime_nsec << setfill(' ')
+      << " " << st.st_size << " " << addh << "\n" << typer_identity;
+  string ret = key.str();
+
+  stringstream name;
+  uint64_t h = molcache_hash(ret.c_str(), ret.length());
+  name << hex << setfill('0') << setw(16) << h;
+  entry = (fs::path(dir) / name.str().substr(0, 2) / (name.str() + ".lmgset")).string();
+  return ret;
+}
+
+template <class G>
+bool read_grid(istream& in, G& grid) {
+  return (bool)in.read((char*)grid.cpu().data(), grid.size() * sizeof(float));
+}
+
+template <class G>
+void write_grid(ostream& out, const G& grid) {
+  out.write((const char*)grid.cpu().data(), grid.size() * sizeof(float));
+}
+}
+
+bool CoordCache::read_struct_cache(const std::string& fullname, CoordinateSet& coord) const {
+  string entry;
+  string key = struct_cache_key(struct_cache_dir, fullname, addh, typer_identity, entry);
+  if(key.length() == 0) return false;
+
+  ifstream in(entry.c_str(), ios::binary);
+  if(!in) return false;
+  struct_cache_header header, expected;
+  if(!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0
+      || header.key_length != key.length())
+    return false;
+  string stored(key.length(), 0);
+  if(!in.read(&stored[0], stored.length()) || stored != key) return false; //hash collision
+
+  //sizes must describe a consistent set and exactly fill the rest of the file,
+  //so a truncated or corrupt entry is a miss rather than a huge allocation
+  boost::system::error_code ec;
+  uint64_t fsize = boost::filesystem::file_size(entry, ec);
+  if(ec || fsize < sizeof(header) + key.length()) return false;
+  uint64_t nfloats = (fsize - sizeof(header) - key.length()) / sizeof(float);
+  uint64_t natoms = header.natoms, rows = header.type_vector_rows, cols = header.type_vector_cols;
+  if(header.radii_size != natoms || (header.type_index_size != 0 && header.type_index_size != natoms)
+      || (rows != 0 && rows != natoms) || (rows != 0 && cols != header.max_type)
+      || (natoms > 0 && (header.type_index_size == 0) == (rows == 0)))
+    return false;
+  if(natoms > nfloats / 4 || (cols != 0 && rows > nfloats / cols)
+      || natoms * 3 + header.type_index_size + rows * cols + header.radii_size != nfloats
+      || fsize != sizeof(header) + key.length() + nfloats * sizeof(float))
+    return false;
+
+  CoordinateSet c;
+  c.coords = MGrid2f(header.natoms, 3);
+  c.type_index = MGrid1f(header.type_index_size);
+  c.type_vector = MGrid2f(header.type_vector_rows, header.type_vector_cols);
+  c.radii = MGrid1f(header.radii_size);
+  c.max_type = header.max_type;
+  if(!read_grid(in, c.coords) || !read_grid(in, c.type_index) || !read_grid(in, c.type_vector) || !read_grid(in, c.radii))
+    return false;
+  coord = c;
+  return true;
+}
+
+void CoordCache::write_struct_cache(const std::string& fullname, const CoordinateSet& coord) const {
+  namespace fs = boost::filesystem;
+  string entry;
+  string key = struct_cache_key(struct_cache_dir, fullname, addh, typer_identity, entry);
+  if(key.length() == 0) return;
+
+  struct_cache_header header;
+  header.max_type = coord.max_type;
+  header.key_length = key.length();
+  header.natoms = coord.coords.dimension(0);
+  header.type_index_size = coord.type_index.size();
+  header.type_vector_rows = coord.type_vector.dimension(0);
+  header.type_vector_cols = coord.type_vector.dimension(1);
+  header.radii_size = coord.radii.size();
+
+  //the cache is an optimization, so failing to write to it is not an error;
+  //entries are renamed into place so concurrent readers never see partial ones
+  boost::system::error_code ec;
+  fs::path path(entry);
+  fs::create_directories(path.parent_path(), ec);
+  fs::path tmp = path.parent_path() / fs::unique_path("%%%%%%%%%%%%.tmp");
+  {
+    ofstream out(tmp.string().c_str(), ios::binary);
+    if(!out) return;
+    out.write((const char*)&header, sizeof(header));
+    out.write(key.c_str(), key.length());
+    write_grid(out, coord.coords);
+    write_grid(out, coord.type_index);
+    write_grid(out, coord.type_vector);
+    write_grid(out, coord.radii);
+    if(!out) {
+      out.close();
+      fs::remove(tmp, ec);
+      return;
     }
   }
+  fs::rename(tmp, path, ec);
+  if(ec) fs::remove(tmp, ec);
 }
 
-
 } /* namespace libmolgrid */
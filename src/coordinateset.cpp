@@ -8,7 +8,13 @@
 
 #include "libmolgrid/coordinateset.h"
 #include "libmolgrid/atom_typer.h"
+#include "libmolgrid/example.h"
+#include "libmolgrid/parallel.h"
 #include <openbabel/obiter.h>
+#include <openbabel/obconversion.h>
+#include <fstream>
+#include <mutex>
+#include <sstream>
 
 namespace libmolgrid {
 
@@ -17,56 +23,191 @@ using namespace OpenBabel;
 
 CoordinateSet::CoordinateSet(OBMol *mol): CoordinateSet(mol, defaultGninaLigandTyper) {}
 
-//initialize with obmol
-CoordinateSet::CoordinateSet(OBMol *mol, const AtomTyper& typer)
-    : max_type(typer.num_types()) {
+std::mutex& openbabel_mutex() {
+  static std::mutex m;
+  return m;
+}
 
-  vector<float3> c; c.reserve(mol->NumAtoms());
-  vector<float> types;  types.reserve(mol->NumAtoms());
-  vector<vector<float> > vector_types;  vector_types.reserve(mol->NumAtoms());
-  vector<float> rads; rads.reserve(mol->NumAtoms());
-  vector<float> vec;
+//contents of file fname; only file I/O, so no lock is needed
+static string read_file_contents(const string& fname) {
+  ifstream in(fname.c_str(), ios::binary);
+  if(!in) throw invalid_argument("Could not read " + fname);
+  stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
 
+//parse contents, the bytes of molecule file fname, into mol using the format
+//of its extension, adding hydrogens if addh; the caller must hold openbabel_mutex
+static void parse_molecule(const string& fname, const string& contents, bool addh, OBMol& mol) {
+  OBConversion conv; //the constructor registers global options
+  bool gzip = false;
+  OBFormat *format = conv.FormatFromExt(fname, gzip);
+  if(!format || !conv.SetInFormat(format, gzip) || !conv.ReadString(&mol, contents))
+    throw invalid_argument("Could not read " + fname);
+  if(addh) {
+    mol.AddHydrogens();
+  }
+}
+
+namespace {
+//per-atom results of typing a molecule, reused between molecules
+struct TypingBuffers {
+  vector<float> vec; //vector type of an atom
+  vector<int> atom_types; //index type of every atom
+  vector<float> atom_radii; //radius of every atom
+};
+}
+
+//append the coordinates, types and radii of the atoms of mol not ignored by
+//typer to flat buffers, vector types taking num_types elements per atom,
+//returning the number of atoms appended
+static unsigned type_atoms(OBMol *mol, const AtomTyper& typer,
+    vector<float>& coords, vector<float>& types, vector<float>& radii, TypingBuffers& buf) {
+  unsigned max_type = typer.num_types();
+  bool vector_typer = typer.is_vector_typer();
+  unsigned N = 0;
+
+  if(!vector_typer) {
+    typer.type_molecule(mol, buf.atom_types, buf.atom_radii);
+    if(buf.atom_types.size() != mol->NumAtoms() || buf.atom_radii.size() != mol->NumAtoms())
+      throw invalid_argument("Typer did not type every atom");
+  }
+
+  unsigned i = 0;
   FOR_ATOMS_OF_MOL(a, mol){
     OBAtom *atom = &*a; //convert from iterator
 
-    if(typer.is_vector_typer()) {
-
-      float radius = typer.get_atom_type_vector(atom, vec);
-      if(radius > 0) { //don't ignore
-        c.push_back(make_float3(atom->GetX(), atom->GetY(), atom->GetZ()));
-        vector_types.push_back(vec);
-        rads.push_back(radius);
-      }
+    if(vector_typer) {
+      float radius = typer.get_atom_type_vector(atom, buf.vec);
+      if(radius <= 0) continue; //ignore
+      if(buf.vec.size() != max_type) throw invalid_argument("Invalid type vector size");
+      types.insert(types.end(), buf.vec.begin(), buf.vec.end());
+      radii.push_back(radius);
     } else {
-      auto type_rad = typer.get_atom_type_index(atom);
-      int type = type_rad.first;
-      float r = type_rad.second;
+      int type = buf.atom_types[i];
+      float r = buf.atom_radii[i];
+      i++;
       if(type >= (int)max_type) throw invalid_argument("Invalid type");
-      if(type >= 0) { //don't ignore atom
-        c.push_back(make_float3(atom->GetX(), atom->GetY(), atom->GetZ()));
-        types.push_back(type);
-        rads.push_back(r);
-      }
+      if(type < 0) continue; //ignore atom
+      types.push_back(type);
+      radii.push_back(r);
     }
+    coords.push_back(atom->GetX());
+    coords.push_back(atom->GetY());
+    coords.push_back(atom->GetZ());
+    N++;
   }
+  return N;
+}
+
+//initialize with obmol
+CoordinateSet::CoordinateSet(OBMol *mol, const AtomTyper& typer)
+    : max_type(typer.num_types()) {
+
+  vector<float> c; c.reserve(mol->NumAtoms()*3);
+  vector<float> types;  types.reserve(mol->NumAtoms());
+  vector<float> rads; rads.reserve(mol->NumAtoms());
+  TypingBuffers buf;
+  unsigned N = type_atoms(mol, typer, c, types, rads, buf);
 
   //allocate grids and initialize
-  unsigned N = c.size();
   coords = MGrid2f(N,3);
-  assert(sizeof(float3)*N == sizeof(float)*coords.size());
-  memcpy(coords.cpu().data(), &c[0], sizeof(float3)*N);
+  memcpy(coords.cpu().data(), c.data(), sizeof(float)*c.size());
 
   radii = MGrid1f(N);
-  memcpy(radii.cpu().data(), &rads[0], sizeof(float)*N);
+  memcpy(radii.cpu().data(), rads.data(), sizeof(float)*N);
 
   if(typer.is_vector_typer()) {
     type_vector = MGrid2f(N,max_type);
-    memcpy(type_vector.cpu().data(), &vector_types[0], sizeof(float)*N*max_type);
+    memcpy(type_vector.cpu().data(), types.data(), sizeof(float)*N*max_type);
   } else {
     type_index = MGrid1f(N);
-    memcpy(type_index.cpu().data(), &types[0], sizeof(float)*N);
+    memcpy(type_index.cpu().data(), types.data(), sizeof(float)*N);
+  }
+}
+
+CoordinateSet read_coordinate_set(const string& fname, const AtomTyper& typer, bool addh) {
+  string contents = read_file_contents(fname);
+  lock_guard<mutex> lock(openbabel_mutex());
+  OBMol mol;
+  parse_molecule(fname, contents, addh, mol);
+  return CoordinateSet(&mol, typer);
+}
+
+namespace {
+//typed atoms of a sequence of molecules
+struct TypedAtoms {
+  vector<float> coords;
+  vector<float> types;
+  vector<float> radii;
+};
+}
+
+vector<CoordinateSet> read_coordinate_sets(const vector<string>& fnames, const AtomTyper& typer, bool addh, unsigned nthreads) {
+  size_t n = fnames.size();
+  unsigned max_type = typer.num_types();
+  bool vector_typer = typer.is_vector_typer();
+  unsigned ncols = vector_typer ? max_type : 1;
+  vector<unsigned> natoms(n);
+
+  //the atoms of the files of chunk c are in parts[c]
+  vector<TypedAtoms> parts(effective_threads(nthreads));
+  //files are read concurrently, but openbabel keeps perception state in
+  //globals, so parsing, protonation and typing are serialized
+  auto read = [&](size_t begin, size_t end, TypedAtoms& atoms) {
+    OBMol mol;
+    TypingBuffers buf;
+    for(size_t i = begin; i < end; i++) {
+      string contents = read_file_contents(fnames[i]);
+      lock_guard<mutex> lock(openbabel_mutex());
+      mol.Clear();
+      parse_molecule(fnames[i], contents, addh, mol);
+      natoms[i] = type_atoms(&mol, typer, atoms.coords, atoms.types, atoms.radii, buf);
+    }
+  };
+
+  parallel_for(nthreads, n, [&](size_t begin, size_t end, unsigned chunk) {
+    read(begin, end, parts[chunk]);
+  });
+
+  //copy every part into its place in preallocated buffers
+  vector<size_t> part_start(parts.size() + 1, 0);
+  for(unsigned p = 0; p < parts.size(); p++) {
+    part_start[p + 1] = part_start[p] + parts[p].radii.size();
   }
+  size_t total = part_start.back();
+  auto all = make_shared<TypedAtoms>();
+  all->coords.resize(total * 3);
+  all->types.resize(total * ncols);
+  all->radii.resize(total);
+  parallel_for(nthreads, parts.size(), [&](size_t begin, size_t end, unsigned) {
+    for(size_t p = begin; p < end; p++) {
+      TypedAtoms& part = parts[p];
+      memcpy(all->coords.data() + part_start[p] * 3, part.coords.data(), sizeof(float) * part.coords.size());
+      memcpy(all->types.data() + part_start[p] * ncols, part.types.data(), sizeof(float) * part.types.size());
+      memcpy(all->radii.data() + part_start[p], part.radii.data(), sizeof(float) * part.radii.size());
+      part = TypedAtoms(); //release memory
+    }
+  });
+
+  vector<CoordinateSet> ret(n);
+  size_t start = 0;
+  for(size_t i = 0; i < n; i++) {
+    CoordinateSet& c = ret[i];
+    unsigned N = natoms[i];
+    c.coords = MGrid2f(all, all->coords.data() + start * 3, N, 3);
+    if(vector_typer) {
+      c.type_vector = MGrid2f(all, all->types.data() + start * ncols, N, ncols);
+    } else {
+      c.type_index = MGrid1f(all, all->types.data() + start, N);
+    }
+    c.radii = MGrid1f(all, all->radii.data() + start, N);
+    c.max_type = max_type;
+    c.src = string_cache.get(fnames[i]);
+    start += N;
+  }
+  return ret;
 }
 
 //initialize with indexed types
@@ -207,6 +348,75 @@ float3 CoordinateSet::center() const {
   return ret;
 }
 
+unsigned CoordinateSet::crop(const float3& c, float maxdist) {
+  unsigned N = coords.dimension(0);
+  if(N == 0) return 0;
+
+  //read through const views so shared read-only memory is not copied
+  const MGrid2f& ccoords = coords;
+  const Grid2f& cc = ccoords.cpu();
+  float maxd2 = maxdist*maxdist;
+  vector<unsigned> keep; keep.reserve(N);
+  for(unsigned i = 0; i < N; i++) {
+    float dx = cc(i,0)-c.x;
+    float dy = cc(i,1)-c.y;
+    float dz = cc(i,2)-c.z;
+    if(dx*dx+dy*dy+dz*dz <= maxd2) keep.push_back(i);
+  }
+  unsigned K = keep.size();
+  if(K == N) return 0;
+
+  //allocate fresh grids rather than compacting in place since memory may be shared
+  MGrid2f newcoords(K,3);
+  MGrid1f newradii(K);
+  const MGrid1f& cradii = radii;
+  const Grid1f& cr = cradii.cpu();
+  Grid2f nc = newcoords.cpu();
+  Grid1f nr = newradii.cpu();
+  for(unsigned i = 0; i < K; i++) {
+    unsigned k = keep[i];
+    nc(i,0) = cc(k,0);
+    nc(i,1) = cc(k,1);
+    nc(i,2) = cc(k,2);
+    nr(i) = cr(k);
+  }
+
+  if(type_index.size() > 0) {
+    MGrid1f newtypes(K);
+    const MGrid1f& ctypes = type_index;
+    const Grid1f& ct = ctypes.cpu();
+    Grid1f nt = newtypes.cpu();
+    for(unsigned i = 0; i < K; i++) {
+      nt(i) = ct(keep[i]);
+    }
+    type_index = newtypes;
+  }
+  if(type_vector.size() > 0) {
+    unsigned T = type_vector.dimension(1);
+    MGrid2f newtypes(K,T);
+    const MGrid2f& cvectors = type_vector;
+    const Grid2f& cv = cvectors.cpu();
+    Grid2f nt = newtypes.cpu();
+    for(unsigned i = 0; i < K; i++) {
+      memcpy(nt[i].data(), cv[keep[i]].data(), sizeof(float)*T);
+    }
+    type_vector = newtypes;
+  }
+  coords = newcoords;
+  radii = newradii;
+  return N-K;
+}
+
+float CoordinateSet::max_radius() const {
+  float ret = 0;
+  unsigned N = radii.size();
+  radii.tocpu();
+  for(unsigned i = 0; i < N; i++) {
+    ret = max(ret, radii(i));
+  }
+  return ret;
+}
+
 void CoordinateSet::dump(std::ostream& out) const {
   unsigned N = coords.dimension(0);
   coords.tocpu();
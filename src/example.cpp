@@ -8,6 +8,11 @@
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
 #include <unordered_set>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <boost/algorithm/string.hpp>
 #include <cuda_runtime.h>
 
@@ -19,6 +24,66 @@ using namespace std;
 
 StringCache string_cache;
 
+static const size_t STRING_ARENA_SIZE = 4096;
+
+//copy s, zero terminated, into the arena
+const char *StringCache::Shard::copy(const char *s, size_t len) {
+  size_t n = len + 1;
+  if (n > left) {
+    size_t sz = max(n, STRING_ARENA_SIZE);
+    arenas.emplace_back(new char[sz]);
+    next = arenas.back().get();
+    left = sz;
+  }
+  char *ret = next;
+  memcpy(ret, s, len);
+  ret[len] = 0;
+  next += n;
+  left -= n;
+  return ret;
+}
+
+const char* StringCache::get(const char *s, size_t len) {
+  //FNV-1a
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 1099511628211ULL;
+  }
+  Shard& shard = shards[h >> 58]; //top bits pick the shard, bottom bits the slot
+  lock_guard<mutex> lock(shard.mtx);
+
+  if (2 * (shard.count + 1) > shard.table.size()) {
+    //grow, rehashing with stored hashes
+    vector<Slot> table(max<size_t>(64, 2 * shard.table.size()), Slot{0, nullptr, 0});
+    size_t mask = table.size() - 1;
+    for (const Slot& slot : shard.table) {
+      if (!slot.str) continue;
+      size_t i = slot.hash & mask;
+      while (table[i].str) i = (i + 1) & mask;
+      table[i] = slot;
+    }
+    memory += (table.size() - shard.table.size()) * sizeof(Slot);
+    shard.table.swap(table);
+  }
+
+  size_t mask = shard.table.size() - 1;
+  size_t i = h & mask;
+  for (; shard.table[i].str; i = (i + 1) & mask) {
+    const Slot& slot = shard.table[i];
+    if (slot.hash == h && slot.len == len && memcmp(slot.str, s, len) == 0) return slot.str;
+  }
+
+  //not present, insert at the empty slot that ended the probe
+  size_t arenas = shard.arenas.size();
+  const char *str = shard.copy(s, len);
+  if (shard.arenas.size() != arenas) memory += max(len + 1, STRING_ARENA_SIZE);
+  shard.table[i] = Slot{h, str, len};
+  shard.count++;
+  num_strings++;
+  return str;
+}
+
 size_t Example::coordinate_size() const {
   unsigned N = 0;
   for(unsigned i = 0, n = sets.size(); i < n; i++) {
@@ -207,6 +272,70 @@ CoordinateSet Example::merge_coordinates(unsigned start, bool unique_index_types
   }
 }
 
+void Example::merge_coordinates(CoordinateSet& c, unsigned start, bool unique_index_types) const {
+  if(sets.size() <= start) {
+    c = CoordinateSet();
+    return;
+  } else if(sets.size() == start+1) {
+    c.copyInto(sets[start]);
+    return;
+  }
+
+  bool indexed = sets[start].has_indexed_types();
+  unsigned maxt = sets[start].max_type;
+  size_t N = 0, NR = 0;
+  for(unsigned s = start, ns = sets.size(); s < ns; s++) {
+    const CoordinateSet& CS = sets[s];
+    if(indexed) {
+      if(CS.size() == 0) continue; //ignore empties
+      if(!CS.has_indexed_types()) throw logic_error("Coordinate sets do not have compatible index types for merge.");
+    } else {
+      if(!CS.has_vector_types())
+        throw logic_error("Coordinate sets do not have compatible vector types for merge.");
+      if(CS.type_vector.dimension(1) != maxt)
+        throw logic_error("Coordinate sets do not have compatible sized vector types.");
+    }
+    N += CS.size();
+    NR += CS.radii.size();
+  }
+
+  c.coords = c.coords.resized(N, 3);
+  c.radii = c.radii.resized(NR);
+  if(indexed) {
+    c.type_index = c.type_index.resized(N);
+    c.type_vector = c.type_vector.resized(0, 0);
+    c.max_type = type_size(unique_index_types);
+  } else {
+    c.type_index = c.type_index.resized(0);
+    c.type_vector = c.type_vector.resized(N, maxt);
+    c.max_type = maxt;
+  }
+  c.src = nullptr;
+
+  size_t offset = 0, roffset = 0; //atom and radius positions in c
+  unsigned toffset = 0; //amount to offset types
+  for(unsigned s = start, ns = sets.size(); s < ns; s++) {
+    const CoordinateSet& CS = sets[s];
+    unsigned n = CS.size();
+    if(indexed && n == 0) continue;
+
+    memcpy(c.coords.cpu().data()+3*offset, CS.coords.cpu().data(), sizeof(float)*3*n);
+    memcpy(c.radii.cpu().data()+roffset, CS.radii.cpu().data(), sizeof(float)*CS.radii.size());
+    if(indexed) {
+      float *types = c.type_index.cpu().data()+offset;
+      const float *src = CS.type_index.cpu().data();
+      for(unsigned i = 0; i < n; i++) {
+        types[i] = src[i]+toffset;
+      }
+      if(unique_index_types) toffset += CS.max_type;
+    } else {
+      memcpy(c.type_vector.cpu().data()+offset*maxt, CS.type_vector.cpu().data(), sizeof(float)*n*maxt);
+    }
+    offset += n;
+    roffset += CS.radii.size();
+  }
+}
+
 template <bool isCUDA>
 void Example::extract_labels(const vector<Example>& examples, Grid<float, 2, isCUDA>& out) {
   if(out.dimension(0) != examples.size()) throw std::out_of_range("Grid dimension does not match number of examples: "+itoa(out.dimension(0)) + " vs "+itoa(examples.size()));
@@ -254,59 +383,139 @@ template void Example::extract_label(const vector<Example>&, unsigned, Grid<floa
 template void Example::extract_label(const vector<Example>&, unsigned, Grid<float, 1, true>& );
 
 
-bool is_numeric(const string& number)
-{
-    char* end = nullptr;
-    strtod(number.c_str(), &end);  //if entire string is number, end will be set to end of string
+static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* Parse the decimal number [b,e) into val, returning false if it is not a
+ * number.  Numbers with at most 15 significant digits and small exponents
+ * are converted exactly with a single rounding; anything else falls back
+ * to strtod, which [b,e) must be terminated for (e.g. by whitespace).
+ */
+static bool parse_number(const char *b, const char *e, double& val) {
+  const char *p = b;
+  bool neg = false;
+  if (p != e && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+  uint64_t m = 0;
+  int sig = 0, exp10 = 0;
+  bool digits = false, exact = true;
+  for (; p != e && isdigit(*p); p++) {
+    digits = true;
+    if (m || *p != '0') {
+      if (++sig > 15) exact = false;
+      else m = m * 10 + (*p - '0');
+    }
+  }
+  if (p != e && *p == '.') {
+    for (p++; p != e && isdigit(*p); p++) {
+      digits = true;
+      if (m || *p != '0') {
+        if (++sig > 15) exact = false;
+        else m = m * 10 + (*p - '0');
+      }
+      exp10--;
+    }
+  }
+  if (!digits) return false;
+  if (p != e && (*p == 'e' || *p == 'E')) {
+    p++;
+    bool eneg = false;
+    if (p != e && (*p == '-' || *p == '+')) eneg = *p++ == '-';
+    if (p == e || !isdigit(*p)) return false;
+    int x = 0;
+    for (; p != e && isdigit(*p); p++) {
+      if (x < 10000) x = x * 10 + (*p - '0');
+    }
+    exp10 += eneg ? -x : x;
+  }
+  if (p != e) return false;
+
+  if (exact && m == 0) {
+    val = neg ? -0.0 : 0.0;
+  } else if (exact && exp10 >= -22 && exp10 <= 22) {
+    val = exp10 < 0 ? m / powers_of_ten[-exp10] : m * powers_of_ten[exp10];
+    if (neg) val = -val;
+  } else {
+    char *end = nullptr;
+    errno = 0;
+    val = strtod(b, &end);
+    if (end != e || (errno == ERANGE && fabs(val) == HUGE_VAL)) return false; //underflow is fine
+  }
+  return true;
+}
 
-    return end != nullptr && *end == 0;  //could also check end != number.c_str() if whole string doesn't need to be numerical
+//true if strtod can parse all of [b,e), which must be terminated
+static bool is_numeric(const char *b, const char *e)
+{
+  double val = 0;
+  if (parse_number(b, e, val)) return true;
+  char* end = nullptr;
+  strtod(b, &end);
+  return end == e;
 }
 
-ExampleRef::ExampleRef(const std::string& line, int numlabels, bool hasgroup) {
-  stringstream stream(line);
-  string tmp;
+void ExampleLine::parse(const char *begin, const char *end, int numlabels, bool hasgroup) {
+  labels.clear();
+  files.clear();
+  group = -1;
+
+  //whitespace separated tokens
+  tokens.clear();
+  for (const char *p = begin; p != end;) {
+    while (p != end && isspace(*p)) p++;
+    if (p == end) break;
+    const char *t = p;
+    while (p != end && !isspace(*p)) p++;
+    tokens.push_back(make_pair(t, size_t(p - t)));
+  }
 
-  if(numlabels < 0) { //auto detect
-    vector<string> tokens;
-    boost::algorithm::split(tokens, line,boost::is_any_of("\t "),boost::token_compress_on);
-    for(unsigned i = 0, n = tokens.size(); i < n; i++) {
+  if (numlabels < 0) { //auto detect
+    for (unsigned i = 0, n = tokens.size(); i < n; i++) {
       numlabels = i;
-      if(!is_numeric(tokens[i]))
+      if (!is_numeric(tokens[i].first, tokens[i].first + tokens[i].second))
         break;
     }
-    if(hasgroup) numlabels--;
+    if (hasgroup) numlabels--;
   }
 
+  unsigned pos = 0;
+  auto missing = [&]() {
+    return std::invalid_argument("Missing molecular data in line: " + string(begin, end));
+  };
   //get group if needed
-  if(hasgroup) {
-    stream >> group;
+  if (hasgroup) {
+    if (pos >= tokens.size()) throw missing();
+    group = strtol(tokens[pos].first, nullptr, 10);
+    pos++;
   }
 
   //grab all labels
-  double label = 0;
-  labels.reserve(numlabels);
-  for(int i = 0; i < numlabels; i++) {
-    stream >> label;
+  for (int i = 0; i < numlabels; i++, pos++) {
+    double label = 0;
+    if (pos >= tokens.size() || !parse_number(tokens[pos].first, tokens[pos].first + tokens[pos].second, label))
+      throw missing();
     labels.push_back(label);
   }
 
   //remainder of the line should be whitespace spearated file names
-  vector<const char *> names;
-  while(stream) {
-    tmp.clear();
-    stream >> tmp;
-    if(tmp.length() == 0 || tmp[0] == '#') //nothing left or hit comment character
+  for (unsigned n = tokens.size(); pos < n; pos++) {
+    if (tokens[pos].first[0] == '#') //hit comment character
       break;
-    const char* n = string_cache.get(tmp);
-    names.push_back(n);
+    files.push_back(tokens[pos]);
   }
 
-  if(names.size() == 0) {
-    throw std::invalid_argument("Missing molecular data in line: "+line);
-  }
-  files.reserve(names.size());
-  files = names;
+  if (files.size() == 0) throw missing();
+}
 
+ExampleRef::ExampleRef(const std::string& line, int numlabels, bool hasgroup) {
+  ExampleLine parsed;
+  parsed.parse(line.c_str(), line.c_str() + line.length(), numlabels, hasgroup);
+  labels = parsed.labels;
+  group = parsed.group;
+  files.reserve(parsed.files.size());
+  for (const auto& f : parsed.files) {
+    files.push_back(string_cache.get(f.first, f.second));
+  }
 }
 
 
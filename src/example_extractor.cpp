@@ -12,12 +12,20 @@
 #include <boost/filesystem/path.hpp>
 #include <openbabel/obconversion.h>
 #include <cuda_runtime.h>
+#include <cmath>
 
 namespace libmolgrid {
 
 using namespace std;
 using namespace OpenBabel;
 
+void ExampleExtractor::crop(CoordinateSet& c, const float3& center) const {
+  //any grid point is within half the diagonal of the grid from its center,
+  //regardless of rotation, and no atom has density beyond its scaled radius
+  float maxdist = crop_dimension*sqrtf(3.0f)/2.0f + c.max_radius()*crop_radius_multiple + crop_padding;
+  c.crop(center, maxdist);
+}
+
 void ExampleExtractor::extract(const ExampleRef& ref, Example& ex) {
   ex.labels = ref.labels; //the easy part
   ex.group = ref.group;
@@ -34,6 +42,13 @@ void ExampleExtractor::extract(const ExampleRef& ref, Example& ex) {
       if(t >= coord_caches.size()) t = coord_caches.size()-1; //repeat last typer if necessary
       coord_caches[t].set_coords(fname, ex.sets[i]);
     }
+
+    if(crop_dimension > 0 && ex.sets.size() > 1) {
+      float3 center = ex.sets.back().center();
+      for(unsigned i = 0, n = ex.sets.size()-1; i < n; i++) {
+        crop(ex.sets[i], center);
+      }
+    }
   } else { //duplicate first pose (receptor) to match each of the remaining poses
     unsigned N = ref.files.size() - 1;
     ex.sets.resize(N*2);
@@ -43,9 +58,18 @@ void ExampleExtractor::extract(const ExampleRef& ref, Example& ex) {
       unsigned t = i;
       if(t >= coord_caches.size()) t = coord_caches.size()-1; //repeat last typer if necessary
       coord_caches[t].set_coords(fname, ex.sets[2*(i-1)+1]);
+    }
+
+    //duplicate receptor by copying
+    for(unsigned i = 2, n = ref.files.size(); i < n; i++) {
+      ex.sets[2*(i-1)] = ex.sets[0];
+    }
 
-      //duplicate receptor by copying
-      if(i > 1) ex.sets[2*(i-1)] = ex.sets[0];
+    //crop each copy of the receptor around the ligand it is paired with
+    if(crop_dimension > 0) {
+      for(unsigned i = 0; i < N; i++) {
+        crop(ex.sets[2*i], ex.sets[2*i+1].center());
+      }
     }
   }
 
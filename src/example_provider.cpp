@@ -7,79 +7,281 @@
 
 #include "libmolgrid/example_provider.h"
 #include "libmolgrid/atom_typer.h"
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <algorithm>
 
 namespace libmolgrid {
 
 using namespace std;
 
+/** \brief Extracts batches of example refs in background threads.
+ * Batches are returned in the order they were pushed.  Each worker
+ * extracts a whole batch at a time.
+ */
+class ExamplePrefetcher {
+  public:
+    /// a batch being extracted; wait can be called without holding any lock
+    class Job {
+        friend class ExamplePrefetcher;
+        vector<ExampleRef> refs;
+        vector<Example> examples;
+        promise<void> finished;
+        future<void> ready = finished.get_future();
+      public:
+        /// wait for the batch to be extracted and take its examples
+        void wait(vector<Example>& ex) {
+          ready.get(); //rethrows extraction errors
+          ex.swap(examples);
+        }
+    };
+
+  private:
+    ExampleExtractor& extractor;
+    unsigned batch_size;
+    unsigned capacity;
+    deque<shared_ptr<Job> > jobs; //batches in the order they are returned
+    deque<shared_ptr<Job> > pending; //batches no worker has started
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable work_cv; //new batch or stopping
+    bool stopping = false;
+
+    //batches already returned by pop are finished even when stopping, since a caller waits on them
+    void work() {
+      unique_lock<mutex> lock(mtx);
+      while(true) {
+        work_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+        if(pending.empty()) return;
+        shared_ptr<Job> job = pending.front();
+        pending.pop_front();
+        lock.unlock();
+
+        try {
+          job->examples.resize(job->refs.size());
+          for(unsigned i = 0, n = job->refs.size(); i < n; i++) {
+            extractor.extract(job->refs[i], job->examples[i]);
+          }
+          job->finished.set_value();
+        } catch(...) {
+          job->finished.set_exception(current_exception());
+        }
+
+        lock.lock();
+      }
+    }
+
+  public:
+    ExamplePrefetcher(ExampleExtractor& e, unsigned nthreads, unsigned bsize, unsigned cap):
+      extractor(e), batch_size(bsize), capacity(max(cap, 1U)) {
+      workers.reserve(nthreads);
+      for(unsigned i = 0; i < nthreads; i++) {
+        workers.push_back(thread(&ExamplePrefetcher::work, this));
+      }
+    }
+
+    ~ExamplePrefetcher() {
+      deque<ExampleRef> unused;
+      stop(unused);
+    }
+
+    unsigned get_batch_size() const { return batch_size; }
+
+    /// true if capacity batches are queued
+    bool full() const { return jobs.size() >= capacity; }
+
+    /// queue a batch for extraction, takes ownership of the contents of refs
+    void push(vector<ExampleRef>& refs) {
+      auto job = make_shared<Job>();
+      job->refs.swap(refs);
+      lock_guard<mutex> lock(mtx);
+      jobs.push_back(job);
+      pending.push_back(job);
+      work_cv.notify_one();
+    }
+
+    /// remove the oldest batch, which the caller waits on
+    shared_ptr<Job> pop() {
+      if(jobs.empty()) throw logic_error("No batches queued for prefetching");
+      shared_ptr<Job> job = jobs.front();
+      jobs.pop_front();
+      return job;
+    }
+
+    /// join the workers, once batches returned by pop are finished, and prepend
+    /// the refs of every batch not returned by pop to refs
+    void stop(deque<ExampleRef>& refs) {
+      {
+        lock_guard<mutex> lock(mtx);
+        for(auto& j : jobs) {
+          auto p = find(pending.begin(), pending.end(), j);
+          if(p != pending.end()) pending.erase(p);
+        }
+        stopping = true;
+        work_cv.notify_all();
+      }
+      for(auto& w : workers) {
+        w.join();
+      }
+      workers.clear();
+      for(auto j = jobs.rbegin(); j != jobs.rend(); ++j) {
+        vector<ExampleRef>& r = (*j)->refs;
+        refs.insert(refs.begin(), r.begin(), r.end());
+      }
+      jobs.clear();
+    }
+};
+
 ExampleProvider::ExampleProvider(const ExampleProviderSettings& settings) :
-    provider(createProvider(settings)),
+    provider(createProvider(settings)), ref_mutex(make_shared<mutex>()),
         extractor(settings,
             make_shared < FileMappedGninaTyper > (defaultGninaReceptorTyper),
-            make_shared < FileMappedGninaTyper > (defaultGninaLigandTyper)) {
+            make_shared < FileMappedGninaTyper > (defaultGninaLigandTyper)),
+        init_settings(settings) {
+
+}
 
+//background threads can't call typers that need the python interpreter
+void ExampleProvider::check_prefetch_typers() const {
+  if(init_settings.num_prefetch_threads > 0 && !extractor.is_thread_safe())
+    throw invalid_argument("Python callback atom typers can not be used with num_prefetch_threads > 0; set num_prefetch_threads to 0");
 }
 
 /// Create provider/extractor according to settings with single typer
 ExampleProvider::ExampleProvider(const ExampleProviderSettings& settings,
     std::shared_ptr<AtomTyper> t) :
-    provider(createProvider(settings)), extractor(settings, t) {
-
+    provider(createProvider(settings)), ref_mutex(make_shared<mutex>()), extractor(settings, t), init_settings(settings) {
+  check_prefetch_typers();
 }
 
 ExampleProvider::ExampleProvider(const ExampleProviderSettings& settings,
     std::shared_ptr<AtomTyper> t1, std::shared_ptr<AtomTyper> t2) :
-    provider(createProvider(settings)), extractor(settings, t1, t2) {
-
+    provider(createProvider(settings)), ref_mutex(make_shared<mutex>()), extractor(settings, t1, t2), init_settings(settings) {
+  check_prefetch_typers();
 }
 
 ExampleProvider::ExampleProvider(const ExampleProviderSettings& settings,
     const std::vector<std::shared_ptr<AtomTyper> >& typrs, const std::vector<std::string>& molcaches)
 :
-    provider(createProvider(settings)), extractor(settings, typrs, molcaches) {
-
+    provider(createProvider(settings)), ref_mutex(make_shared<mutex>()), extractor(settings, typrs, molcaches),
+    init_settings(settings) {
+  check_prefetch_typers();
 }
 
 /// use provided provider
 ExampleProvider::ExampleProvider(std::shared_ptr<ExampleRefProvider> p,
     const ExampleExtractor& e) :
-    provider(p), extractor(e) {
+    provider(p), ref_mutex(make_shared<mutex>()), extractor(e) {
 
 }
 
+//copies share the provider, so they share the mutex that guards it
+ExampleProvider::ExampleProvider(const ExampleProvider& rhs) :
+    provider(rhs.provider), ref_mutex(rhs.ref_mutex), extractor(rhs.extractor), init_settings(rhs.init_settings) {
+
+}
+
+ExampleProvider& ExampleProvider::operator=(const ExampleProvider& rhs) {
+  if(this != &rhs) {
+    shared_ptr<mutex> m = ref_mutex; //keep the locked mutex alive when replaced
+    lock_guard<mutex> lock(*m);
+    prefetcher.reset();
+    drawn.clear();
+    provider = rhs.provider;
+    ref_mutex = rhs.ref_mutex;
+    extractor = rhs.extractor;
+    init_settings = rhs.init_settings;
+  }
+  return *this;
+}
+
+ExampleProvider::~ExampleProvider() {}
+
+//draw refs that were taken for prefetching before consulting provider
+void ExampleProvider::nextref(ExampleRef& ref) {
+  if(drawn.size()) {
+    ref = drawn.front();
+    drawn.pop_front();
+  } else {
+    provider->nextref(ref);
+  }
+}
+
+void ExampleProvider::stop_prefetching() {
+  if(prefetcher) {
+    prefetcher->stop(drawn);
+    prefetcher.reset();
+  }
+}
+
 ///load example file file fname and setup provider
 void ExampleProvider::populate(const std::string& fname, int num_labels) {
-  ifstream f(fname.c_str());
-  if (!f) throw invalid_argument("Could not open file " + fname);
-  provider->populate(f, num_labels);
+  lock_guard<mutex> lock(*ref_mutex);
+  stop_prefetching();
+  provider->populate(fname, num_labels);
   provider->setup();
 }
 
 ///load multiple example files
 void ExampleProvider::populate(const std::vector<std::string>& fnames, int num_labels) {
-  for (unsigned i = 0, n = fnames.size(); i < n; i++) {
-    ifstream f(fnames[i].c_str());
-    if (!f) throw invalid_argument("Could not open file " + fnames[i]);
-    provider->populate(f, num_labels);
-  }
+  lock_guard<mutex> lock(*ref_mutex);
+  stop_prefetching();
+  provider->populate(fnames, num_labels);
   provider->setup();
 }
 
 ///provide next example
 void ExampleProvider::next(Example& ex) {
-  static thread_local ExampleRef ref;
-  provider->nextref(ref);
+  ExampleRef ref;
+  {
+    lock_guard<mutex> lock(*ref_mutex);
+    stop_prefetching();
+    nextref(ref);
+  }
   extractor.extract(ref, ex);
 }
 
 ///provide a batch of examples
 void ExampleProvider::next_batch(std::vector<Example>& ex, unsigned batch_size) {
-  static vector<ExampleRef> refs;
+  unique_lock<mutex> lock(*ref_mutex);
+  provider->check_batch_size(batch_size); //reads provider state that other callers modify
+
+  if(init_settings.num_prefetch_threads > 0 && batch_size > 0) {
+    if(prefetcher && prefetcher->get_batch_size() != batch_size) {
+      stop_prefetching();
+    }
+    if(!prefetcher) {
+      prefetcher.reset(new ExamplePrefetcher(extractor, init_settings.num_prefetch_threads,
+          batch_size, init_settings.prefetch_batches));
+    }
+    //refs are drawn by the caller, not the workers, so the order is reproducible
+    auto fill = [&]() {
+      vector<ExampleRef> refs;
+      while(!prefetcher->full()) {
+        refs.resize(batch_size);
+        for (unsigned i = 0; i < batch_size; i++) {
+          nextref(refs[i]);
+        }
+        prefetcher->push(refs);
+      }
+    };
+    fill();
+    shared_ptr<ExamplePrefetcher::Job> job = prefetcher->pop();
+    fill(); //keep workers busy while the caller uses this batch
+    lock.unlock(); //other callers can draw while this one waits for a worker
+    job->wait(ex);
+    return;
+  }
+
+  vector<ExampleRef> refs(batch_size);
+  for (unsigned i = 0; i < batch_size; i++) {
+    nextref(refs[i]);
+  }
+  lock.unlock();
   ex.resize(batch_size);
-  refs.resize(batch_size);
-  provider->check_batch_size(batch_size);
   for (unsigned i = 0; i < batch_size; i++) {
-    provider->nextref(refs[i]);
     extractor.extract(refs[i], ex[i]);
   }
 
@@ -87,8 +289,10 @@ void ExampleProvider::next_batch(std::vector<Example>& ex, unsigned batch_size)
 
 void ExampleProvider::skip(unsigned n) {
   ExampleRef ref;
+  lock_guard<mutex> lock(*ref_mutex);
+  stop_prefetching();
   for(unsigned i = 0; i < n; i++) {
-    provider->nextref(ref);
+    nextref(ref);
   }
 }
 
@@ -100,6 +304,13 @@ std::shared_ptr<ExampleRefProvider> ExampleProvider::createProvider(
   bool strat_aff = settings.stratify_max != settings.stratify_min;
   bool grouped = settings.max_group_size > 1;
 
+  if (settings.stream_examples)
+  {
+    if (balanced || strat_receptor || strat_aff || grouped)
+      throw invalid_argument("stream_examples can not be combined with balancing, stratification, or grouping");
+    return make_shared < StreamingExampleRefProvider > (settings);
+  }
+
   //strat_aff > strat_receptor > balanced
   if (strat_aff)
   {
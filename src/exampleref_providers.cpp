@@ -7,6 +7,14 @@
 
 #include "libmolgrid/exampleref_providers.h"
 #include <boost/algorithm/string.hpp>
+#include "libmolgrid/parallel.h"
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <boost/filesystem.hpp>
 
 namespace libmolgrid {
 
@@ -45,41 +53,304 @@ void ReceptorStratifiedExampleRefProvider<BalancedExampleRefProvider, 2>::setup(
 
 }
 
+namespace {
+/// example lines parsed from a chunk of text
+struct ParsedExamples {
+    vector<float> labels;
+    vector<size_t> label_end; //per line
+    vector<int> groups;
+    vector<const char*> files; //interned
+    vector<size_t> file_end; //per line
+
+    size_t size() const { return groups.size(); }
+
+    //parse the lines of [begin,end), which must end with a newline or be terminated
+    void parse(const char *begin, const char *end, int numlabels, bool hasgroup) {
+      ExampleLine line;
+      for(const char *p = begin; p < end;) {
+        const char *eol = (const char*)memchr(p, '\n', end - p);
+        if(!eol) eol = end;
+        const char *b = p, *e = eol;
+        p = eol + 1;
+        while(b != e && isspace(*b)) b++;
+        while(e != b && isspace(e[-1])) e--;
+        if(b == e) continue; //ignore blank lines
+
+        line.parse(b, e, numlabels, hasgroup);
+        labels.insert(labels.end(), line.labels.begin(), line.labels.end());
+        label_end.push_back(labels.size());
+        groups.push_back(line.group);
+        for(const auto& f : line.files) {
+          files.push_back(string_cache.get(f.first, f.second));
+        }
+        file_end.push_back(files.size());
+      }
+    }
+
+    //add the examples to provider in order
+    void add_to(ExampleRefProvider& provider) const {
+      ExampleRef ref;
+      for(size_t i = 0, n = size(); i < n; i++) {
+        size_t lstart = i ? label_end[i - 1] : 0;
+        size_t fstart = i ? file_end[i - 1] : 0;
+        ref.labels.assign(labels.begin() + lstart, labels.begin() + label_end[i]);
+        ref.files.assign(files.begin() + fstart, files.begin() + file_end[i]);
+        ref.group = groups[i];
+        provider.addref(ref);
+      }
+    }
+};
+
+/* Parse the lines of [begin,end) using up to nthreads threads, splitting at
+ * line boundaries into chunks of at least chunksize bytes.  The text must end
+ * with a newline or be terminated.
+ */
+void parse_lines(const char *begin, const char *end, int numlabels, bool hasgroup, unsigned nthreads,
+    size_t chunksize, vector<ParsedExamples>& parsed) {
+  size_t n = end - begin;
+  size_t nchunks = max<size_t>(1, min<size_t>(effective_threads(nthreads), n / max<size_t>(chunksize, 1)));
+  vector<const char*> bounds(nchunks + 1, end);
+  bounds[0] = begin;
+  for(size_t c = 1; c < nchunks; c++) {
+    const char *p = max(begin + n * c / nchunks, bounds[c - 1]);
+    const char *eol = (const char*)memchr(p, '\n', end - p);
+    bounds[c] = eol ? eol + 1 : end;
+  }
+
+  size_t first = parsed.size();
+  parsed.resize(first + nchunks);
+  parallel_for(nchunks, nchunks, [&](size_t b, size_t e, unsigned) {
+    for(size_t c = b; c < e; c++) {
+      parsed[first + c].parse(bounds[c], bounds[c + 1], numlabels, hasgroup);
+    }
+  });
+}
+
+/* Read all of in in blocks of at most blocksize bytes (fewer if the rest of
+ * the stream is known to be smaller), passing the lines of each block, parsed
+ * with up to nthreads threads, to consume.  A line longer than a block grows
+ * the buffer.
+ */
+void parse_stream(std::istream& in, int numlabels, bool hasgroup, unsigned nthreads,
+    size_t chunksize, size_t blocksize, const function<void(vector<ParsedExamples>&)>& consume) {
+  size_t cap = max<size_t>(blocksize, 1);
+  streampos pos = in.tellg();
+  if(pos != streampos(-1)) {
+    in.seekg(0, ios::end);
+    streampos end = in.tellg();
+    in.seekg(pos);
+    if(end != streampos(-1) && end >= pos) cap = min<size_t>(cap, size_t(end - pos) + 1); //+1 so eof is seen on the first read
+  }
+
+  //not zero-initialized, unlike resizing a string
+  unique_ptr<char[]> buf(new char[cap]);
+  size_t len = 0; //bytes in buf, starting with any incomplete line of the last block
+  vector<ParsedExamples> parsed;
+  while(true) {
+    if(len == cap) { //incomplete line fills the buffer
+      unique_ptr<char[]> bigger(new char[2 * cap]);
+      memcpy(bigger.get(), buf.get(), len);
+      buf.swap(bigger);
+      cap *= 2;
+    }
+    in.read(buf.get() + len, cap - len);
+    len += in.gcount();
+    bool done = !in;
+
+    //only parse complete lines unless at end of input
+    size_t stop = len;
+    if(!done) {
+      while(stop > 0 && buf[stop - 1] != '\n') stop--;
+    }
+    if(stop > 0) {
+      parsed.clear();
+      parse_lines(buf.get(), buf.get() + stop, numlabels, hasgroup, nthreads, chunksize, parsed);
+      consume(parsed);
+      memmove(buf.get(), buf.get() + stop, len - stop);
+      len -= stop;
+    }
+    if(done) break;
+  }
+}
+}
+
 int ExampleRefProvider::populate(std::istream& lines, int numlabels) {
   if(!lines) throw invalid_argument("Could not read lines");
 
-  string line;
-  while (getline(lines, line))
-  {
-    trim(line);
-    if(line.length() > 0) { //ignore blank lines
-      ExampleRef ref(line, numlabels, has_group());
-      addref(ref);
+  parse_stream(lines, numlabels, has_group(), num_parse_threads, parse_chunk_size, parse_block_size, [this](vector<ParsedExamples>& parsed) {
+    for(const ParsedExamples& p : parsed) {
+      p.add_to(*this);
     }
+  });
+
+  return size();
+}
+
+int ExampleRefProvider::populate(const std::string& fname, int numlabels) {
+  ifstream f(fname.c_str());
+  if (!f) throw invalid_argument("Could not open file " + fname);
+  return populate(f, numlabels);
+}
+
+int ExampleRefProvider::populate(const std::vector<std::string>& fnames, int numlabels) {
+  if(fnames.size() <= 1 || effective_threads(num_parse_threads) <= 1) {
+    for(const string& fname : fnames) {
+      populate(fname, numlabels);
+    }
+    return size();
   }
 
+  //each thread parses whole files, which are then added in order
+  vector<vector<ParsedExamples> > parsed(fnames.size());
+  bool hasgroup = has_group();
+  parallel_for(num_parse_threads, fnames.size(), [&](size_t b, size_t e, unsigned) {
+    for(size_t i = b; i < e; i++) {
+      ifstream f(fnames[i].c_str());
+      if (!f) throw invalid_argument("Could not open file " + fnames[i]);
+      parse_stream(f, numlabels, hasgroup, 1, parse_chunk_size, parse_block_size, [&](vector<ParsedExamples>& p) {
+        move(p.begin(), p.end(), back_inserter(parsed[i]));
+      });
+    }
+  });
+
+  for(const auto& file : parsed) {
+    for(const ParsedExamples& p : file) {
+      p.add_to(*this);
+    }
+  }
   return size();
 }
 
 void UniformExampleRefProvider::addref(const ExampleRef& ex)
 {
-  all.push_back(ex);
+  size_t n = groups.size();
+  if(n >= UINT32_MAX) throw std::invalid_argument("Too many examples");
+  if(n == 0) {
+    file_stride = ex.files.size();
+    label_stride = ex.labels.size();
+  }
+  if(file_start.size() == 0 && (ex.files.size() != file_stride || ex.labels.size() != label_stride)) {
+    //no longer a fixed stride, record where every example starts
+    file_start.resize(n + 1);
+    label_start.resize(n + 1);
+    for(size_t i = 0; i <= n; i++) {
+      file_start[i] = i * file_stride;
+      label_start[i] = i * label_stride;
+    }
+  }
+
+  files.insert(files.end(), ex.files.begin(), ex.files.end());
+  labels.insert(labels.end(), ex.labels.begin(), ex.labels.end());
+  groups.push_back(ex.group);
+  order.push_back(n);
+  if(file_start.size()) {
+    file_start.push_back(files.size());
+    label_start.push_back(labels.size());
+  }
   nlabels = ex.labels.size();
 }
 
 void UniformExampleRefProvider::setup()
 {
   current = 0;
-  if(randomize) shuffle(all.begin(), all.end(), random_engine);
-  if(all.size() == 0) throw std::invalid_argument("No valid examples found in training set.");
+  if(randomize) shuffle(order.begin(), order.end(), random_engine);
+  if(order.size() == 0) throw std::invalid_argument("No valid examples found in training set.");
 }
 
 void UniformExampleRefProvider::nextref(ExampleRef& ex)
 {
-  assert(current < all.size());
-  ex = all[current];
+  assert(current < order.size());
+  size_t i = order[current];
+  ex.files.assign(files.begin() + files_begin(i), files.begin() + files_begin(i + 1));
+  ex.labels.assign(labels.begin() + labels_begin(i), labels.begin() + labels_begin(i + 1));
+  ex.group = groups[i];
+  ex.seqcont = false;
+  current++;
+  if(current >= order.size())
+  {
+    setup(); //reset current and shuffle if necessary
+  }
+}
+
+void StreamingExampleRefProvider::addref(const ExampleRef& ex)
+{
+  throw std::invalid_argument("Cannot add refs to StreamingExampleRefProvider, populate it from a file");
+}
+
+int StreamingExampleRefProvider::populate(std::istream& lines, int numlabels)
+{
+  throw std::invalid_argument("StreamingExampleRefProvider must be populated from a file");
+}
+
+int StreamingExampleRefProvider::populate(const std::string& fname, int numlabels)
+{
+  if(files.size() >= (1U << FILE_BITS)) throw invalid_argument("Too many example files");
+  if(!boost::filesystem::is_regular_file(fname)) throw invalid_argument("Could not open file " + fname);
+  if(boost::filesystem::file_size(fname) == 0) return size(); //can't map empty file
+
+  boost::iostreams::mapped_file_source map(fname);
+  if(!map.is_open()) throw invalid_argument("Could not memory map " + fname);
+  if(map.size() > OFFSET_MASK) throw invalid_argument(fname + " is too large");
+  uint64_t fileid = uint64_t(files.size()) << (64 - FILE_BITS);
+  size_t firstline = lines.size();
+
+  //record the start of every line that isn't blank
+  const char *data = map.data();
+  for(size_t pos = 0, n = map.size(); pos < n;) {
+    const char *end = (const char*)memchr(data + pos, '\n', n - pos);
+    size_t next = end ? end - data + 1 : n;
+    for(size_t i = pos; i < next; i++) {
+      if(!isspace(data[i])) {
+        lines.push_back(fileid | pos);
+        break;
+      }
+    }
+    pos = next;
+  }
+
+  files.push_back(map);
+  file_numlabels.push_back(numlabels);
+  if(lines.size() > firstline && nlabels == 0) {
+    nlabels = parse(lines[firstline]).labels.size();
+  }
+  return size();
+}
+
+int StreamingExampleRefProvider::populate(const std::vector<std::string>& fnames, int numlabels)
+{
+  for(const string& fname : fnames) {
+    populate(fname, numlabels);
+  }
+  return size();
+}
+
+ExampleRef StreamingExampleRefProvider::parse(uint64_t line) const
+{
+  unsigned fileid = line >> (64 - FILE_BITS);
+  size_t pos = line & OFFSET_MASK;
+  const boost::iostreams::mapped_file_source& map = files[fileid];
+  const char *start = map.data() + pos;
+  const char *end = (const char*)memchr(start, '\n', map.size() - pos);
+  if(!end) end = map.data() + map.size();
+
+  string text(start, end);
+  trim(text);
+  return ExampleRef(text, file_numlabels[fileid], has_group());
+}
+
+void StreamingExampleRefProvider::setup()
+{
+  current = 0;
+  if(randomize) shuffle(lines.begin(), lines.end(), random_engine);
+  if(lines.size() == 0) throw std::invalid_argument("No valid examples found in training set.");
+}
+
+void StreamingExampleRefProvider::nextref(ExampleRef& ex)
+{
+  assert(current < lines.size());
+  ex = parse(lines[current]);
   current++;
-  if(current >= all.size())
+  if(current >= lines.size())
   {
     setup(); //reset current and shuffle if necessary
   }
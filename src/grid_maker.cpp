@@ -5,9 +5,16 @@
  *      Author: dkoes
  */
 #include "libmolgrid/grid_maker.h"
+#include "libmolgrid/parallel.h"
 #include <cmath>
 #include <vector>
 #include <iomanip>
+#include <type_traits>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LMG_X86_SIMD
+#include <immintrin.h>
+#endif
 
 namespace libmolgrid {
 
@@ -131,22 +138,348 @@ template void GridMaker::forward(const Example& in, Grid<double, 4, true>& out,
     float random_translation, bool random_rotation, const float3& center) const;
 
 
+//everything needed to evaluate the non-binary density of a single atom along a row of grid points
+struct density_row {
+  float dxy2; //squared distance from atom to row in the first two dimensions
+  float az; //atom coordinate along the row
+  float origin; //grid origin along the row
+  float resolution;
+  float ar; //scaled atomic radius
+  float gauss_cutoff; //distance where gaussian becomes quadratic
+  float final_cutoff; //distance where density goes to zero
+  float A, B, C; //quadratic coefficients
+};
+
+typedef void (*density_row_kernel)(const density_row& r, unsigned kbegin, unsigned n, float *vals);
+
+#ifdef LMG_X86_SIMD
+//vectorized exp uses the cephes range reduction and polynomial (relative error ~1e-7)
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500E-4f
+#define EXP_P1 1.3981999507E-3f
+#define EXP_P2 8.3334519073E-3f
+#define EXP_P3 4.1665795894E-2f
+#define EXP_P4 1.6666665459E-1f
+#define EXP_P5 5.0000001201E-1f
+
+static inline __m128 exp_sse2(__m128 x) {
+  x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(88.0f)), _mm_set1_ps(-87.0f));
+  //n = floor(x/ln2 + 0.5)
+  __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(EXP_LOG2E)), _mm_set1_ps(0.5f));
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+  fx = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, fx), _mm_set1_ps(1.0f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C1)));
+  x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C2)));
+  __m128 y = _mm_set1_ps(EXP_P0);
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P1));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P2));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P3));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P4));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P5));
+  y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), x), _mm_set1_ps(1.0f));
+  //multiply by 2^n
+  __m128i n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(y, _mm_castsi128_ps(n));
+}
+
+static void density_row_sse2(const density_row& r, unsigned kbegin, unsigned n, float *vals) {
+  const __m128 lane = _mm_set_ps(3, 2, 1, 0);
+  const __m128 res = _mm_set1_ps(r.resolution);
+  const __m128 origin = _mm_set1_ps(r.origin);
+  const __m128 az = _mm_set1_ps(r.az);
+  const __m128 dxy2 = _mm_set1_ps(r.dxy2);
+  const __m128 exscale = _mm_set1_ps(-2.0f / (r.ar * r.ar));
+  const __m128 ar = _mm_set1_ps(r.ar);
+  const __m128 gcut = _mm_set1_ps(r.gauss_cutoff);
+  const __m128 fcut = _mm_set1_ps(r.final_cutoff);
+  const __m128 A = _mm_set1_ps(r.A), B = _mm_set1_ps(r.B), C = _mm_set1_ps(r.C);
+
+  for (unsigned k = 0; k < n; k += 4) {
+    __m128 kf = _mm_add_ps(_mm_cvtepi32_ps(_mm_set1_epi32(kbegin + k)), lane);
+    __m128 dz = _mm_sub_ps(_mm_add_ps(origin, _mm_mul_ps(kf, res)), az);
+    __m128 d2 = _mm_add_ps(dxy2, _mm_mul_ps(dz, dz));
+    __m128 dist = _mm_sqrt_ps(d2);
+    __m128 g = exp_sse2(_mm_mul_ps(d2, exscale));
+    __m128 dr = _mm_div_ps(dist, ar);
+    __m128 q = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(A, dr), B), dr), C);
+    q = _mm_max_ps(q, _mm_setzero_ps());
+    __m128 isgauss = _mm_cmple_ps(dist, gcut);
+    __m128 v = _mm_or_ps(_mm_and_ps(isgauss, g), _mm_andnot_ps(isgauss, q));
+    v = _mm_and_ps(_mm_cmplt_ps(dist, fcut), v);
+    if (k + 4 <= n) {
+      _mm_storeu_ps(vals + k, v);
+    } else {
+      float tmp[4];
+      _mm_storeu_ps(tmp, v);
+      std::copy(tmp, tmp + (n - k), vals + k);
+    }
+  }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_avx2(__m256 x) {
+  x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(88.0f)), _mm256_set1_ps(-87.0f));
+  __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E), _mm256_set1_ps(0.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C1), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C2), x);
+  __m256 y = _mm256_set1_ps(EXP_P0);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P1));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+  y = _mm256_add_ps(_mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x), _mm256_set1_ps(1.0f));
+  __m256i n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+__attribute__((target("avx2,fma")))
+static void density_row_avx2(const density_row& r, unsigned kbegin, unsigned n, float *vals) {
+  const __m256 lane = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256 res = _mm256_set1_ps(r.resolution);
+  const __m256 origin = _mm256_set1_ps(r.origin);
+  const __m256 az = _mm256_set1_ps(r.az);
+  const __m256 dxy2 = _mm256_set1_ps(r.dxy2);
+  const __m256 exscale = _mm256_set1_ps(-2.0f / (r.ar * r.ar));
+  const __m256 ar = _mm256_set1_ps(r.ar);
+  const __m256 gcut = _mm256_set1_ps(r.gauss_cutoff);
+  const __m256 fcut = _mm256_set1_ps(r.final_cutoff);
+  const __m256 A = _mm256_set1_ps(r.A), B = _mm256_set1_ps(r.B), C = _mm256_set1_ps(r.C);
+
+  for (unsigned k = 0; k < n; k += 8) {
+    __m256 kf = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_set1_epi32(kbegin + k)), lane);
+    __m256 dz = _mm256_sub_ps(_mm256_add_ps(origin, _mm256_mul_ps(kf, res)), az);
+    __m256 d2 = _mm256_add_ps(dxy2, _mm256_mul_ps(dz, dz));
+    __m256 dist = _mm256_sqrt_ps(d2);
+    __m256 g = exp_avx2(_mm256_mul_ps(d2, exscale));
+    __m256 dr = _mm256_div_ps(dist, ar);
+    __m256 q = _mm256_fmadd_ps(_mm256_fmadd_ps(A, dr, B), dr, C);
+    q = _mm256_max_ps(q, _mm256_setzero_ps());
+    __m256 v = _mm256_blendv_ps(q, g, _mm256_cmp_ps(dist, gcut, _CMP_LE_OQ));
+    v = _mm256_and_ps(_mm256_cmp_ps(dist, fcut, _CMP_LT_OQ), v);
+    if (k + 8 <= n) {
+      _mm256_storeu_ps(vals + k, v);
+    } else {
+      float tmp[8];
+      _mm256_storeu_ps(tmp, v);
+      std::copy(tmp, tmp + (n - k), vals + k);
+    }
+  }
+}
+
+//some gcc versions warn about the deliberately undefined pass-through operand of avx512 intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static inline __m512 exp_avx512(__m512 x) {
+  x = _mm512_max_ps(_mm512_min_ps(x, _mm512_set1_ps(88.0f)), _mm512_set1_ps(-87.0f));
+  __m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(EXP_LOG2E), _mm512_set1_ps(0.5f));
+  fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C1), x);
+  x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C2), x);
+  __m512 y = _mm512_set1_ps(EXP_P0);
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P1));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P2));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P3));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P4));
+  y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P5));
+  y = _mm512_add_ps(_mm512_fmadd_ps(y, _mm512_mul_ps(x, x), x), _mm512_set1_ps(1.0f));
+  __m512i n = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+  return _mm512_mul_ps(y, _mm512_castsi512_ps(n));
+}
+
+__attribute__((target("avx512f")))
+static void density_row_avx512(const density_row& r, unsigned kbegin, unsigned n, float *vals) {
+  const __m512 lane = _mm512_set_ps(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m512 res = _mm512_set1_ps(r.resolution);
+  const __m512 origin = _mm512_set1_ps(r.origin);
+  const __m512 az = _mm512_set1_ps(r.az);
+  const __m512 dxy2 = _mm512_set1_ps(r.dxy2);
+  const __m512 exscale = _mm512_set1_ps(-2.0f / (r.ar * r.ar));
+  const __m512 ar = _mm512_set1_ps(r.ar);
+  const __m512 gcut = _mm512_set1_ps(r.gauss_cutoff);
+  const __m512 fcut = _mm512_set1_ps(r.final_cutoff);
+  const __m512 A = _mm512_set1_ps(r.A), B = _mm512_set1_ps(r.B), C = _mm512_set1_ps(r.C);
+
+  for (unsigned k = 0; k < n; k += 16) {
+    __m512 kf = _mm512_add_ps(_mm512_cvtepi32_ps(_mm512_set1_epi32(kbegin + k)), lane);
+    __m512 dz = _mm512_sub_ps(_mm512_add_ps(origin, _mm512_mul_ps(kf, res)), az);
+    __m512 d2 = _mm512_add_ps(dxy2, _mm512_mul_ps(dz, dz));
+    __m512 dist = _mm512_sqrt_ps(d2);
+    __m512 g = exp_avx512(_mm512_mul_ps(d2, exscale));
+    __m512 dr = _mm512_div_ps(dist, ar);
+    __m512 q = _mm512_fmadd_ps(_mm512_fmadd_ps(A, dr, B), dr, C);
+    q = _mm512_max_ps(q, _mm512_setzero_ps());
+    __m512 v = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(dist, gcut, _CMP_LE_OQ), q, g);
+    v = _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(dist, fcut, _CMP_LT_OQ), v);
+    __mmask16 store = n - k >= 16 ? 0xFFFF : (1U << (n - k)) - 1;
+    _mm512_mask_storeu_ps(vals + k, store, v);
+  }
+}
+#pragma GCC diagnostic pop
+#else
+//portable implementation, matches calc_point<false>
+static void density_row_scalar(const density_row& r, unsigned kbegin, unsigned n, float *vals) {
+  for (unsigned k = 0; k < n; k++) {
+    float dz = r.origin + (kbegin + k) * r.resolution - r.az;
+    float dist = sqrtf(r.dxy2 + dz * dz);
+    float val = 0;
+    if (dist < r.final_cutoff) {
+      if (dist <= r.gauss_cutoff) {
+        float ex = -2.0 * dist * dist / (r.ar * r.ar);
+        val = exp(ex);
+      } else {
+        float dr = dist / r.ar;
+        float q = (r.A * dr + r.B) * dr + r.C;
+        val = q > 0 ? q : 0; //avoid very small negative numbers
+      }
+    }
+    vals[k] = val;
+  }
+}
+#endif
+
+//pick the widest kernel supported by this processor
+static density_row_kernel select_density_row_kernel() {
+#ifdef LMG_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return density_row_avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return density_row_avx2;
+  return density_row_sse2;
+#else
+  return density_row_scalar;
+#endif
+}
+
+void GridMaker::calc_row_cpu(float az, float ar, float dxy2, float origin, unsigned kbegin, unsigned n, float *vals) const {
+  static const density_row_kernel kernel = select_density_row_kernel();
+  density_row r;
+  r.dxy2 = dxy2;
+  r.az = az;
+  r.origin = origin;
+  r.resolution = resolution;
+  r.ar = ar * radius_scale;
+  r.gauss_cutoff = r.ar * gaussian_radius_multiple;
+  r.final_cutoff = r.ar * final_radius_multiple;
+  r.A = A;
+  r.B = B;
+  r.C = C;
+  kernel(r, kbegin, n, vals);
+}
+
 template<typename Dtype>
-void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
-    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
-    Grid<Dtype, 4, false>& out) const {
-  //zero grid first
-  std::fill(out.data(), out.data() + out.size(), 0.0);
-  check_index_args(coords, type_index, radii, out);
+void GridMaker::forward_batch(const std::vector<Example>& in, Grid<Dtype, 5, false>& out,
+    float random_translation, bool random_rotation, std::false_type) const {
+  //random transformations are drawn in example order so results match gridding one at a time
+  std::vector<Transform> transforms;
+  transforms.reserve(in.size());
+  for(const Example& ex : in) {
+    transforms.push_back(Transform(ex.sets.back().center(), random_translation, random_rotation));
+  }
 
-  float3 grid_origin = get_grid_origin(grid_center);
-  size_t natoms = coords.dimension(0);
+  //parallelize across examples, so each example is gridded by a single thread
+  GridMaker serial(*this);
+  serial.set_num_threads(1);
+  parallel_for(num_threads, in.size(), [&](size_t begin, size_t end, unsigned) {
+    CoordinateSet c; //reused across this thread's examples to avoid reallocation
+    for(size_t i = begin; i < end; i++) {
+      in[i].merge_coordinates(c);
+      if(c.max_type != out.dimension(1)) throw std::out_of_range("Incorrect number of channels in output grid: "+itoa(c.max_type) +" vs "+itoa(out.dimension(1)));
+      transforms[i].forward(c, c);
+      Grid<Dtype, 4, false> g(out[i]);
+      serial.forward(transforms[i].get_rotation_center(), c, g);
+    }
+  });
+}
+
+//convert n fp32 values to half precision, rounding to nearest even
+static void store_reduced_scalar(const float *src, size_t n, __half *dst) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = __float2half_rn(src[i]);
+  }
+}
+
+#ifdef LMG_X86_SIMD
+__attribute__((target("avx,f16c")))
+static void store_reduced_f16c(const float *src, size_t n, __half *dst) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+  store_reduced_scalar(src + i, n - i, dst + i);
+}
+#endif
+
+static void store_reduced(const float *src, size_t n, __half *dst) {
+#ifdef LMG_X86_SIMD
+  static const bool f16c = (__builtin_cpu_init(), __builtin_cpu_supports("f16c"));
+  if (f16c) {
+    store_reduced_f16c(src, n, dst);
+    return;
+  }
+#endif
+  store_reduced_scalar(src, n, dst);
+}
+
+#ifdef LIBMOLGRID_BFLOAT16
+static void store_reduced(const float *src, size_t n, __nv_bfloat16 *dst) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = __float2bfloat16_rn(src[i]);
+  }
+}
+#endif
+
+//full precision output is accumulated in place, calling set_atoms(imin, imax, grid)
+template<typename Dtype, typename Func>
+static void grid_slab(Grid<Dtype, 4, false>& out, size_t imin, size_t imax, Func set_atoms, std::true_type) {
+  set_atoms(imin, imax, out);
+}
+
+//reduced precision output is accumulated in fp32 a few planes at a time and each
+//grid point rounded once, so the scratch buffer is small and freed on return
+template<typename Dtype, typename Func>
+static void grid_slab(Grid<Dtype, 4, false>& out, size_t imin, size_t imax, Func set_atoms, std::false_type) {
+  const size_t planes = 4; //planes of every channel accumulated at a time
+  size_t ntypes = out.dimension(0);
+  size_t plane = out.dimension(2) * out.dimension(3);
+  std::vector<float> buffer(ntypes * std::min(planes, imax - imin) * plane);
+  for (size_t i = imin; i < imax; i += planes) {
+    size_t n = std::min(planes, imax - i);
+    Grid<float, 4, false> acc(buffer.data(), ntypes, n, out.dimension(2), out.dimension(3));
+    set_atoms(i, i + n, acc);
+    for (size_t t = 0; t < ntypes; t++) {
+      store_reduced(acc.data() + t * n * plane, n * plane, out.data() + (t * out.dimension(1) + i) * plane);
+    }
+  }
+}
+
+template<typename Dtype>
+void GridMaker::set_atoms_cpu(size_t imin, size_t imax, const float3& grid_origin,
+    const unsigned *atoms, size_t natoms,
+    const Grid<float, 2, false>& coords, const Grid<float, 1, false>& type_index,
+    const Grid<float, 1, false>& radii, Grid<Dtype, 4, false>& out) const {
   size_t ntypes = out.dimension(0);
+  size_t plane = dim * dim; //grid points with the same first spatial index
+  //out is the whole grid, or only holds planes [imin, imax) of every channel
+  size_t height = out.dimension(1);
+  size_t first = height == dim ? 0 : imin;
+
+  //zero slab first
+  for (size_t t = 0; t < ntypes; t++) {
+    Dtype *start = out.data() + (t * height + imin - first) * plane;
+    std::fill(start, start + (imax - imin) * plane, 0.0);
+  }
+
+  std::vector<float> vals(dim); //densities of a row of grid points
   //iterate over all atoms
-  for (size_t aidx = 0; aidx < natoms; ++aidx) {
+  for (size_t a = 0; a < natoms; ++a) {
+    size_t aidx = atoms ? atoms[a] : a;
     float atype = type_index(aidx);
-    if(atype >= ntypes) throw std::out_of_range("Type index "+itoa(atype)+" larger than allowed "+itoa(ntypes));
     if (atype >= 0 && atype < ntypes) {
+      size_t tidx = atype;
       float3 acoords;
       acoords.x = coords(aidx, 0);
       acoords.y = coords(aidx, 1);
@@ -156,30 +489,37 @@ void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
 
       uint2 bounds[3];
       bounds[0] = get_bounds_1d(grid_origin.x, acoords.x, densityrad);
+      bounds[0].x = std::max<size_t>(bounds[0].x, imin);
+      bounds[0].y = std::min<size_t>(bounds[0].y, imax);
+      if (bounds[0].x >= bounds[0].y) continue; //not in this slab
       bounds[1] = get_bounds_1d(grid_origin.y, acoords.y, densityrad);
       bounds[2] = get_bounds_1d(grid_origin.z, acoords.z, densityrad);
+      if (bounds[2].x >= bounds[2].y) continue; //outside grid
+      size_t nk = bounds[2].y - bounds[2].x;
 
       //for every grid point possibly overlapped by this atom
       for (size_t i = bounds[0].x, iend = bounds[0].y; i < iend; i++) {
         for (size_t j = bounds[1].x, jend = bounds[1].y; j < jend; j++) {
-          for (size_t k = bounds[2].x, kend = bounds[2].y; k < kend; k++) {
-            float3 grid_coords;
-            grid_coords.x = grid_origin.x + i * resolution;
-            grid_coords.y = grid_origin.y + j * resolution;
-            grid_coords.z = grid_origin.z + k * resolution;
-
-            size_t offset = ((((atype * dim) + i) * dim) + j) * dim + k;
-            if (binary) {
+          Dtype *row = out.data() + ((((tidx * height) + i - first) * dim) + j) * dim;
+          if (binary) {
+            for (size_t k = bounds[2].x, kend = bounds[2].y; k < kend; k++) {
+              float3 grid_coords;
+              grid_coords.x = grid_origin.x + i * resolution;
+              grid_coords.y = grid_origin.y + j * resolution;
+              grid_coords.z = grid_origin.z + k * resolution;
               float val = calc_point<true>(acoords.x, acoords.y, acoords.z, radius, grid_coords);
 
               if (val != 0)
-                *(out.data() + offset) = 1.0;
+                row[k] = 1.0;
             }
-            else {
-              float val = calc_point<false>(acoords.x, acoords.y, acoords.z, radius, grid_coords);
-              *(out.data() + offset) += val;
+          }
+          else {
+            float dx = grid_origin.x + i * resolution - acoords.x;
+            float dy = grid_origin.y + j * resolution - acoords.y;
+            calc_row_cpu(acoords.z, radius, dx * dx + dy * dy, grid_origin.z, bounds[2].x, nk, vals.data());
+            for (size_t k = 0; k < nk; k++) {
+              row[bounds[2].x + k] += vals[k];
             }
-
           }
         }
       }
@@ -188,60 +528,248 @@ void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
 }
 
 template<typename Dtype>
-void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
-    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
-    Grid<Dtype, 4, false>& out) const {
-  //zero grid first
-  std::fill(out.data(), out.data() + out.size(), 0.0);
-  check_vector_args(coords, type_vector, radii, out);
-
-  float3 grid_origin = get_grid_origin(grid_center);
-  size_t natoms = coords.dimension(0);
+void GridMaker::set_atoms_cpu(size_t imin, size_t imax, const float3& grid_origin,
+    const unsigned *atoms, size_t natoms,
+    const Grid<float, 2, false>& coords, const Grid<float, 2, false>& type_vector,
+    const Grid<float, 1, false>& radii, Grid<Dtype, 4, false>& out) const {
   size_t ntypes = type_vector.dimension(1);
+  size_t plane = dim * dim; //grid points with the same first spatial index
+  //out is the whole grid, or only holds planes [imin, imax) of every channel
+  size_t height = out.dimension(1);
+  size_t first = height == dim ? 0 : imin;
+
+  //zero slab first
+  for (size_t t = 0; t < ntypes; t++) {
+    Dtype *start = out.data() + (t * height + imin - first) * plane;
+    std::fill(start, start + (imax - imin) * plane, 0.0);
+  }
+
+  std::vector<float> vals(dim); //densities of a row of grid points
+  std::vector<size_t> channels; //types with nonzero amounts for current atom
+  channels.reserve(ntypes);
   //iterate over all atoms
-  for (size_t aidx = 0; aidx < natoms; ++aidx) {
+  for (size_t a = 0; a < natoms; ++a) {
+    size_t aidx = atoms ? atoms[a] : a;
+    channels.clear();
     for (size_t tidx = 0; tidx < ntypes; tidx++) {
-      Dtype tmult = type_vector(aidx, tidx); //amount of type for this atom
-      if (tmult != 0) {
-        float3 acoords;
-        acoords.x = coords(aidx, 0);
-        acoords.y = coords(aidx, 1);
-        acoords.z = coords(aidx, 2);
-        float radius = radii(aidx);
-        float densityrad = radius * radius_scale * final_radius_multiple;
-
-        uint2 bounds[3];
-        bounds[0] = get_bounds_1d(grid_origin.x, acoords.x, densityrad);
-        bounds[1] = get_bounds_1d(grid_origin.y, acoords.y, densityrad);
-        bounds[2] = get_bounds_1d(grid_origin.z, acoords.z, densityrad);
-
-        //for every grid point possibly overlapped by this atom
-        for (size_t i = bounds[0].x, iend = bounds[0].y; i < iend; i++) {
-          for (size_t j = bounds[1].x, jend = bounds[1].y; j < jend; j++) {
-            for (size_t k = bounds[2].x, kend = bounds[2].y; k < kend; k++) {
-              float3 grid_coords;
-              grid_coords.x = grid_origin.x + i * resolution;
-              grid_coords.y = grid_origin.y + j * resolution;
-              grid_coords.z = grid_origin.z + k * resolution;
-
-              size_t offset = ((((tidx * dim) + i) * dim) + j) * dim + k;
-              if (binary) {
-                float val = calc_point<true>(acoords.x, acoords.y, acoords.z, radius, grid_coords);
+      if (type_vector(aidx, tidx) != 0) channels.push_back(tidx);
+    }
+    if (channels.size() == 0) continue;
+
+    float3 acoords;
+    acoords.x = coords(aidx, 0);
+    acoords.y = coords(aidx, 1);
+    acoords.z = coords(aidx, 2);
+    float radius = radii(aidx);
+    float densityrad = radius * radius_scale * final_radius_multiple;
+
+    uint2 bounds[3];
+    bounds[0] = get_bounds_1d(grid_origin.x, acoords.x, densityrad);
+    bounds[0].x = std::max<size_t>(bounds[0].x, imin);
+    bounds[0].y = std::min<size_t>(bounds[0].y, imax);
+    if (bounds[0].x >= bounds[0].y) continue; //not in this slab
+    bounds[1] = get_bounds_1d(grid_origin.y, acoords.y, densityrad);
+    bounds[2] = get_bounds_1d(grid_origin.z, acoords.z, densityrad);
+    if (bounds[2].x >= bounds[2].y) continue; //outside grid
+    size_t nk = bounds[2].y - bounds[2].x;
+
+    //for every grid point possibly overlapped by this atom
+    for (size_t i = bounds[0].x, iend = bounds[0].y; i < iend; i++) {
+      for (size_t j = bounds[1].x, jend = bounds[1].y; j < jend; j++) {
+        //density is the same for every type, only the multiplier changes
+        if (binary) {
+          for (size_t k = 0; k < nk; k++) {
+            float3 grid_coords;
+            grid_coords.x = grid_origin.x + i * resolution;
+            grid_coords.y = grid_origin.y + j * resolution;
+            grid_coords.z = grid_origin.z + (bounds[2].x + k) * resolution;
+            vals[k] = calc_point<true>(acoords.x, acoords.y, acoords.z, radius, grid_coords);
+          }
+        } else {
+          float dx = grid_origin.x + i * resolution - acoords.x;
+          float dy = grid_origin.y + j * resolution - acoords.y;
+          calc_row_cpu(acoords.z, radius, dx * dx + dy * dy, grid_origin.z, bounds[2].x, nk, vals.data());
+        }
 
-                if (val != 0)
-                  *(out.data() + offset) += tmult; //not quite binary
-              }
-              else {
-                float val = calc_point<false>(acoords.x, acoords.y, acoords.z, radius, grid_coords);
-                *(out.data() + offset) += val*tmult;
-              }
+        for (size_t tidx : channels) {
+          Dtype tmult = type_vector(aidx, tidx); //amount of type for this atom
+          Dtype *row = out.data() + ((((tidx * height) + i - first) * dim) + j) * dim + bounds[2].x;
+          for (size_t k = 0; k < nk; k++) {
+            if (binary) {
+              if (vals[k] != 0)
+                row[k] += tmult; //not quite binary
             }
+            else
+              row[k] += vals[k] * tmult;
           }
         }
-      } //tmult != 0
-    } //tidx
+      }
+    }
   } //aidx
 }
+
+const unsigned* GridMaker::select_atoms_cpu(const float3& grid_origin, const CellList *cells, size_t& natoms,
+    std::vector<unsigned>& buffer) const {
+  if (!cells) return nullptr;
+  if (cells->num_atoms() != natoms)
+    throw std::invalid_argument("Cell list does not match number of atoms: "+itoa(cells->num_atoms())+" vs "+itoa(natoms));
+  float pad = cells->get_max_radius() * radius_scale * final_radius_multiple;
+  float extent = (dim - 1) * resolution;
+  float3 lo = make_float3(grid_origin.x - pad, grid_origin.y - pad, grid_origin.z - pad);
+  float3 hi = make_float3(grid_origin.x + extent + pad, grid_origin.y + extent + pad, grid_origin.z + extent + pad);
+  cells->query(lo, hi, buffer);
+  natoms = buffer.size();
+  return buffer.data();
+}
+
+template<typename Dtype>
+void GridMaker::forward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    const CellList *cells, Grid<Dtype, 4, false>& out) const {
+  check_index_args(coords, type_index, radii, out);
+
+  float3 grid_origin = get_grid_origin(grid_center);
+  std::vector<unsigned> selected;
+  size_t natoms = coords.dimension(0);
+  const unsigned *atoms = select_atoms_cpu(grid_origin, cells, natoms, selected);
+
+  //validate every atom, not just those near the grid, so a cell list doesn't hide bad types
+  size_t ntypes = out.dimension(0);
+  for (size_t a = 0, n = coords.dimension(0); a < n; ++a) {
+    float atype = type_index(a);
+    if(atype >= ntypes) throw std::out_of_range("Type index "+itoa(atype)+" larger than allowed "+itoa(ntypes));
+  }
+
+  //reduced precision output is accumulated in fp32 and rounded once per grid point
+  typename std::is_floating_point<Dtype>::type inplace;
+
+  //each thread owns a slab of every channel and visits the atoms in the same
+  //order, so every grid point is accumulated identically regardless of thread count
+  parallel_for(num_threads, dim, [&](size_t ibegin, size_t iend, unsigned) {
+    grid_slab(out, ibegin, iend, [&](size_t imin, size_t imax, auto& acc) {
+      set_atoms_cpu(imin, imax, grid_origin, atoms, natoms, coords, type_index, radii, acc);
+    }, inplace);
+  });
+}
+
+template<typename Dtype>
+void GridMaker::forward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    const CellList *cells, Grid<Dtype, 4, false>& out) const {
+  check_vector_args(coords, type_vector, radii, out);
+
+  float3 grid_origin = get_grid_origin(grid_center);
+  std::vector<unsigned> selected;
+  size_t natoms = coords.dimension(0);
+  const unsigned *atoms = select_atoms_cpu(grid_origin, cells, natoms, selected);
+
+  typename std::is_floating_point<Dtype>::type inplace;
+
+  parallel_for(num_threads, dim, [&](size_t ibegin, size_t iend, unsigned) {
+    grid_slab(out, ibegin, iend, [&](size_t imin, size_t imax, auto& acc) {
+      set_atoms_cpu(imin, imax, grid_origin, atoms, natoms, coords, type_vector, radii, acc);
+    }, inplace);
+  });
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    Grid<Dtype, 4, false>& out) const {
+  forward_cpu(grid_center, coords, type_index, radii, nullptr, out);
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    const CellList& cells, Grid<Dtype, 4, false>& out) const {
+  forward_cpu(grid_center, coords, type_index, radii, &cells, out);
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    Grid<Dtype, 4, false>& out) const {
+  forward_cpu(grid_center, coords, type_vector, radii, nullptr, out);
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    const CellList& cells, Grid<Dtype, 4, false>& out) const {
+  forward_cpu(grid_center, coords, type_vector, radii, &cells, out);
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const CoordinateSet& in, ChannelSparseGrid<Dtype>& out) const {
+  bool indexed = in.has_indexed_types();
+  const Grid<float, 2, false>& coords = in.coords.cpu();
+  const Grid<float, 1, false>& radii = in.radii.cpu();
+  size_t natoms = coords.dimension(0);
+  size_t ntypes = indexed ? in.max_type : in.type_vector.dimension(1);
+  if(radii.size() != natoms)
+    throw std::invalid_argument("Radii dimension ("+itoa(radii.size())+") does not equal number of atoms ("+itoa(natoms)+")");
+  if(indexed && in.type_index.size() != natoms)
+    throw std::invalid_argument("Type dimension ("+itoa(in.type_index.size())+") does not equal number of atoms ("+itoa(natoms)+")");
+  if(!indexed && in.type_vector.dimension(0) != natoms)
+    throw std::invalid_argument("Type dimension ("+itoa(in.type_vector.dimension(0))+") does not equal number of atoms ("+itoa(natoms)+")");
+
+  //find the types that have an atom whose density reaches the grid
+  float3 grid_origin = get_grid_origin(grid_center);
+  std::vector<char> occupied(ntypes, 0);
+  for (size_t a = 0; a < natoms; ++a) {
+    float densityrad = radii(a) * radius_scale * final_radius_multiple;
+    uint2 bx = get_bounds_1d(grid_origin.x, coords(a, 0), densityrad);
+    uint2 by = get_bounds_1d(grid_origin.y, coords(a, 1), densityrad);
+    uint2 bz = get_bounds_1d(grid_origin.z, coords(a, 2), densityrad);
+    if(bx.x >= bx.y || by.x >= by.y || bz.x >= bz.y) continue;
+    if(indexed) {
+      float atype = in.type_index.cpu()(a);
+      if(atype < 0) continue;
+      if(atype >= ntypes) throw std::out_of_range("Type index "+itoa(atype)+" larger than allowed "+itoa(ntypes));
+      occupied[(unsigned)atype] = 1;
+    } else {
+      for (size_t t = 0; t < ntypes; t++) {
+        if(in.type_vector.cpu()(a, t) != 0) occupied[t] = 1;
+      }
+    }
+  }
+
+  out.nchannels = ntypes;
+  out.channels.clear();
+  std::vector<int> remap(ntypes, -1);
+  for (size_t t = 0; t < ntypes; t++) {
+    if(occupied[t]) {
+      remap[t] = out.channels.size();
+      out.channels.push_back(t);
+    }
+  }
+  size_t nstored = out.channels.size();
+  out.values = out.values.resized(nstored, dim, dim, dim);
+  out.reserved = std::max(out.reserved, out.values.size());
+  if(nstored == 0) return;
+
+  //grid the atoms with types renumbered to the stored channels
+  Grid<Dtype, 4, false>& values = out.values.cpu();
+  if(indexed) {
+    std::vector<float> types(natoms);
+    const Grid<float, 1, false>& ti = in.type_index.cpu();
+    for (size_t a = 0; a < natoms; a++) {
+      float atype = ti(a);
+      types[a] = (atype >= 0 && atype < ntypes) ? remap[(unsigned)atype] : -1;
+    }
+    forward_cpu(grid_center, coords, Grid<float, 1, false>(types.data(), natoms), radii, nullptr, values);
+  } else {
+    std::vector<float> types(natoms * nstored);
+    const Grid<float, 2, false>& tv = in.type_vector.cpu();
+    for (size_t a = 0; a < natoms; a++) {
+      for (size_t c = 0; c < nstored; c++) {
+        types[a * nstored + c] = tv(a, out.channels[c]);
+      }
+    }
+    forward_cpu(grid_center, coords, Grid<float, 2, false>(types.data(), natoms, nstored), radii, nullptr, values);
+  }
+}
         
         
 template void GridMaker::forward(const std::vector<Example>& in, Grid<float, 5, false>& out,
@@ -252,6 +780,10 @@ template void GridMaker::forward(const std::vector<Example>& in, Grid<double, 5,
   float random_translation, bool random_rotation) const;
 template void GridMaker::forward(const std::vector<Example>& in, Grid<double, 5, true>& out,
     float random_translation, bool random_rotation) const;
+template void GridMaker::forward_batch(const std::vector<Example>& in, Grid<float, 5, false>& out,
+    float random_translation, bool random_rotation, std::false_type) const;
+template void GridMaker::forward_batch(const std::vector<Example>& in, Grid<double, 5, false>& out,
+    float random_translation, bool random_rotation, std::false_type) const;
 
 template void GridMaker::forward(float3 grid_center,
     const Grid<float, 2, false>& coords,
@@ -270,6 +802,60 @@ template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>
 template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
         const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
         Grid<double, 4, false>& out) const;
+
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    const CellList& cells, Grid<float, 4, false>& out) const;
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    const CellList& cells, Grid<double, 4, false>& out) const;
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    const CellList& cells, Grid<float, 4, false>& out) const;
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    const CellList& cells, Grid<double, 4, false>& out) const;
+
+template void GridMaker::forward(float3 grid_center, const CoordinateSet& in, ChannelSparseGrid<float>& out) const;
+template void GridMaker::forward(float3 grid_center, const CoordinateSet& in, ChannelSparseGrid<double>& out) const;
+
+//reduced precision output, accumulated in fp32
+#define INSTANTIATE_REDUCED_FORWARD(T) \
+template void GridMaker::check_index_args(const Grid<float, 2, false>& coords, \
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, Grid<T, 4, false>& out) const; \
+template void GridMaker::check_index_args(const Grid<float, 2, true>& coords, \
+    const Grid<float, 1, true>& type_index, const Grid<float, 1, true>& radii, Grid<T, 4, true>& out) const; \
+template void GridMaker::check_vector_args(const Grid<float, 2, false>& coords, \
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, Grid<T, 4, false>& out) const; \
+template void GridMaker::check_vector_args(const Grid<float, 2, true>& coords, \
+    const Grid<float, 2, true>& type_vector, const Grid<float, 1, true>& radii, Grid<T, 4, true>& out) const; \
+template void GridMaker::forward(const Example& in, const Transform& transform, Grid<T, 4, false>& out) const; \
+template void GridMaker::forward(const Example& in, const Transform& transform, Grid<T, 4, true>& out) const; \
+template void GridMaker::forward(const Example& in, Grid<T, 4, false>& out, \
+    float random_translation, bool random_rotation, const float3& center) const; \
+template void GridMaker::forward(const Example& in, Grid<T, 4, true>& out, \
+    float random_translation, bool random_rotation, const float3& center) const; \
+template void GridMaker::forward(const std::vector<Example>& in, Grid<T, 5, false>& out, \
+    float random_translation, bool random_rotation) const; \
+template void GridMaker::forward(const std::vector<Example>& in, Grid<T, 5, true>& out, \
+    float random_translation, bool random_rotation) const; \
+template void GridMaker::forward_batch(const std::vector<Example>& in, Grid<T, 5, false>& out, \
+    float random_translation, bool random_rotation, std::false_type) const; \
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords, \
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, Grid<T, 4, false>& out) const; \
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords, \
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, Grid<T, 4, false>& out) const; \
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords, \
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, \
+    const CellList& cells, Grid<T, 4, false>& out) const; \
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords, \
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, \
+    const CellList& cells, Grid<T, 4, false>& out) const;
+
+INSTANTIATE_REDUCED_FORWARD(__half)
+#ifdef LIBMOLGRID_BFLOAT16
+INSTANTIATE_REDUCED_FORWARD(__nv_bfloat16)
+#endif
         
 //set a single atom gradient - note can't pass a slice by reference
 template <typename Dtype>
@@ -303,11 +889,20 @@ float3 GridMaker::calc_atom_gradient_cpu(const float3& grid_origin, const Grid1f
   return agrad;
 }
 
-//set return accumulated gradient of type
+//return accumulated gradient of atom and set gradient of every type, visiting
+//each grid point once rather than once per type for each of the two gradients
 template <typename Dtype>
-float GridMaker::calc_type_gradient_cpu(const float3& grid_origin, const Grid1f& coordr, const Grid<Dtype, 3, false>& diff, float radius) const {
+float3 GridMaker::calc_atom_type_gradients_cpu(const float3& grid_origin, const Grid1f& coordr, const float *tmult,
+    const Grid<Dtype, 4, false>& diff, float radius, float *tgrad) const {
 
-  float r = radius * radius_scale * final_radius_multiple;
+  float3 agrad{0,0,0};
+  unsigned ntypes = diff.dimension(0);
+  for(unsigned t = 0; t < ntypes; t++) {
+    tgrad[t] = 0;
+  }
+
+  float ar = radius * radius_scale;
+  float r = ar * final_radius_multiple;
   float3 a{coordr(0),coordr(1),coordr(2)}; //atom coordinate
 
   uint2 ranges[3];
@@ -315,27 +910,53 @@ float GridMaker::calc_type_gradient_cpu(const float3& grid_origin, const Grid1f&
   ranges[1] = get_bounds_1d(grid_origin.y, a.y, r);
   ranges[2] = get_bounds_1d(grid_origin.z, a.z, r);
 
-  float ret = 0;
+  const Dtype *diffdata = diff.data();
+  size_t cstride = (size_t)dim * dim * dim;
   //for every grid point possibly overlapped by this atom
   for (unsigned i = ranges[0].x, iend = ranges[0].y; i < iend; ++i) {
     for (unsigned j = ranges[1].x, jend = ranges[1].y; j < jend; ++j) {
       for (unsigned k = ranges[2].x, kend = ranges[2].y; k < kend; ++k) {
         //convert grid point coordinates to angstroms
-        float x = grid_origin.x + i * resolution;
-        float y = grid_origin.y + j * resolution;
-        float z = grid_origin.z + k * resolution;
-        float val;
-        if(binary)
-          val = calc_point<true>(a.x, a.y, a.z, radius, float3{x,y,z});
-        else
-          val = calc_point<false>(a.x, a.y, a.z, radius, float3{x,y,z});
+        float dist_x = grid_origin.x + i * resolution - a.x;
+        float dist_y = grid_origin.y + j * resolution - a.y;
+        float dist_z = grid_origin.z + k * resolution - a.z;
+        float dist2 = dist_x * dist_x + dist_y * dist_y + dist_z * dist_z;
+        double dist = sqrt(dist2);
+        if (dist >= r) continue; //no overlap
+
+        //density and its derivative, as in calc_point and accumulate_atom_gradient
+        float val, agrad_dist;
+        if (dist <= ar * gaussian_radius_multiple) {
+          float ex = exp(-2.0 * dist2 / (ar * ar));
+          agrad_dist = -4.0 * dist / (ar * ar) * ex;
+          val = ex;
+        } else {
+          agrad_dist = (D*dist/ar + E)/ar;
+          float dr = dist / ar;
+          float q = (A * dr + B) * dr + C;
+          val = q > 0 ? q : 0;
+        }
+        if (binary) val = dist2 < ar * ar ? 1.0 : 0.0;
+
+        //type weighted sum of gradient values for the atom gradient
+        const Dtype *d = diffdata + ((size_t)i * dim + j) * dim + k;
+        float gridval = 0;
+        for (unsigned t = 0; t < ntypes; t++) {
+          float g = d[t * cstride];
+          gridval += tmult[t] * g;
+          tgrad[t] += val * g;
+        }
 
-        ret += val * diff(i,j,k);
+        if (dist > 0) {
+          agrad.x += -(dist_x / dist) * (agrad_dist * gridval);
+          agrad.y += -(dist_y / dist) * (agrad_dist * gridval);
+          agrad.z += -(dist_z / dist) * (agrad_dist * gridval);
+        }
       }
     }
   }
 
-  return ret;
+  return agrad;
 }
 
 template <typename Dtype>
@@ -352,20 +973,26 @@ float GridMaker::calc_atom_relevance_cpu(const float3& grid_origin, const Grid1f
   ranges[2] = get_bounds_1d(grid_origin.z, a.z, r);
 
 
+  //same densities as the forward pass, so val never exceeds denseval
+  std::vector<float> vals(dim);
   //for every grid point possibly overlapped by this atom
   for (unsigned i = ranges[0].x, iend = ranges[0].y; i < iend;
       ++i) {
     for (unsigned j = ranges[1].x, jend = ranges[1].y; j < jend; ++j) {
+      //convert grid point coordinates to angstroms
+      float x = grid_origin.x + i * resolution;
+      float y = grid_origin.y + j * resolution;
+      if(!binary && ranges[2].x < ranges[2].y)
+        calc_row_cpu(a.z, radius, (x - a.x) * (x - a.x) + (y - a.y) * (y - a.y),
+            grid_origin.z, ranges[2].x, ranges[2].y - ranges[2].x, vals.data());
       for (unsigned k = ranges[2].x, kend = ranges[2].y; k < kend; ++k) {
-        //convert grid point coordinates to angstroms
-        float x = grid_origin.x + i * resolution;
-        float y = grid_origin.y + j * resolution;
-        float z = grid_origin.z + k * resolution;
         float val = 0;
-        if(binary)
+        if(binary) {
+          float z = grid_origin.z + k * resolution;
           val = calc_point<true>(a.x, a.y, a.z, radius, float3{x,y,z});
+        }
         else
-          val = calc_point<false>(a.x, a.y, a.z, radius, float3{x,y,z});
+          val = vals[k - ranges[2].x];
 
         if (val > 0) {
           float denseval = density(i,j,k);
@@ -384,8 +1011,8 @@ float GridMaker::calc_atom_relevance_cpu(const float3& grid_origin, const Grid1f
 
 //cpu backwards
 template <typename Dtype>
-void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
-    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+void GridMaker::backward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList *cells,
     const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const {
 
   atom_gradients.fill_zero();
@@ -395,16 +1022,37 @@ void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords
   if(n != radii.size()) throw std::invalid_argument("Radii dimension doesn't equal number of coordinates");
   if(coords.dimension(1) != 3) throw std::invalid_argument("Need x,y,z,r for coord_radius");
   float3 grid_origin = get_grid_origin(grid_center);
-
-  for (unsigned i = 0; i < n; ++i) {
-    int whichgrid = round(type_index[i]); // this is which atom-type channel of the grid to look at
-    if (whichgrid >= 0) {
-      float3 agrad = calc_atom_gradient_cpu(grid_origin, coords[i], diff[whichgrid], radii[i]);
-      atom_gradients(i,0) = agrad.x;
-      atom_gradients(i,1) = agrad.y;
-      atom_gradients(i,2) = agrad.z;
+  std::vector<unsigned> selected;
+  size_t natoms = n;
+  const unsigned *atoms = select_atoms_cpu(grid_origin, cells, natoms, selected);
+
+  //every atom gradient is computed entirely by one thread, so results don't depend on thread count
+  parallel_for(num_threads, natoms, [&](size_t begin, size_t end, unsigned) {
+    for (size_t a = begin; a < end; ++a) {
+      unsigned i = atoms ? atoms[a] : a;
+      int whichgrid = round(type_index[i]); // this is which atom-type channel of the grid to look at
+      if (whichgrid >= 0) {
+        float3 agrad = calc_atom_gradient_cpu(grid_origin, coords[i], diff[whichgrid], radii[i]);
+        atom_gradients(i,0) = agrad.x;
+        atom_gradients(i,1) = agrad.y;
+        atom_gradients(i,2) = agrad.z;
+      }
     }
-  }
+  });
+}
+
+template <typename Dtype>
+void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const {
+  backward_cpu(grid_center, coords, type_index, radii, nullptr, diff, atom_gradients);
+}
+
+template <typename Dtype>
+void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const {
+  backward_cpu(grid_center, coords, type_index, radii, &cells, diff, atom_gradients);
 }
 
 template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coordrs,
@@ -413,11 +1061,17 @@ template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false
 template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coordrs,
     const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
     const Grid<double, 4, false>& diff, Grid<double, 2, false>& atom_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coordrs,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<float, 4, false>& diff, Grid<float, 2, false>& atom_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coordrs,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<double, 4, false>& diff, Grid<double, 2, false>& atom_gradients) const;
 
 //cpu backwards
 template <typename Dtype>
-void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
-    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+void GridMaker::backward_cpu(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const CellList *cells,
     const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const {
 
   atom_gradients.fill_zero();
@@ -433,20 +1087,37 @@ void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords
   if(n != radii.size()) throw std::invalid_argument("Radii dimension doesn't equal number of coordinates");
   if(coords.dimension(1) != 3) throw std::invalid_argument("Need x,y,z,r for coord_radius");
   float3 grid_origin = get_grid_origin(grid_center);
-
-  for (unsigned i = 0; i < n; ++i) {
-    float radius = radii(i);
-    for(unsigned whichgrid = 0; whichgrid < ntypes; whichgrid++) {
-      float tmult = type_vector(i,whichgrid);
-      if(tmult != 0) {
-        float3 agrad = calc_atom_gradient_cpu(grid_origin, coords[i], diff[whichgrid], radius);
-        atom_gradients(i,0) += agrad.x*tmult;
-        atom_gradients(i,1) += agrad.y*tmult;
-        atom_gradients(i,2) += agrad.z*tmult;
+  std::vector<unsigned> selected;
+  size_t natoms = n;
+  const unsigned *atoms = select_atoms_cpu(grid_origin, cells, natoms, selected);
+
+  parallel_for(num_threads, natoms, [&](size_t begin, size_t end, unsigned) {
+    std::vector<float> tgrad(ntypes); //accumulated by this thread only
+    for (size_t a = begin; a < end; ++a) {
+      unsigned i = atoms ? atoms[a] : a;
+      float3 agrad = calc_atom_type_gradients_cpu(grid_origin, coords[i], type_vector[i].data(), diff, radii(i), tgrad.data());
+      atom_gradients(i,0) = agrad.x;
+      atom_gradients(i,1) = agrad.y;
+      atom_gradients(i,2) = agrad.z;
+      for(unsigned whichgrid = 0; whichgrid < ntypes; whichgrid++) {
+        type_gradients(i,whichgrid) = tgrad[whichgrid];
       }
-      type_gradients(i,whichgrid) = calc_type_gradient_cpu(grid_origin, coords[i], diff[whichgrid], radius);
     }
-  }
+  });
+}
+
+template <typename Dtype>
+void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const {
+  backward_cpu(grid_center, coords, type_vector, radii, nullptr, diff, atom_gradients, type_gradients);
+}
+
+template <typename Dtype>
+void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const {
+  backward_cpu(grid_center, coords, type_vector, radii, &cells, diff, atom_gradients, type_gradients);
 }
 
 template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
@@ -455,11 +1126,17 @@ template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false
 template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
     const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
     const Grid<double, 4, false>& diff, Grid<double, 2, false>& atom_gradients, Grid<double, 2, false>& type_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<float, 4, false>& diff, Grid<float, 2, false>& atom_gradients, Grid<float, 2, false>& type_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<double, 4, false>& diff, Grid<double, 2, false>& atom_gradients, Grid<double, 2, false>& type_gradients) const;
 
 
 template <typename Dtype>
-void GridMaker::backward_relevance(float3 grid_center,  const Grid<float, 2, false>& coords,
-    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+void GridMaker::backward_relevance_cpu(float3 grid_center,  const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList *cells,
     const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
     Grid<Dtype, 1, false>& relevance) const {
 
@@ -470,13 +1147,35 @@ void GridMaker::backward_relevance(float3 grid_center,  const Grid<float, 2, fal
   if(n != radii.size()) throw std::invalid_argument("Radii dimension doesn't equal number of coordinates");
 
   float3 grid_origin = get_grid_origin(grid_center);
-
-  for (unsigned i = 0; i < n; ++i) {
-    int whichgrid = round(type_index[i]); // this is which atom-type channel of the grid to look at
-    if (whichgrid >= 0) {
-      relevance(i) = calc_atom_relevance_cpu(grid_origin, coords[i], density[whichgrid], diff[whichgrid], radii[i]);
+  std::vector<unsigned> selected;
+  size_t natoms = n;
+  const unsigned *atoms = select_atoms_cpu(grid_origin, cells, natoms, selected);
+
+  parallel_for(num_threads, natoms, [&](size_t begin, size_t end, unsigned) {
+    for (size_t a = begin; a < end; ++a) {
+      unsigned i = atoms ? atoms[a] : a;
+      int whichgrid = round(type_index[i]); // this is which atom-type channel of the grid to look at
+      if (whichgrid >= 0) {
+        relevance(i) = calc_atom_relevance_cpu(grid_origin, coords[i], density[whichgrid], diff[whichgrid], radii[i]);
+      }
     }
-  }
+  });
+}
+
+template <typename Dtype>
+void GridMaker::backward_relevance(float3 grid_center,  const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+    Grid<Dtype, 1, false>& relevance) const {
+  backward_relevance_cpu(grid_center, coords, type_index, radii, nullptr, density, diff, relevance);
+}
+
+template <typename Dtype>
+void GridMaker::backward_relevance(float3 grid_center,  const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const CellList& cells,
+    const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+    Grid<Dtype, 1, false>& relevance) const {
+  backward_relevance_cpu(grid_center, coords, type_index, radii, &cells, density, diff, relevance);
 }
 
 template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>&,
@@ -485,4 +1184,396 @@ template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>
 template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>&,
     const Grid<float, 1, false>&, const Grid<float, 1, false>&, const Grid<double, 4, false>&,
     const Grid<double, 4, false>& , Grid<double, 1, false>& ) const;
+template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>&,
+    const Grid<float, 1, false>&, const Grid<float, 1, false>&, const CellList&, const Grid<float, 4, false>&,
+    const Grid<float, 4, false>&, Grid<float, 1, false>&) const;
+template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>&,
+    const Grid<float, 1, false>&, const Grid<float, 1, false>&, const CellList&, const Grid<double, 4, false>&,
+    const Grid<double, 4, false>& , Grid<double, 1, false>& ) const;
+bool GridMaker::record_footprints_cpu(const float3& grid_origin, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& radii, const std::vector<unsigned>& atoms, AtomFootprints& fp) const {
+  fp.footprints.clear();
+  fp.grid_origin = grid_origin;
+  fp.dim = dim;
+  fp.resolution = resolution;
+  fp.radius_scale = radius_scale;
+  fp.gaussian_radius_multiple = gaussian_radius_multiple;
+  fp.binary = binary;
+  fp.natoms = coords.dimension(0);
+  fp.complete = false;
+
+  //bounds and storage of every atom that overlaps the grid
+  size_t total = 0;
+  for (unsigned aidx : atoms) {
+    float densityrad = radii(aidx) * radius_scale * final_radius_multiple;
+    AtomFootprints::footprint f;
+    f.atom = aidx;
+    f.bounds[0] = get_bounds_1d(grid_origin.x, coords(aidx, 0), densityrad);
+    f.bounds[1] = get_bounds_1d(grid_origin.y, coords(aidx, 1), densityrad);
+    f.bounds[2] = get_bounds_1d(grid_origin.z, coords(aidx, 2), densityrad);
+    if (f.bounds[0].x >= f.bounds[0].y || f.bounds[1].x >= f.bounds[1].y || f.bounds[2].x >= f.bounds[2].y)
+      continue; //outside grid
+    f.offset = total;
+    total += (size_t)(f.bounds[0].y - f.bounds[0].x) * (f.bounds[1].y - f.bounds[1].x) * (f.bounds[2].y - f.bounds[2].x);
+    fp.footprints.push_back(f);
+  }
+  if (total > fp.max_points) {
+    //too large, caller computes densities directly
+    fp.footprints.clear();
+    fp.density.clear();
+    fp.gradient.clear();
+    return false;
+  }
+  fp.density.resize(total);
+  fp.gradient.resize(total);
+
+  //densities are computed exactly as in set_atoms_cpu so gridding from footprints is identical
+  parallel_for(num_threads, fp.footprints.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t n = begin; n < end; n++) {
+      const AtomFootprints::footprint& f = fp.footprints[n];
+      float3 a = make_float3(coords(f.atom, 0), coords(f.atom, 1), coords(f.atom, 2));
+      float radius = radii(f.atom);
+      float ar = radius * radius_scale;
+      float ar2 = ar * ar;
+      float gauss2 = ar2 * gaussian_radius_multiple * gaussian_radius_multiple;
+      float final2 = ar2 * final_radius_multiple * final_radius_multiple;
+      size_t nk = f.bounds[2].y - f.bounds[2].x;
+
+      float *dens = fp.density.data() + f.offset;
+      float *grad = fp.gradient.data() + f.offset;
+      for (unsigned i = f.bounds[0].x; i < f.bounds[0].y; i++) {
+        for (unsigned j = f.bounds[1].x; j < f.bounds[1].y; j++) {
+          float dx = grid_origin.x + i * resolution - a.x;
+          float dy = grid_origin.y + j * resolution - a.y;
+          float dxy2 = dx * dx + dy * dy;
+          if (binary) {
+            for (size_t k = 0; k < nk; k++) {
+              float3 grid_coords = make_float3(grid_origin.x + i * resolution, grid_origin.y + j * resolution,
+                  grid_origin.z + (f.bounds[2].x + k) * resolution);
+              dens[k] = calc_point<true>(a.x, a.y, a.z, radius, grid_coords);
+            }
+          } else {
+            calc_row_cpu(a.z, radius, dxy2, grid_origin.z, f.bounds[2].x, nk, dens);
+          }
+
+          //the same derivative as accumulate_atom_gradient, divided by distance
+          for (size_t k = 0; k < nk; k++) {
+            float dz = grid_origin.z + (f.bounds[2].x + k) * resolution - a.z;
+            float dist2 = dxy2 + dz * dz;
+            if (dist2 >= final2) {
+              grad[k] = 0;
+            } else if (dist2 <= gauss2) {
+              float ex = binary ? expf(-2.0f * dist2 / ar2) : dens[k];
+              grad[k] = 4.0f * ex / ar2;
+            } else {
+              float dist = sqrtf(dist2);
+              grad[k] = -(D * dist / ar + E) / (ar * dist);
+            }
+          }
+          dens += nk;
+          grad += nk;
+        }
+      }
+    }
+  });
+  fp.complete = true;
+  return true;
+}
+
+void GridMaker::check_footprints(const AtomFootprints& fp, const float3& grid_origin, size_t natoms) const {
+  if (fp.natoms != natoms)
+    throw std::invalid_argument("Atom footprints do not match number of atoms: "+itoa(fp.natoms)+" vs "+itoa(natoms));
+  if (fp.dim != dim || fp.grid_origin.x != grid_origin.x || fp.grid_origin.y != grid_origin.y || fp.grid_origin.z != grid_origin.z)
+    throw std::invalid_argument("Atom footprints were computed for a different grid");
+  if (fp.resolution != resolution || fp.radius_scale != radius_scale ||
+      fp.gaussian_radius_multiple != gaussian_radius_multiple || fp.binary != binary)
+    throw std::invalid_argument("Atom footprints were computed with different gridding parameters");
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    AtomFootprints& footprints, Grid<Dtype, 4, false>& out) const {
+  check_index_args(coords, type_index, radii, out);
+
+  float3 grid_origin = get_grid_origin(grid_center);
+  size_t ntypes = out.dimension(0);
+  std::vector<unsigned> atoms;
+  atoms.reserve(coords.dimension(0));
+  for (size_t a = 0, n = coords.dimension(0); a < n; ++a) {
+    float atype = type_index(a);
+    if(atype >= ntypes) throw std::out_of_range("Type index "+itoa(atype)+" larger than allowed "+itoa(ntypes));
+    if(atype >= 0) atoms.push_back(a);
+  }
+  if (!record_footprints_cpu(grid_origin, coords, radii, atoms, footprints)) {
+    forward(grid_center, coords, type_index, radii, out);
+    return;
+  }
+
+  size_t plane = dim * dim;
+  parallel_for(num_threads, dim, [&](size_t ibegin, size_t iend, unsigned) {
+    for (size_t t = 0; t < ntypes; t++) {
+      Dtype *start = out.data() + (t * dim + ibegin) * plane;
+      std::fill(start, start + (iend - ibegin) * plane, 0.0);
+    }
+    for (const AtomFootprints::footprint& f : footprints.footprints) {
+      size_t imin = std::max<size_t>(f.bounds[0].x, ibegin), imax = std::min<size_t>(f.bounds[0].y, iend);
+      size_t tidx = type_index(f.atom);
+      size_t nj = f.bounds[1].y - f.bounds[1].x, nk = f.bounds[2].y - f.bounds[2].x;
+      for (size_t i = imin; i < imax; i++) {
+        const float *vals = footprints.density.data() + f.offset + (i - f.bounds[0].x) * nj * nk;
+        for (size_t j = f.bounds[1].x; j < f.bounds[1].y; j++, vals += nk) {
+          Dtype *row = out.data() + ((((tidx * dim) + i) * dim) + j) * dim + f.bounds[2].x;
+          for (size_t k = 0; k < nk; k++) {
+            if (binary) {
+              if (vals[k] != 0) row[k] = 1.0;
+            }
+            else
+              row[k] += vals[k];
+          }
+        }
+      }
+    }
+  });
+}
+
+template<typename Dtype>
+void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    AtomFootprints& footprints, Grid<Dtype, 4, false>& out) const {
+  check_vector_args(coords, type_vector, radii, out);
+
+  float3 grid_origin = get_grid_origin(grid_center);
+  size_t ntypes = type_vector.dimension(1);
+  std::vector<unsigned> atoms;
+  atoms.reserve(coords.dimension(0));
+  for (size_t a = 0, n = coords.dimension(0); a < n; ++a) {
+    for (size_t t = 0; t < ntypes; t++) {
+      if (type_vector(a, t) != 0) {
+        atoms.push_back(a);
+        break;
+      }
+    }
+  }
+  if (!record_footprints_cpu(grid_origin, coords, radii, atoms, footprints)) {
+    forward(grid_center, coords, type_vector, radii, out);
+    return;
+  }
+
+  size_t plane = dim * dim;
+  parallel_for(num_threads, dim, [&](size_t ibegin, size_t iend, unsigned) {
+    for (size_t t = 0; t < ntypes; t++) {
+      Dtype *start = out.data() + (t * dim + ibegin) * plane;
+      std::fill(start, start + (iend - ibegin) * plane, 0.0);
+    }
+    for (const AtomFootprints::footprint& f : footprints.footprints) {
+      size_t imin = std::max<size_t>(f.bounds[0].x, ibegin), imax = std::min<size_t>(f.bounds[0].y, iend);
+      size_t nj = f.bounds[1].y - f.bounds[1].x, nk = f.bounds[2].y - f.bounds[2].x;
+      for (size_t i = imin; i < imax; i++) {
+        const float *vals = footprints.density.data() + f.offset + (i - f.bounds[0].x) * nj * nk;
+        for (size_t j = f.bounds[1].x; j < f.bounds[1].y; j++, vals += nk) {
+          for (size_t tidx = 0; tidx < ntypes; tidx++) {
+            Dtype tmult = type_vector(f.atom, tidx); //amount of type for this atom
+            if (tmult == 0) continue;
+            Dtype *row = out.data() + ((((tidx * dim) + i) * dim) + j) * dim + f.bounds[2].x;
+            for (size_t k = 0; k < nk; k++) {
+              if (binary) {
+                if (vals[k] != 0)
+                  row[k] += tmult; //not quite binary
+              }
+              else
+                row[k] += vals[k] * tmult;
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+template<typename Dtype>
+void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients) const {
+
+  atom_gradients.fill_zero();
+  unsigned n = coords.dimension(0);
+  if(n != type_index.size()) throw std::invalid_argument("Type dimension doesn't equal number of coordinates.");
+  if(n != atom_gradients.dimension(0)) throw std::invalid_argument("Gradient dimension doesn't equal number of coordinates");
+  if(n != radii.size()) throw std::invalid_argument("Radii dimension doesn't equal number of coordinates");
+  if(coords.dimension(1) != 3) throw std::invalid_argument("Need x,y,z,r for coord_radius");
+  float3 grid_origin = get_grid_origin(grid_center);
+  check_footprints(footprints, grid_origin, n);
+  if (!footprints.complete) {
+    backward(grid_center, coords, type_index, radii, diff, atom_gradients);
+    return;
+  }
+
+  parallel_for(num_threads, footprints.footprints.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t fidx = begin; fidx < end; fidx++) {
+      const AtomFootprints::footprint& f = footprints.footprints[fidx];
+      int whichgrid = round(type_index[f.atom]);
+      const float *grad = footprints.gradient.data() + f.offset;
+      float3 agrad{0,0,0};
+      for (unsigned i = f.bounds[0].x; i < f.bounds[0].y; i++) {
+        float dx = grid_origin.x + i * resolution - coords(f.atom, 0);
+        for (unsigned j = f.bounds[1].x; j < f.bounds[1].y; j++) {
+          float dy = grid_origin.y + j * resolution - coords(f.atom, 1);
+          const Dtype *row = diff.data() + (((size_t)whichgrid * dim + i) * dim + j) * dim;
+          for (unsigned k = f.bounds[2].x; k < f.bounds[2].y; k++, grad++) {
+            float dz = grid_origin.z + k * resolution - coords(f.atom, 2);
+            float g = *grad * row[k];
+            agrad.x += dx * g;
+            agrad.y += dy * g;
+            agrad.z += dz * g;
+          }
+        }
+      }
+      atom_gradients(f.atom, 0) = agrad.x;
+      atom_gradients(f.atom, 1) = agrad.y;
+      atom_gradients(f.atom, 2) = agrad.z;
+    }
+  });
+}
+
+template<typename Dtype>
+void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<Dtype, 4, false>& diff, Grid<Dtype, 2, false>& atom_gradients, Grid<Dtype, 2, false>& type_gradients) const {
+
+  atom_gradients.fill_zero();
+  type_gradients.fill_zero();
+  unsigned n = coords.dimension(0);
+  unsigned ntypes = type_vector.dimension(1);
+
+  if(n != type_vector.dimension(0)) throw std::invalid_argument("Type dimension doesn't equal number of coordinates.");
+  if(ntypes != diff.dimension(0)) throw std::invalid_argument("Channels in diff doesn't equal number of types");
+  if(n != atom_gradients.dimension(0)) throw std::invalid_argument("Atom gradient dimension doesn't equal number of coordinates");
+  if(n != type_gradients.dimension(0)) throw std::invalid_argument("Type gradient dimension doesn't equal number of coordinates");
+  if(type_gradients.dimension(1) != ntypes) throw std::invalid_argument("Type gradient dimension has wrong number of types");
+  if(n != radii.size()) throw std::invalid_argument("Radii dimension doesn't equal number of coordinates");
+  if(coords.dimension(1) != 3) throw std::invalid_argument("Need x,y,z,r for coord_radius");
+  float3 grid_origin = get_grid_origin(grid_center);
+  check_footprints(footprints, grid_origin, n);
+  if (!footprints.complete) {
+    backward(grid_center, coords, type_vector, radii, diff, atom_gradients, type_gradients);
+    return;
+  }
+
+  size_t cstride = (size_t)dim * dim * dim;
+  parallel_for(num_threads, footprints.footprints.size(), [&](size_t begin, size_t end, unsigned) {
+    std::vector<float> tgrad(ntypes); //accumulated by this thread only
+    for (size_t fidx = begin; fidx < end; fidx++) {
+      const AtomFootprints::footprint& f = footprints.footprints[fidx];
+      float3 a = make_float3(coords(f.atom, 0), coords(f.atom, 1), coords(f.atom, 2));
+      const float *tmult = type_vector.data() + (size_t)f.atom * ntypes; //amount of each type for this atom
+      const float *dens = footprints.density.data() + f.offset;
+      const float *grad = footprints.gradient.data() + f.offset;
+      std::fill(tgrad.begin(), tgrad.end(), 0.0f);
+      float3 agrad{0,0,0};
+      for (unsigned i = f.bounds[0].x; i < f.bounds[0].y; i++) {
+        float dx = grid_origin.x + i * resolution - a.x;
+        for (unsigned j = f.bounds[1].x; j < f.bounds[1].y; j++) {
+          float dy = grid_origin.y + j * resolution - a.y;
+          const Dtype *row = diff.data() + ((size_t)i * dim + j) * dim;
+          for (unsigned k = f.bounds[2].x; k < f.bounds[2].y; k++, dens++, grad++) {
+            float dz = grid_origin.z + k * resolution - a.z;
+            float val = *dens;
+            if (val == 0 && *grad == 0) continue; //corners of the box are beyond the density radius
+            float gridval = 0;
+            for (unsigned t = 0; t < ntypes; t++) {
+              float g = row[t * cstride + k];
+              gridval += tmult[t] * g;
+              tgrad[t] += val * g;
+            }
+            float g = *grad * gridval;
+            agrad.x += dx * g;
+            agrad.y += dy * g;
+            agrad.z += dz * g;
+          }
+        }
+      }
+      atom_gradients(f.atom, 0) = agrad.x;
+      atom_gradients(f.atom, 1) = agrad.y;
+      atom_gradients(f.atom, 2) = agrad.z;
+      for (unsigned t = 0; t < ntypes; t++) {
+        type_gradients(f.atom, t) = tgrad[t];
+      }
+    }
+  });
+}
+
+template <typename Dtype>
+void GridMaker::backward_relevance(float3 grid_center,  const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<Dtype, 4, false>& density, const Grid<Dtype, 4, false>& diff,
+    Grid<Dtype, 1, false>& relevance) const {
+
+  relevance.fill_zero();
+  unsigned n = coords.dimension(0);
+  if(n != type_index.size()) throw std::invalid_argument("Type dimension doesn't equal number of coordinates.");
+  if(coords.dimension(1) != 3) throw std::invalid_argument("Need x,y,z,r for coord_radius");
+  if(n != radii.size()) throw std::invalid_argument("Radii dimension doesn't equal number of coordinates");
+  float3 grid_origin = get_grid_origin(grid_center);
+  check_footprints(footprints, grid_origin, n);
+  if (!footprints.complete) {
+    backward_relevance(grid_center, coords, type_index, radii, density, diff, relevance);
+    return;
+  }
+
+  parallel_for(num_threads, footprints.footprints.size(), [&](size_t begin, size_t end, unsigned) {
+    for (size_t fidx = begin; fidx < end; fidx++) {
+      const AtomFootprints::footprint& f = footprints.footprints[fidx];
+      int whichgrid = round(type_index[f.atom]);
+      const float *vals = footprints.density.data() + f.offset;
+      float ret = 0;
+      for (unsigned i = f.bounds[0].x; i < f.bounds[0].y; i++) {
+        for (unsigned j = f.bounds[1].x; j < f.bounds[1].y; j++) {
+          for (unsigned k = f.bounds[2].x; k < f.bounds[2].y; k++, vals++) {
+            float val = *vals;
+            if (val > 0) {
+              float denseval = density(whichgrid, i, j, k);
+              if(denseval > 0) {
+                //weight by contribution to density grid
+                ret += diff(whichgrid, i, j, k)*val/denseval;
+              }
+            }
+          }
+        }
+      }
+      relevance(f.atom) = ret;
+    }
+  });
+}
+
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    AtomFootprints& footprints, Grid<float, 4, false>& out) const;
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii,
+    AtomFootprints& footprints, Grid<double, 4, false>& out) const;
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    AtomFootprints& footprints, Grid<float, 4, false>& out) const;
+template void GridMaker::forward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii,
+    AtomFootprints& footprints, Grid<double, 4, false>& out) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<float, 4, false>& diff, Grid<float, 2, false>& atom_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 1, false>& type_index, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<double, 4, false>& diff, Grid<double, 2, false>& atom_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<float, 4, false>& diff, Grid<float, 2, false>& atom_gradients, Grid<float, 2, false>& type_gradients) const;
+template void GridMaker::backward(float3 grid_center, const Grid<float, 2, false>& coords,
+    const Grid<float, 2, false>& type_vector, const Grid<float, 1, false>& radii, const AtomFootprints& footprints,
+    const Grid<double, 4, false>& diff, Grid<double, 2, false>& atom_gradients, Grid<double, 2, false>& type_gradients) const;
+template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>&,
+    const Grid<float, 1, false>&, const Grid<float, 1, false>&, const AtomFootprints&, const Grid<float, 4, false>&,
+    const Grid<float, 4, false>&, Grid<float, 1, false>&) const;
+template void GridMaker::backward_relevance(float3,  const Grid<float, 2, false>&,
+    const Grid<float, 1, false>&, const Grid<float, 1, false>&, const AtomFootprints&, const Grid<double, 4, false>&,
+    const Grid<double, 4, false>& , Grid<double, 1, false>& ) const;
 }
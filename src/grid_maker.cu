@@ -1,4 +1,5 @@
 #include "libmolgrid/grid_maker.h"
+#include <type_traits>
 
 namespace libmolgrid {
     __shared__ uint scanScratch[LMG_CUDA_NUM_THREADS * 2];
@@ -171,6 +172,65 @@ namespace libmolgrid {
     }
 
 
+    //fp32 device buffer of at least n values, owned by the calling thread
+    static float* accumulation_buffer(size_t n) {
+      struct buffer_t {
+        float *data = nullptr;
+        size_t capacity = 0;
+        int device = -1;
+        ~buffer_t() { cudaFree(data); }
+      };
+      thread_local buffer_t buffer;
+      int device = 0;
+      LMG_CUDA_CHECK(cudaGetDevice(&device));
+      if(n > buffer.capacity || device != buffer.device) {
+        LMG_CUDA_CHECK(cudaFree(buffer.data));
+        buffer.data = nullptr;
+        buffer.capacity = 0;
+        LMG_CUDA_CHECK(cudaMalloc(&buffer.data, n * sizeof(float)));
+        buffer.capacity = n;
+        buffer.device = device;
+      }
+      return buffer.data;
+    }
+
+    //full precision output is accumulated in place
+    template <typename Dtype>
+    static Grid<Dtype, 4, true> accumulation_grid(Grid<Dtype, 4, true>& out, std::true_type) {
+      return out;
+    }
+
+    //reduced precision output is accumulated in a zeroed fp32 buffer
+    template <typename Dtype>
+    static Grid<float, 4, true> accumulation_grid(Grid<Dtype, 4, true>& out, std::false_type) {
+      float *buffer = accumulation_buffer(out.size());
+      LMG_CUDA_CHECK(cudaMemset(buffer, 0, out.size() * sizeof(float)));
+      return Grid<float, 4, true>(buffer, out.dimension(0), out.dimension(1), out.dimension(2), out.dimension(3));
+    }
+
+    __device__ inline void store_reduced(float val, __half& dst) { dst = __float2half_rn(val); }
+#ifdef LIBMOLGRID_BFLOAT16
+    __device__ inline void store_reduced(float val, __nv_bfloat16& dst) { dst = __float2bfloat16_rn(val); }
+#endif
+
+    template <typename Dtype>
+    __global__ void store_reduced_gpu(unsigned n, const float *acc, Dtype *out) {
+      LMG_CUDA_KERNEL_LOOP(i, n) {
+        store_reduced(acc[i], out[i]);
+      }
+    }
+
+    template <typename Dtype>
+    static void store_grid(const Grid<Dtype, 4, true>& acc, Grid<Dtype, 4, true>& out, std::true_type) {
+    }
+
+    //round every value of acc into out
+    template <typename Dtype>
+    static void store_grid(const Grid<float, 4, true>& acc, Grid<Dtype, 4, true>& out, std::false_type) {
+      unsigned n = out.size();
+      store_reduced_gpu<Dtype><<<LMG_GET_BLOCKS(n), LMG_CUDA_NUM_THREADS>>>(n, acc.data(), out.data());
+    }
+
     template <typename Dtype, bool Binary>
     __device__ void GridMaker::set_atoms(unsigned rel_atoms, float3 grid_origin,
         const float3 *coord_data, const float *tdata, const float *radii, Dtype *data) {
@@ -268,14 +328,20 @@ namespace libmolgrid {
 
       check_index_args(coords, type_index, radii, out);
       //zero out grid to start
-      LMG_CUDA_CHECK(cudaMemset(out.data(), 0, out.size() * sizeof(float)));
+      LMG_CUDA_CHECK(cudaMemset(out.data(), 0, out.size() * sizeof(Dtype)));
 
       if(coords.dimension(0) == 0) return; //no atoms
 
+      //reduced precision output is accumulated in fp32 and rounded once at the end
+      typedef typename std::conditional<std::is_floating_point<Dtype>::value, Dtype, float>::type Atype;
+      typename std::is_floating_point<Dtype>::type inplace;
+      Grid<Atype, 4, true> acc = accumulation_grid(out, inplace);
+
       if(binary)
-        forward_gpu<Dtype, true><<<blocks, threads>>>(*this, grid_origin, coords, type_index, radii, out);
+        forward_gpu<Atype, true><<<blocks, threads>>>(*this, grid_origin, coords, type_index, radii, acc);
       else
-        forward_gpu<Dtype, false><<<blocks, threads>>>(*this, grid_origin, coords, type_index, radii, out);
+        forward_gpu<Atype, false><<<blocks, threads>>>(*this, grid_origin, coords, type_index, radii, acc);
+      store_grid(acc, out, inplace);
 
       LMG_CUDA_CHECK(cudaPeekAtLastError());
     }
@@ -393,14 +459,20 @@ namespace libmolgrid {
 
       check_vector_args(coords, type_vector, radii, out);
       //zero out grid to start
-      LMG_CUDA_CHECK(cudaMemset(out.data(), 0, out.size() * sizeof(float)));
+      LMG_CUDA_CHECK(cudaMemset(out.data(), 0, out.size() * sizeof(Dtype)));
 
       if(coords.dimension(0) == 0) return; //no atoms
 
+      //reduced precision output is accumulated in fp32 and rounded once at the end
+      typedef typename std::conditional<std::is_floating_point<Dtype>::value, Dtype, float>::type Atype;
+      typename std::is_floating_point<Dtype>::type inplace;
+      Grid<Atype, 4, true> acc = accumulation_grid(out, inplace);
+
       if(binary)
-        forward_gpu_vec<Dtype, true><<<blocks, threads>>>(*this, grid_origin, coords, type_vector, radii, out);
+        forward_gpu_vec<Atype, true><<<blocks, threads>>>(*this, grid_origin, coords, type_vector, radii, acc);
       else
-        forward_gpu_vec<Dtype, false><<<blocks, threads>>>(*this, grid_origin, coords, type_vector, radii, out);
+        forward_gpu_vec<Atype, false><<<blocks, threads>>>(*this, grid_origin, coords, type_vector, radii, acc);
+      store_grid(acc, out, inplace);
 
       LMG_CUDA_CHECK(cudaPeekAtLastError());
     }
@@ -410,6 +482,18 @@ namespace libmolgrid {
     template void GridMaker::forward(float3 grid_center, const Grid<float, 2, true>& coords,
         const Grid<float, 2, true>& type_vector, const Grid<float, 1, true>& radii, Grid<double, 4, true>& out) const;
 
+    //reduced precision output, accumulated in fp32
+#define INSTANTIATE_REDUCED_FORWARD(T) \
+    template void GridMaker::forward(float3 grid_center, const Grid<float, 2, true>& coords, \
+        const Grid<float, 1, true>& type_index, const Grid<float, 1, true>& radii, Grid<T, 4, true>& out) const; \
+    template void GridMaker::forward(float3 grid_center, const Grid<float, 2, true>& coords, \
+        const Grid<float, 2, true>& type_vector, const Grid<float, 1, true>& radii, Grid<T, 4, true>& out) const;
+
+    INSTANTIATE_REDUCED_FORWARD(__half)
+#ifdef LIBMOLGRID_BFLOAT16
+    INSTANTIATE_REDUCED_FORWARD(__nv_bfloat16)
+#endif
+
     //kernel launch - parallelize across whole atoms
     //TODO: accelerate this more
     template<typename Dtype>
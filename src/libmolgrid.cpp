@@ -19,11 +19,44 @@ namespace libmolgrid {
     template class ManagedGrid<float, SIZE>; \
     template class ManagedGrid<double, SIZE>;
 
+//explicit instantiation compiles every member, including arithmetic that needs
+//host operators for __half and __nv_bfloat16; older CUDA versions lack these,
+//in which case reduced precision grids are instantiated implicitly where used
+#ifdef LIBMOLGRID_HOST_REDUCED_OPS
+#define INSTANTIATE_HALF_GRID_DEFINITIONS(SIZE) \
+    template class Grid<__half, SIZE, false>; \
+    template class Grid<__half, SIZE, true>; \
+    template class ManagedGrid<__half, SIZE>;
+#else
+#define INSTANTIATE_HALF_GRID_DEFINITIONS(SIZE)
+#endif
+
+#if defined(LIBMOLGRID_BFLOAT16) && defined(LIBMOLGRID_HOST_REDUCED_OPS)
+#define INSTANTIATE_BF16_GRID_DEFINITIONS(SIZE) \
+    template class Grid<__nv_bfloat16, SIZE, false>; \
+    template class Grid<__nv_bfloat16, SIZE, true>; \
+    template class ManagedGrid<__nv_bfloat16, SIZE>;
+#else
+#define INSTANTIATE_BF16_GRID_DEFINITIONS(SIZE)
+#endif
+
 INSTANTIATE_GRID_DEFINITIONS(1)
+INSTANTIATE_HALF_GRID_DEFINITIONS(1)
+INSTANTIATE_BF16_GRID_DEFINITIONS(1)
 INSTANTIATE_GRID_DEFINITIONS(2)
+INSTANTIATE_HALF_GRID_DEFINITIONS(2)
+INSTANTIATE_BF16_GRID_DEFINITIONS(2)
 INSTANTIATE_GRID_DEFINITIONS(3)
+INSTANTIATE_HALF_GRID_DEFINITIONS(3)
+INSTANTIATE_BF16_GRID_DEFINITIONS(3)
 INSTANTIATE_GRID_DEFINITIONS(4)
+INSTANTIATE_HALF_GRID_DEFINITIONS(4)
+INSTANTIATE_BF16_GRID_DEFINITIONS(4)
 INSTANTIATE_GRID_DEFINITIONS(5)
+INSTANTIATE_HALF_GRID_DEFINITIONS(5)
+INSTANTIATE_BF16_GRID_DEFINITIONS(5)
 INSTANTIATE_GRID_DEFINITIONS(6)
+INSTANTIATE_HALF_GRID_DEFINITIONS(6)
+INSTANTIATE_BF16_GRID_DEFINITIONS(6)
 
 }
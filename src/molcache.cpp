@@ -0,0 +1,473 @@
+/*
+ * molcache.cpp
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#include "libmolgrid/molcache.h"
+#include "libmolgrid/libmolgrid.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace libmolgrid {
+
+using namespace std;
+
+static_assert(sizeof(MolCache3Header) == 64, "MolCache3Header must be 64 bytes");
+static_assert(sizeof(MolCacheSlot) == 16, "MolCacheSlot must be 16 bytes");
+static_assert(sizeof(MolCache2IndexHeader) == 64, "MolCache2IndexHeader must be 64 bytes");
+
+static size_t align_block(size_t n) {
+  return (n + MOLCACHE3_ALIGN - 1) & ~(MOLCACHE3_ALIGN - 1);
+}
+
+//positions of the arrays of a molecule block relative to its start
+struct block_layout {
+    size_t coords, types, radii, end;
+    block_layout(size_t natoms, size_t namelen) {
+      coords = align_block(2 * sizeof(uint32_t) + namelen);
+      types = align_block(coords + 3 * sizeof(float) * natoms);
+      radii = align_block(types + sizeof(float) * natoms);
+      end = align_block(radii + sizeof(float) * natoms);
+    }
+};
+
+uint64_t molcache_hash(const char *data, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) data[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+std::string molcache3_typer_description(const AtomTyper& typer) {
+  stringstream desc;
+  desc << typer.num_types() << "\n";
+  for (const string& name : typer.get_type_names()) {
+    desc << name << "\n";
+  }
+  return desc.str();
+}
+
+//open addressing with linear probing, at most half full
+static vector<MolCacheSlot> build_hash_index(const vector<MolCacheSlot>& entries) {
+  uint64_t nslots = 1;
+  while (nslots < 2 * entries.size()) nslots *= 2;
+  vector<MolCacheSlot> index(nslots, MolCacheSlot{0, 0});
+  for (const MolCacheSlot& e : entries) {
+    uint64_t i = e.hash & (nslots - 1);
+    while (index[i].offset != 0) i = (i + 1) & (nslots - 1);
+    index[i] = e;
+  }
+  return index;
+}
+
+//call matches(offset) on slots with the hash of name until it returns true
+template <class Match>
+static bool probe_hash_index(const MolCacheSlot *slots, uint64_t nslots, const char *name, size_t len, Match matches) {
+  uint64_t h = molcache_hash(name, len);
+  uint64_t mask = nslots - 1;
+  for (uint64_t i = 0; i < nslots; i++) {
+    const MolCacheSlot& slot = slots[(h + i) & mask];
+    if (slot.offset == 0) return false; //empty slot terminates probe
+    if (slot.hash == h && matches(slot.offset)) return true;
+  }
+  return false;
+}
+
+MolCacheLoad parse_molcache_load(const std::string& name) {
+  if (name == "none") return MolCacheLoadNone;
+  if (name == "willneed") return MolCacheLoadWillNeed;
+  if (name == "populate") return MolCacheLoadPopulate;
+  if (name == "hugepages") return MolCacheLoadHugePages;
+  throw invalid_argument("Unknown molcache load policy " + name + " (must be none, willneed, populate, or hugepages)");
+}
+
+static const char *molcache_load_name(MolCacheLoad load) {
+  switch (load) {
+  case MolCacheLoadNone:
+    return "none";
+  case MolCacheLoadWillNeed:
+    return "willneed";
+  case MolCacheLoadPopulate:
+    return "populate";
+  case MolCacheLoadHugePages:
+    return "hugepages";
+  }
+  return "unknown";
+}
+
+static void log_molcache_load(const std::string& fname, size_t len, MolCacheLoad load,
+    chrono::steady_clock::time_point start) {
+  double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (load == MolCacheLoadWillNeed) {
+    //the kernel reads ahead asynchronously, so only issuing the advice is timed
+    cerr << "Mapped " << fname << " (" << len / (1024.0 * 1024.0) << " MB) and requested readahead (willneed policy) in "
+        << secs << "s; pages are read in the background\n";
+  } else {
+    cerr << "Loaded " << fname << " (" << len / (1024.0 * 1024.0) << " MB) with " << molcache_load_name(load)
+        << " policy in " << secs << "s\n";
+  }
+}
+
+MolCacheMap::MolCacheMap(const std::string& fname, MolCacheLoad load, bool log) {
+  auto start = chrono::steady_clock::now();
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) throw invalid_argument("Could not open file: " + fname);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    throw invalid_argument("Could not memory map " + fname);
+  }
+  len = st.st_size;
+
+  void *p = MAP_FAILED;
+  if (load == MolCacheLoadHugePages) {
+    //huge pages are only reliably available for anonymous memory, so copy the file
+    p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+      madvise(p, len, MADV_HUGEPAGE);
+#endif
+      for (size_t pos = 0; pos < len;) {
+        ssize_t n = pread(fd, (char*) p + pos, len - pos, pos);
+        if (n <= 0) {
+          munmap(p, len);
+          ::close(fd);
+          throw runtime_error("Error reading " + fname);
+        }
+        pos += n;
+      }
+      mprotect(p, len, PROT_READ);
+    } else {
+      cerr << "Could not allocate " << len / (1024.0 * 1024.0) << " MB of private memory for " << fname
+          << ", mapping the file without huge pages\n";
+      load = MolCacheLoadNone;
+    }
+  }
+  if (p == MAP_FAILED) {
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (load == MolCacheLoadPopulate) flags |= MAP_POPULATE;
+#endif
+    p = mmap(nullptr, len, PROT_READ, flags, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) throw invalid_argument("Could not memory map " + fname);
+  ptr = (const char*) p;
+
+  if (load == MolCacheLoadWillNeed) {
+    //advise in chunks so the destructor does not wait long for the thread
+    loader = thread([this, fname, log, start]() {
+      const size_t chunk = 64 * 1024 * 1024;
+      for (size_t pos = 0; pos < len && !stop_loading; pos += chunk) {
+        madvise((void*) (ptr + pos), min(chunk, len - pos), MADV_WILLNEED);
+      }
+      if (log && !stop_loading) log_molcache_load(fname, len, MolCacheLoadWillNeed, start);
+    });
+  } else if (log) {
+    log_molcache_load(fname, len, load, start);
+  }
+}
+
+MolCacheMap::~MolCacheMap() {
+  stop_loading = true;
+  if (loader.joinable()) loader.join();
+  if (ptr) munmap((void*) ptr, len);
+}
+
+MolCache3::MolCache3(const std::string& fname, MolCacheLoad load, bool log) :
+    map(fname, load, log) {
+  if (map.size() < sizeof(MolCache3Header)) throw invalid_argument(fname + " is not a valid molcache3 file");
+
+  memcpy(&header, map.data(), sizeof(MolCache3Header));
+  if (header.version != MOLCACHE3_VERSION)
+    throw invalid_argument(fname + " is not a valid molcache3 file");
+
+  //index must be in bounds and a power of two
+  size_t n = header.num_slots;
+  if (n == 0 || (n & (n - 1)) != 0 || header.index_offset % MOLCACHE3_ALIGN != 0
+      || header.index_offset + n * sizeof(MolCacheSlot) > map.size()
+      || header.typer_offset + header.typer_length > map.size())
+    throw invalid_argument(fname + " is a truncated or corrupt molcache3 file");
+
+  slots = (const MolCacheSlot*) (map.data() + header.index_offset);
+}
+
+std::string MolCache3::typer_description() const {
+  return string(map.data() + header.typer_offset, header.typer_length);
+}
+
+void MolCache3::check_typer(const AtomTyper& typer) const {
+  string desc = molcache3_typer_description(typer);
+  if (typer.is_vector_typer())
+    throw invalid_argument("Vector typer used with molcache3 file");
+  if (molcache_hash(desc.c_str(), desc.length()) != header.typer_hash || desc != typer_description())
+    throw invalid_argument("molcache3 file was created with a different atom typer ("
+        + itoa(header.num_types) + " types) than the one provided (" + itoa(typer.num_types()) + " types)");
+}
+
+bool MolCache3::find(const char *name, entry& e) const {
+  size_t len = strlen(name);
+  size_t size = map.size();
+  return probe_hash_index(slots, header.num_slots, name, len, [&](uint64_t offset) {
+    //the index may point anywhere, so every part of the block is checked before it is read
+    if (offset < sizeof(MolCache3Header) || offset % MOLCACHE3_ALIGN != 0 || offset > size - 2 * sizeof(uint32_t))
+      throw invalid_argument("molcache3 entry for " + string(name) + " is truncated or corrupt");
+    const char *block = map.data() + offset;
+    uint32_t natoms = ((const uint32_t*) block)[0];
+    uint32_t namelen = ((const uint32_t*) block)[1];
+    if (namelen != len) return false;
+    if (offset + 2 * sizeof(uint32_t) + namelen > size)
+      throw invalid_argument("molcache3 entry for " + string(name) + " is truncated or corrupt");
+    if (memcmp(block + 2 * sizeof(uint32_t), name, len) != 0) return false;
+
+    block_layout layout(natoms, namelen);
+    if (offset + layout.end > size)
+      throw invalid_argument("molcache3 entry for " + string(name) + " is truncated or corrupt");
+    e.natoms = natoms;
+    e.coords = (const float*) (block + layout.coords);
+    e.types = (const float*) (block + layout.types);
+    e.radii = (const float*) (block + layout.radii);
+    return true;
+  });
+}
+
+//file position of the trailer of a molcache2 file
+static uint64_t molcache2_trailer(const char *data, size_t size, const std::string& fname) {
+  int32_t version = 0;
+  uint64_t start = 0;
+  if (size >= sizeof(version) + sizeof(start)) {
+    memcpy(&version, data, sizeof(version));
+    memcpy(&start, data + sizeof(version), sizeof(start));
+  }
+  if (version != -1) throw invalid_argument(fname + " is not a valid molcache2 file");
+  if (start < sizeof(version) + sizeof(start) || start > size)
+    throw invalid_argument(fname + " is a truncated or corrupt molcache2 file");
+  return start;
+}
+
+//hash and position of each record (name length, name, offset) of the trailer
+static vector<MolCacheSlot> molcache2_records(const char *data, size_t size, const std::string& fname) {
+  vector<MolCacheSlot> entries;
+  for (uint64_t pos = molcache2_trailer(data, size, fname), n = size; pos < n;) {
+    unsigned char len = data[pos];
+    if (pos + 1 + len + sizeof(uint64_t) > n)
+      throw invalid_argument(fname + " is a truncated or corrupt molcache2 file");
+    entries.push_back(MolCacheSlot{molcache_hash(data + pos + 1, len), pos});
+    pos += 1 + len + sizeof(uint64_t);
+  }
+  return entries;
+}
+
+//hash index of the trailer records, where only the last record of a repeated name is indexed
+static vector<MolCacheSlot> build_molcache2_index(const char *data, const vector<MolCacheSlot>& entries,
+    uint64_t& num_molecules) {
+  uint64_t nslots = 1;
+  while (nslots < 2 * entries.size()) nslots *= 2;
+  vector<MolCacheSlot> index(nslots, MolCacheSlot{0, 0});
+  num_molecules = 0;
+  for (auto e = entries.rbegin(); e != entries.rend(); ++e) {
+    const char *name = data + e->offset + 1;
+    unsigned char len = data[e->offset];
+    bool seen = probe_hash_index(index.data(), nslots, name, len, [&](uint64_t pos) {
+      return (unsigned char) data[pos] == len && memcmp(data + pos + 1, name, len) == 0;
+    });
+    if (seen) continue;
+    uint64_t i = e->hash & (nslots - 1);
+    while (index[i].offset != 0) i = (i + 1) & (nslots - 1);
+    index[i] = *e;
+    num_molecules++;
+  }
+  return index;
+}
+
+MolCache2::MolCache2(const std::string& fname, MolCacheLoad load, bool log) :
+    map(fname, load, log) {
+  uint64_t trailer = molcache2_trailer(map.data(), map.size(), fname);
+
+  //use the index file if it is for this version of the molcache
+  string iname = index_file_name(fname);
+  boost::system::error_code ec;
+  if (boost::filesystem::exists(iname, ec)) {
+    index_map.open(iname);
+    MolCache2IndexHeader header;
+    bool valid = index_map.is_open() && index_map.size() >= sizeof(header);
+    if (valid) {
+      memcpy(&header, index_map.data(), sizeof(header));
+      uint64_t n = header.num_slots;
+      valid = header.version == MOLCACHE2_INDEX_VERSION && header.molcache_size == map.size()
+          && header.trailer_offset == trailer
+          && header.molcache_mtime == (int64_t) boost::filesystem::last_write_time(fname, ec)
+          && n > 0 && (n & (n - 1)) == 0 && sizeof(header) + n * sizeof(MolCacheSlot) <= index_map.size();
+    }
+    if (valid) {
+      slots = (const MolCacheSlot*) (index_map.data() + sizeof(header));
+      num_slots = header.num_slots;
+      num_molecules = header.num_molecules;
+      return;
+    }
+    if (index_map.is_open()) index_map.close();
+  }
+
+  vector<MolCacheSlot> entries = molcache2_records(map.data(), map.size(), fname);
+  index = build_molcache2_index(map.data(), entries, num_molecules);
+  slots = index.data();
+  num_slots = index.size();
+}
+
+bool MolCache2::find(const char *name, const char *& data) const {
+  size_t len = strlen(name);
+  size_t size = map.size();
+  return probe_hash_index(slots, num_slots, name, len, [&](uint64_t pos) {
+    //an index file may point anywhere, so the record and the atoms it points to are checked
+    if (pos >= size)
+      throw invalid_argument("molcache2 entry for " + string(name) + " is truncated or corrupt");
+    const char *record = map.data() + pos;
+    if ((unsigned char) record[0] != len) return false;
+    if (pos + 1 + len + sizeof(uint64_t) > size)
+      throw invalid_argument("molcache2 entry for " + string(name) + " is truncated or corrupt");
+    if (memcmp(record + 1, name, len) != 0) return false;
+
+    uint64_t offset = 0;
+    uint32_t natoms = 0;
+    memcpy(&offset, record + 1 + len, sizeof(offset));
+    if (offset > size - sizeof(natoms))
+      throw invalid_argument("molcache2 entry for " + string(name) + " is truncated or corrupt");
+    memcpy(&natoms, map.data() + offset, sizeof(natoms));
+    if (offset + sizeof(natoms) + natoms * MOLCACHE2_ATOM_SIZE > size)
+      throw invalid_argument("molcache2 entry for " + string(name) + " is truncated or corrupt");
+    data = map.data() + offset;
+    return true;
+  });
+}
+
+size_t MolCache2::create_index(const std::string& fname) {
+  MolCacheMap map(fname);
+
+  MolCache2IndexHeader header;
+  header.molcache_size = map.size();
+  header.molcache_mtime = boost::filesystem::last_write_time(fname);
+  header.trailer_offset = molcache2_trailer(map.data(), map.size(), fname);
+  vector<MolCacheSlot> entries = molcache2_records(map.data(), map.size(), fname);
+  vector<MolCacheSlot> index = build_molcache2_index(map.data(), entries, header.num_molecules);
+  header.num_slots = index.size();
+
+  //write to a temporary file so readers never see a partial index
+  string iname = index_file_name(fname);
+  string tmpname = iname + ".tmp";
+  {
+    ofstream out(tmpname.c_str(), ios::binary | ios::trunc);
+    if (!out) throw invalid_argument("Could not create " + tmpname);
+    out.write((const char*) &header, sizeof(header));
+    out.write((const char*) index.data(), index.size() * sizeof(MolCacheSlot));
+    if (!out) throw runtime_error("Error writing " + tmpname);
+  }
+  boost::filesystem::rename(tmpname, iname);
+  return header.num_molecules;
+}
+
+MolCache3Writer::MolCache3Writer(const std::string& f, std::shared_ptr<AtomTyper> t) :
+    fname(f), typer(t) {
+  if (typer->is_vector_typer())
+    throw invalid_argument("molcache3 files require an index typer");
+  out.open(fname.c_str(), ios::binary | ios::trunc);
+  if (!out) throw invalid_argument("Could not create " + fname);
+
+  //header is rewritten on close
+  MolCache3Header header;
+  write(&header, sizeof(header));
+}
+
+MolCache3Writer::~MolCache3Writer() {
+  try {
+    close();
+  } catch (...) {
+    //can't throw from destructor
+  }
+}
+
+void MolCache3Writer::write(const void *data, size_t n) {
+  out.write((const char*) data, n);
+  if (!out) throw runtime_error("Error writing " + fname);
+  pos += n;
+}
+
+//zero fill to alignment boundary
+void MolCache3Writer::pad() {
+  static const char zeros[MOLCACHE3_ALIGN] = { 0, };
+  size_t n = align_block(pos) - pos;
+  if (n) write(zeros, n);
+}
+
+bool MolCache3Writer::add(const std::string& name, const CoordinateSet& c) {
+  if (!out.is_open()) throw logic_error("Adding to closed molcache3 file " + fname);
+  if (names.count(name)) return false;
+  if (c.has_vector_types())
+    throw invalid_argument("Vector typed coordinates can not be stored in molcache3 file");
+  if (c.max_type > typer->num_types())
+    throw invalid_argument("Coordinates of " + name + " have more types (" + itoa(c.max_type)
+        + ") than the molcache3 atom typer (" + itoa(typer->num_types()) + ")");
+
+  uint32_t natoms = c.size();
+  uint32_t namelen = name.length();
+  MolCacheSlot slot;
+  slot.hash = molcache_hash(name.c_str(), namelen);
+  slot.offset = pos;
+
+  block_layout layout(natoms, namelen);
+  write(&natoms, sizeof(natoms));
+  write(&namelen, sizeof(namelen));
+  write(name.c_str(), namelen);
+  pad();
+  if (natoms > 0) {
+    write(c.coords.cpu().data(), 3 * sizeof(float) * natoms);
+    pad();
+    write(c.type_index.cpu().data(), sizeof(float) * natoms);
+    pad();
+    write(c.radii.cpu().data(), sizeof(float) * natoms);
+    pad();
+  }
+  if (pos != slot.offset + layout.end) throw logic_error("Inconsistent molcache3 block layout");
+
+  names.insert(name);
+  entries.push_back(slot);
+  return true;
+}
+
+void MolCache3Writer::close() {
+  if (!out.is_open()) return;
+
+  MolCache3Header header;
+  header.num_types = typer->num_types();
+  header.num_molecules = entries.size();
+
+  string desc = molcache3_typer_description(*typer);
+  header.typer_hash = molcache_hash(desc.c_str(), desc.length());
+  header.typer_offset = pos;
+  header.typer_length = desc.length();
+  write(desc.c_str(), desc.length());
+  pad();
+
+  vector<MolCacheSlot> index = build_hash_index(entries);
+  header.index_offset = pos;
+  header.num_slots = index.size();
+  write(index.data(), index.size() * sizeof(MolCacheSlot));
+
+  out.seekp(0);
+  out.write((const char*) &header, sizeof(header));
+  out.close();
+  if (!out) throw runtime_error("Error writing " + fname);
+}
+
+} /* namespace libmolgrid */
@@ -28,3 +28,34 @@ BOOST_AUTO_TEST_CASE(coordinates) {
   BOOST_CHECK_SMALL(c.coords(1,1)-3.0f,TOL);
 
 }
+
+BOOST_AUTO_TEST_CASE(crop) {
+  vector<float3> coords{make_float3(0,0,0),make_float3(10,0,0),make_float3(0,2,0),make_float3(0,0,-5)};
+  vector<int> types{3,2,1,0};
+  vector<float> radii{1.5,1.5,1.0,2.0};
+  CoordinateSet c(coords,types,radii, 4);
+  BOOST_CHECK_EQUAL(c.max_radius(), 2.0f);
+
+  CoordinateSet orig = c;
+  BOOST_CHECK_EQUAL(c.crop(make_float3(0,0,0), 20), 0);
+  BOOST_CHECK(c == orig); //nothing removed, nothing reallocated
+
+  BOOST_CHECK_EQUAL(c.crop(make_float3(0,1,0), 5), 2);
+  BOOST_CHECK_EQUAL(c.size(), 2);
+  BOOST_CHECK_EQUAL(c.num_types(), 4);
+  BOOST_CHECK_EQUAL(c.type_index(0), 3);
+  BOOST_CHECK_EQUAL(c.type_index(1), 1);
+  BOOST_CHECK_EQUAL(c.radii(1), 1.0f);
+  BOOST_CHECK_EQUAL(c.coords(1,1), 2.0f);
+  BOOST_CHECK_EQUAL(orig.size(), 4); //original storage untouched
+
+  //vector types
+  CoordinateSet v = orig.clone();
+  v.make_vector_types();
+  BOOST_CHECK_EQUAL(v.crop(make_float3(0,0,-5), 5), 2);
+  BOOST_CHECK_EQUAL(v.size(), 2);
+  BOOST_CHECK_EQUAL(v.type_vector.dimension(0), 2);
+  BOOST_CHECK_EQUAL(v.type_vector(0,3), 1.0f);
+  BOOST_CHECK_EQUAL(v.type_vector(1,0), 1.0f);
+  BOOST_CHECK_EQUAL(v.type_vector(1,3), 0.0f);
+}
@@ -6,6 +6,7 @@ except ImportError:
     from openbabel import pybel  #3.0
 
 import numpy as np
+import os
 
 from pytest import approx
 
@@ -102,4 +103,23 @@ def test_coordset_merge():
     assert np.all(coordsm == coords[:5])
     assert np.all(typesm == types[:5,:8])
     assert np.all(radiim == radii[:5])
-    
\ No newline at end of file
+    
+def test_read_coordinate_sets(capsys):
+    datadir = os.path.dirname(__file__)+'/data'
+    e = molgrid.ExampleProvider(data_root=datadir+"/structs")
+    e.populate(datadir+"/smallmol.types")
+    with capsys.disabled(): #openbabel warnings
+        exs = e.next_batch(e.size())
+        ligs = [c.src for ex in exs for c in ex.coord_sets[1:]]
+        sets = molgrid.read_coordinate_sets([datadir+"/structs/"+l for l in ligs], molgrid.defaultGninaLigandTyper, nthreads=4)
+
+    assert len(sets) == len(ligs)
+    for ex, c in zip(exs, sets):
+        lig = ex.coord_sets[1]
+        assert c.max_type == lig.max_type
+        assert np.array_equal(c.coords.tonumpy(), lig.coords.tonumpy())
+        assert np.array_equal(c.type_index.tonumpy(), lig.type_index.tonumpy())
+        assert np.array_equal(c.radii.tonumpy(), lig.radii.tonumpy())
+
+    with pytest.raises(ValueError):
+        molgrid.read_coordinate_sets([datadir+"/missing.sdf"], molgrid.defaultGninaLigandTyper)
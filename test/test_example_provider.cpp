@@ -0,0 +1,231 @@
+#define BOOST_TEST_MODULE example_provider_test
+#include <boost/test/unit_test.hpp>
+#include "test_util.h"
+#include "libmolgrid/exampleref_providers.h"
+#include "libmolgrid/example_provider.h"
+#include <boost/filesystem.hpp>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace libmolgrid;
+using namespace std;
+
+//all refs of provider in order
+static vector<ExampleRef> all_refs(ExampleRefProvider& provider) {
+  vector<ExampleRef> refs(provider.size());
+  for(ExampleRef& ref : refs) provider.nextref(ref);
+  return refs;
+}
+
+static void check_same_refs(const vector<ExampleRef>& a, const vector<ExampleRef>& b) {
+  BOOST_REQUIRE_EQUAL(a.size(), b.size());
+  for(unsigned i = 0, n = a.size(); i < n; i++) {
+    BOOST_REQUIRE_EQUAL(a[i].files.size(), b[i].files.size());
+    for(unsigned j = 0; j < a[i].files.size(); j++) {
+      BOOST_CHECK_EQUAL(string(a[i].files[j]), string(b[i].files[j]));
+    }
+    BOOST_CHECK_EQUAL_COLLECTIONS(a[i].labels.begin(), a[i].labels.end(), b[i].labels.begin(), b[i].labels.end());
+    BOOST_CHECK_EQUAL(a[i].group, b[i].group);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(parallel_parse_blocks) {
+  //lines of varying length, including one longer than a block and no final newline
+  stringstream text;
+  for(unsigned i = 0; i < 500; i++) {
+    text << (i % 2) << " " << i * 0.5 << " rec" << i % 7 << ".gninatypes lig" << i << string(i % 13, 'x') << ".gninatypes";
+    if(i == 250) text << " " << string(1000, 'y') << ".gninatypes";
+    if(i % 50 == 0) text << "\n   "; //blank line
+    if(i != 499) text << "\n";
+  }
+  string lines = text.str();
+
+  ExampleProviderSettings settings;
+  settings.num_parse_threads = 1;
+  UniformExampleRefProvider serial(settings);
+  stringstream in(lines);
+  BOOST_CHECK_EQUAL(serial.populate(in, 2), 500);
+  serial.setup();
+  vector<ExampleRef> expected = all_refs(serial);
+  BOOST_CHECK_EQUAL(expected[250].files.size(), 3);
+
+  //small chunks and blocks so lines straddle block boundaries and each block is split among threads
+  settings.num_parse_threads = 4;
+  for(size_t block : {64, 256, 1001, 4096}) {
+    UniformExampleRefProvider parallel(settings);
+    parallel.set_parse_sizes(128, block);
+    stringstream pin(lines);
+    BOOST_CHECK_EQUAL(parallel.populate(pin, 2), 500);
+    parallel.setup();
+    check_same_refs(expected, all_refs(parallel));
+  }
+
+  //a file, whose size is known, split across files parsed concurrently
+  boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  boost::filesystem::create_directories(dir);
+  size_t half = lines.find('\n', lines.size() / 2) + 1;
+  string fname1 = (dir / "a.types").string(), fname2 = (dir / "b.types").string();
+  ofstream(fname1) << lines.substr(0, half);
+  ofstream(fname2) << lines.substr(half);
+
+  UniformExampleRefProvider fromfile(settings);
+  fromfile.set_parse_sizes(128, 256);
+  BOOST_CHECK_EQUAL(fromfile.populate(fname1, 2), 251);
+  BOOST_CHECK_EQUAL(fromfile.populate(fname2, 2), 500);
+  fromfile.setup();
+  check_same_refs(expected, all_refs(fromfile));
+
+  UniformExampleRefProvider fromfiles(settings);
+  fromfiles.set_parse_sizes(128, 256);
+  BOOST_CHECK_EQUAL(fromfiles.populate(vector<string>{fname1, fname2}, 2), 500);
+  fromfiles.setup();
+  check_same_refs(expected, all_refs(fromfiles));
+
+  boost::filesystem::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(string_cache_concurrent) {
+  //threads intern overlapping ranges of names, each thread in a different order
+  const unsigned nthreads = 8, per_thread = 2000, stride = 500;
+  unsigned nnames = (nthreads - 1) * stride + per_thread;
+  vector<string> names(nnames);
+  for(unsigned i = 0; i < nnames; i++) names[i] = "lig" + to_string(i) + ".gninatypes";
+
+  StringCache cache;
+  vector<vector<const char*> > ptrs(nthreads, vector<const char*>(nnames, nullptr));
+  vector<unsigned> changed(nthreads, 0); //times a thread got a different pointer for a name
+  vector<thread> threads;
+  for(unsigned t = 0; t < nthreads; t++) {
+    threads.emplace_back([&, t]() {
+      for(unsigned rep = 0; rep < 3; rep++) {
+        for(unsigned k = 0; k < per_thread; k++) {
+          unsigned i = t * stride + (k * 7 + t + rep) % per_thread;
+          const char *p = cache.get(names[i]);
+          if(ptrs[t][i] && ptrs[t][i] != p) changed[t]++;
+          ptrs[t][i] = p;
+        }
+      }
+    });
+  }
+  for(thread& th : threads) th.join();
+  for(unsigned t = 0; t < nthreads; t++) BOOST_CHECK_EQUAL(changed[t], 0);
+
+  //every thread got the same pointer for a name, and it holds the name
+  vector<const char*> interned(nnames, nullptr);
+  for(unsigned i = 0; i < nnames; i++) {
+    const char *&p = interned[i];
+    for(unsigned t = 0; t < nthreads; t++) {
+      if(!ptrs[t][i]) continue;
+      if(!p) p = ptrs[t][i];
+      BOOST_CHECK_EQUAL((void*)ptrs[t][i], (void*)p);
+    }
+    BOOST_REQUIRE(p);
+    BOOST_CHECK_EQUAL(strcmp(p, names[i].c_str()), 0);
+  }
+
+  //counts match interning the same names from one thread; the names are short
+  //enough that each shard needs one arena, so memory doesn't depend on order
+  StringCache serial;
+  for(const string& name : names) serial.get(name);
+  BOOST_CHECK_EQUAL(cache.size(), nnames);
+  BOOST_CHECK_EQUAL(serial.size(), nnames);
+  BOOST_CHECK_EQUAL(cache.memory_usage(), serial.memory_usage());
+
+  //expected memory: each used shard has one 4096 byte arena and a power of two
+  //table (at least 64 slots) that is at most half full; shards are picked by
+  //the top 6 bits of the FNV-1a hash
+  vector<size_t> shard_count(64, 0);
+  for(const string& name : names) {
+    uint64_t h = 14695981039346656037ULL;
+    for(char c : name) {
+      h ^= (unsigned char)c;
+      h *= 1099511628211ULL;
+    }
+    shard_count[h >> 58]++;
+  }
+  size_t expected = 0;
+  for(size_t count : shard_count) {
+    if(count == 0) continue;
+    size_t slots = 64;
+    while(2 * count > slots) slots *= 2;
+    expected += 4096 + slots * (sizeof(uint64_t) + sizeof(const char*) + sizeof(size_t));
+  }
+  BOOST_CHECK_EQUAL(cache.memory_usage(), expected);
+
+  //interning again adds nothing
+  size_t memory = cache.memory_usage();
+  for(unsigned i = 0; i < nnames; i++) {
+    BOOST_CHECK_EQUAL((void*)cache.get(names[i]), (void*)interned[i]);
+  }
+  BOOST_CHECK_EQUAL(cache.size(), nnames);
+  BOOST_CHECK_EQUAL(cache.memory_usage(), memory);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_next_batch) {
+  //threads drawing batches together must get every example of an epoch exactly
+  //once; copies don't share prefetched batches, so they are only mixed without prefetching
+  boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  boost::filesystem::create_directories(dir);
+  {
+    ofstream mol((dir / "mol.gninatypes").string().c_str(), ios::binary);
+    float coords[3] = {1, 2, 3};
+    int type = 2; //carbon
+    mol.write((const char*)coords, sizeof(coords));
+    mol.write((const char*)&type, sizeof(type));
+  }
+  const unsigned nthreads = 4, nbatches = 10, batch_size = 5, N = nthreads * nbatches * batch_size;
+  string types = (dir / "all.types").string();
+  {
+    ofstream out(types.c_str());
+    for(unsigned i = 0; i < N; i++) out << i << " mol.gninatypes mol.gninatypes\n";
+  }
+
+  for(int prefetch : {0, 2}) {
+    ExampleProviderSettings settings;
+    settings.data_root = dir.string();
+    settings.shuffle = true;
+    settings.num_prefetch_threads = prefetch;
+    ExampleProvider provider(settings);
+    provider.populate(types);
+    ExampleProvider copy(provider); //shares the ref provider
+
+    //without prefetching, half the threads use the copy; the last thread draws
+    //single examples, which stops prefetching while others wait on batches
+    vector<vector<float> > labels(nthreads);
+    vector<thread> threads;
+    for(unsigned t = 0; t < nthreads; t++) {
+      threads.emplace_back([&, t]() {
+        ExampleProvider& p = prefetch == 0 && t % 2 ? copy : provider;
+        for(unsigned b = 0; b < nbatches; b++) {
+          vector<Example> batch;
+          if(t == nthreads - 1) {
+            batch.resize(batch_size);
+            for(Example& ex : batch) p.next(ex);
+          } else {
+            batch = p.next_batch(batch_size);
+          }
+          for(const Example& ex : batch) {
+            labels[t].push_back(ex.labels[0]);
+            if(ex.sets.size() != 2 || ex.sets[1].size() != 1) labels[t].push_back(-1);
+          }
+        }
+      });
+    }
+    for(thread& th : threads) th.join();
+
+    set<float> seen;
+    for(const vector<float>& l : labels) {
+      BOOST_CHECK_EQUAL(l.size(), nbatches * batch_size);
+      seen.insert(l.begin(), l.end());
+    }
+    BOOST_CHECK_EQUAL(seen.size(), N);
+    BOOST_CHECK_EQUAL(*seen.begin(), 0);
+    BOOST_CHECK_EQUAL(*seen.rbegin(), N - 1);
+  }
+  boost::filesystem::remove_all(dir);
+}
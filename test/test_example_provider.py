@@ -2,6 +2,8 @@ import pytest
 import molgrid
 import numpy as np
 import os
+import struct
+import threading
 
 from pytest import approx
 from numpy import around
@@ -138,6 +140,349 @@ def test_cached_example_provider():
     assert clig.radii[9] == approx(1.8)        
     assert list(clig.type_index) == [8.0, 1.0, 1.0, 9.0, 10.0, 0.0, 0.0, 1.0, 9.0, 8.0]
 
+def test_mapped_typer_cached_example_provider():
+    fname = datadir+"/small.types"
+    t = molgrid.SubsettedGninaTyper([[2,3],[4,5],[6,7,8,9],[10,11,12,13]])
+    e = molgrid.ExampleProvider(t, t, data_root=datadir+"/structs")
+    ce = molgrid.ExampleProvider(t, t, ligmolcache=datadir+'/lig.molcache2',recmolcache=datadir+'/rec.molcache2')
+    e.populate(fname)
+    ce.populate(fname)
+    for ex, cex in zip(e.next_batch(50), ce.next_batch(50)):
+        for c, cc in zip(ex.coord_sets, cex.coord_sets):
+            assert c.max_type == cc.max_type == 5
+            assert np.array_equal(c.type_index.tonumpy(), cc.type_index.tonumpy())
+            assert np.array_equal(c.radii.tonumpy(), cc.radii.tonumpy())
+
+def test_indexed_molcache2_example_provider(tmpdir):
+    fname = datadir+"/small.types"
+    for cache in ['rec.molcache2', 'lig.molcache2']:
+        tmpdir.join(cache).write_binary(open(datadir+'/'+cache,'rb').read())
+    recfile = str(tmpdir.join('rec.molcache2'))
+    ligfile = str(tmpdir.join('lig.molcache2'))
+
+    def load():
+        e = molgrid.ExampleProvider(recmolcache=recfile, ligmolcache=ligfile)
+        e.populate(fname)
+        return e.next_batch(e.size())
+
+    exs = load()
+    assert molgrid.create_molcache2_index(recfile) == 60
+    assert molgrid.create_molcache2_index(ligfile) == 1000
+    assert tmpdir.join('lig.molcache2.index').check()
+    iexs = load()
+    for ex, iex in zip(exs, iexs):
+        for c, ic in zip(ex.coord_sets, iex.coord_sets):
+            assert c.size() > 0
+            assert np.array_equal(c.coords.tonumpy(), ic.coords.tonumpy())
+            assert np.array_equal(c.type_index.tonumpy(), ic.type_index.tonumpy())
+
+def test_duplicate_molcache2_example_provider(tmpdir):
+    #molcache2 file where lig.gninatypes appears twice; the last record is used
+    def molcache2(mols):
+        body, trailer, pos = b'', b'', 12
+        for name, atoms in mols:
+            block = struct.pack('<I', len(atoms)) + b''.join(struct.pack('<fffi', x, y, z, 2) for (x, y, z) in atoms)
+            trailer += struct.pack('<B', len(name)) + name.encode() + struct.pack('<Q', pos)
+            body += block
+            pos += len(block)
+        return struct.pack('<iQ', -1, pos) + body + trailer
+
+    mols = [('rec.gninatypes', [(0, 0, 0)]), ('lig.gninatypes', [(1, 0, 0)]),
+            ('lig.gninatypes', [(1, 0, 0), (2, 0, 0), (3, 0, 0)])]
+    cache = tmpdir.join('dup.molcache2')
+    cache.write_binary(molcache2(mols))
+    fname = tmpdir.join('dup.types')
+    fname.write('1 rec.gninatypes lig.gninatypes\n')
+
+    def load():
+        e = molgrid.ExampleProvider(recmolcache=str(cache), ligmolcache=str(cache))
+        e.populate(str(fname))
+        return e.next()
+
+    ex = load()
+    assert ex.coord_sets[0].size() == 1
+    assert ex.coord_sets[1].size() == 3
+    assert molgrid.create_molcache2_index(str(cache)) == 2
+    ex = load()
+    assert ex.coord_sets[1].size() == 3
+
+    #records pointing past the end of the file are errors, not out of bounds reads
+    data = bytearray(molcache2(mols))
+    data[-8:] = struct.pack('<Q', len(data) - 2)
+    cache.write_binary(bytes(data))
+    with pytest.raises(ValueError):
+        load()
+
+@pytest.mark.parametrize("load", ["none", "willneed", "populate", "hugepages"])
+def test_molcache_load_example_provider(load):
+    fname = datadir+"/small.types"
+    e = molgrid.ExampleProvider(ligmolcache=datadir+'/lig.molcache2',recmolcache=datadir+'/rec.molcache2')
+    e.populate(fname)
+    le = molgrid.ExampleProvider(ligmolcache=datadir+'/lig.molcache2',recmolcache=datadir+'/rec.molcache2',molcache_load=load)
+    le.populate(fname)
+    for ex, lex in zip(e.next_batch(e.size()), le.next_batch(le.size())):
+        for c, lc in zip(ex.coord_sets, lex.coord_sets):
+            assert np.array_equal(c.coords.tonumpy(), lc.coords.tonumpy())
+
+    with pytest.raises(ValueError):
+        molgrid.ExampleProvider(ligmolcache=datadir+'/lig.molcache2',molcache_load='bogus')
+
+def test_cropped_example_provider():
+    fname = datadir+"/small.types"
+    e = molgrid.ExampleProvider(ligmolcache=datadir+'/lig.molcache2',recmolcache=datadir+'/rec.molcache2')
+    e.populate(fname)
+    gmaker = molgrid.GridMaker()
+    ce = molgrid.ExampleProvider(ligmolcache=datadir+'/lig.molcache2',recmolcache=datadir+'/rec.molcache2',
+                                 crop_dimension=gmaker.get_dimension())
+    ce.populate(fname)
+
+    batch = e.next_batch(10)
+    cbatch = ce.next_batch(10)
+    dims = gmaker.grid_dimensions(e.type_size())
+    grid = molgrid.MGrid4f(*dims)
+    cgrid = molgrid.MGrid4f(*dims)
+    for ex, cex in zip(batch, cbatch):
+        #receptor is cropped, ligand is not
+        assert cex.coord_sets[0].size() < ex.coord_sets[0].size()
+        assert cex.coord_sets[1].size() == ex.coord_sets[1].size()
+        gmaker.forward(ex, grid.cpu(), 0, False)
+        gmaker.forward(cex, cgrid.cpu(), 0, False)
+        assert np.array_equal(grid.tonumpy(), cgrid.tonumpy())
+
+def test_molcache3_example_provider(tmpdir):
+    fname = datadir+"/small.types"
+    e = molgrid.ExampleProvider(data_root=datadir+"/structs")
+    e.populate(fname)
+    exs = e.next_batch(e.size())
+
+    recfile = str(tmpdir.join("rec.molcache3"))
+    ligfile = str(tmpdir.join("lig.molcache3"))
+    recw = molgrid.MolCache3Writer(recfile, molgrid.defaultGninaReceptorTyper)
+    ligw = molgrid.MolCache3Writer(ligfile, molgrid.defaultGninaLigandTyper)
+    for ex in exs:
+        recw.add(ex.coord_sets[0].src, ex.coord_sets[0])
+        ligw.add(ex.coord_sets[1].src, ex.coord_sets[1])
+    recw.close()
+    ligw.close()
+
+    ce = molgrid.ExampleProvider(recmolcache=recfile, ligmolcache=ligfile)
+    ce.populate(fname)
+    cexs = ce.next_batch(ce.size())
+    for ex, cex in zip(exs, cexs):
+        for c, cc in zip(ex.coord_sets, cex.coord_sets):
+            assert c.src == cc.src
+            assert c.max_type == cc.max_type
+            assert np.array_equal(c.coords.tonumpy(), cc.coords.tonumpy())
+            assert np.array_equal(c.type_index.tonumpy(), cc.type_index.tonumpy())
+            assert np.array_equal(c.radii.tonumpy(), cc.radii.tonumpy())
+
+    # files record the typer they were created with
+    with pytest.raises(ValueError):
+        molgrid.ExampleProvider(molgrid.ElementIndexTyper(), recmolcache=recfile)
+
+    # a molecule block that runs past the end of the file is an error, not an out of bounds read
+    data = bytearray(tmpdir.join("lig.molcache3").read_binary())
+    data[64:68] = struct.pack('I', 0xfffffff0) # natoms of first block
+    badfile = tmpdir.join("bad.molcache3")
+    badfile.write_binary(bytes(data))
+    be = molgrid.ExampleProvider(recmolcache=recfile, ligmolcache=str(badfile))
+    be.populate(fname)
+    with pytest.raises(ValueError):
+        be.next_batch(be.size())
+
+def test_struct_cache_example_provider(tmpdir, capsys):
+    fname = datadir+"/smallmol.types"
+    cachedir = tmpdir.join("structs")
+    exs = []
+    for i in range(2):
+        e = molgrid.ExampleProvider(data_root=datadir+"/structs", struct_cache_dir=str(cachedir))
+        e.populate(fname)
+        with capsys.disabled():
+            exs.append(e.next_batch(e.size()))
+        # every distinct molecule file has an entry after the first pass
+        assert len(cachedir.visit('*.lmgset')) == len(set(c.src for ex in exs[0] for c in ex.coord_sets))
+
+    for ex, cex in zip(*exs):
+        for c, cc in zip(ex.coord_sets, cex.coord_sets):
+            assert c.src == cc.src
+            assert c.max_type == cc.max_type
+            assert np.array_equal(c.coords.tonumpy(), cc.coords.tonumpy())
+            assert np.array_equal(c.type_index.tonumpy(), cc.type_index.tonumpy())
+            assert np.array_equal(c.radii.tonumpy(), cc.radii.tonumpy())
+
+    # entries are specific to the typer
+    e = molgrid.ExampleProvider(molgrid.ElementIndexTyper(), data_root=datadir+"/structs", struct_cache_dir=str(cachedir))
+    e.populate(fname)
+    with capsys.disabled():
+        e.next_batch(e.size())
+    assert len(cachedir.visit('*.lmgset')) == 2*len(set(c.src for ex in exs[0] for c in ex.coord_sets))
+
+    # corrupt or truncated entries are misses, not errors
+    for i, entry in enumerate(cachedir.visit('*.lmgset')):
+        if i % 2:
+            entry.write_binary(entry.read_binary()[:-4])
+        else:
+            with open(str(entry), 'r+b') as f:
+                f.seek(16)  # natoms
+                f.write(struct.pack('<Q', 1 << 60))
+    e = molgrid.ExampleProvider(data_root=datadir+"/structs", struct_cache_dir=str(cachedir))
+    e.populate(fname)
+    with capsys.disabled():
+        ex2 = e.next_batch(e.size())
+    for ex, cex in zip(exs[0], ex2):
+        for c, cc in zip(ex.coord_sets, cex.coord_sets):
+            assert np.array_equal(c.coords.tonumpy(), cc.coords.tonumpy())
+            assert np.array_equal(c.type_index.tonumpy(), cc.type_index.tonumpy())
+
+def test_parallel_parse_example_provider():
+    fnames = [datadir+"/small.types", datadir+"/smallmol.types", datadir+"/small.types"]
+    refs = []
+    for nthreads in [1, 4]:
+        e = molgrid.ExampleProvider(data_root=datadir+"/structs", num_parse_threads=nthreads)
+        e.populate(fnames)
+        refs.append([(tuple(ex.labels), tuple(c.src for c in ex.coord_sets)) for ex in e.next_batch(e.size())])
+    assert len(refs[0]) > 2000
+    assert refs[0] == refs[1]
+
+def test_string_cache_memory(tmpdir):
+    fname = tmpdir.join("names.types")
+    fname.write(''.join('1 %d %s/lig.gninatypes\n' % (i, 'x'*200+str(i)) for i in range(2000)))
+    before = molgrid.string_cache_memory_usage()
+    e = molgrid.ExampleProvider(num_parse_threads=4)
+    e.populate(str(fname))
+    assert e.size() == 2000
+    assert molgrid.string_cache_memory_usage() >= before + 2000*200
+
+def test_streaming_example_provider():
+    fname = datadir+"/small.types"
+    batches = []
+    for stream in [False, True]:
+        molgrid.set_random_seed(0)
+        e = molgrid.ExampleProvider(data_root=datadir+"/structs", shuffle=True, stream_examples=stream)
+        e.populate([fname, fname])
+        assert e.size() == 2000
+        assert e.num_labels() == 3
+        batches.append(e.next_batch(2010))
+
+    for ex, sex in zip(*batches):
+        assert list(ex.labels) == approx(list(sex.labels))
+        assert [c.src for c in ex.coord_sets] == [c.src for c in sex.coord_sets]
+
+    with pytest.raises(ValueError):
+        molgrid.ExampleProvider(stream_examples=True, balanced=True)
+
+def test_prefetch_example_provider():
+    fname = datadir+"/small.types"
+    batches = []
+    for nthreads in [0, 2]:
+        molgrid.set_random_seed(0)
+        e = molgrid.ExampleProvider(data_root=datadir+"/structs", shuffle=True, num_prefetch_threads=nthreads)
+        e.populate(fname)
+        exs = []
+        for _ in range(5):
+            exs += e.next_batch(16)
+        e.skip(3)
+        exs.append(e.next())
+        exs += e.next_batch(10)
+        batches.append(exs)
+
+    for ex, pex in zip(*batches):
+        assert list(ex.labels) == approx(list(pex.labels))
+        for c, pc in zip(ex.coord_sets, pex.coord_sets):
+            assert c.size() == pc.size()
+            assert np.array_equal(c.coords.tonumpy(), pc.coords.tonumpy())
+
+def test_prefetch_callback_typer():
+    def mytyper(atom):
+        return (atom.GetAtomicNum(), 2.0)
+    t = molgrid.PythonCallbackIndexTyper(mytyper, 16)
+    molgrid.ExampleProvider(t, data_root=datadir+"/structs")
+    # python can't be called from the prefetch threads
+    with pytest.raises(ValueError):
+        molgrid.ExampleProvider(t, data_root=datadir+"/structs", num_prefetch_threads=2)
+
+def test_threaded_example_provider():
+    fname = datadir+"/small.types"
+    e = molgrid.ExampleProvider(data_root=datadir+"/structs")
+    e.populate(fname)
+    n = e.size()
+    # a single pass over the examples from several threads sees every example once
+    srcs = []
+    def load():
+        for _ in range(n//40):
+            srcs.extend(tuple(c.src for c in ex.coord_sets) for ex in e.next_batch(10))
+    threads = [threading.Thread(target=load) for _ in range(4)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    e = molgrid.ExampleProvider(data_root=datadir+"/structs")
+    e.populate(fname)
+    expected = [tuple(c.src for c in ex.coord_sets) for ex in e.next_batch(n)]
+    assert sorted(srcs) == sorted(expected)
+
+def test_duplicate_first_example_provider(tmpdir):
+    #the receptor is paired with each ligand
+    def write_gninatypes(name, coords):
+        with open(str(tmpdir.join(name)), 'wb') as f:
+            for (x, y, z) in coords:
+                f.write(struct.pack('fffi', x, y, z, 2))
+    write_gninatypes('rec.gninatypes', [(0, 0, 0), (2, 0, 0), (0, 2, 0), (0, 0, 2)])
+    write_gninatypes('lig1.gninatypes', [(1, 1, 1)])
+    write_gninatypes('lig2.gninatypes', [(3, 3, 3), (4, 3, 3)])
+    fname = tmpdir.join('dup.types')
+    fname.write('1 rec.gninatypes lig1.gninatypes lig2.gninatypes\n')
+
+    e = molgrid.ExampleProvider(data_root=str(tmpdir))
+    e.populate(str(fname))
+    ex = e.next()
+    assert len(ex.coord_sets) == 3
+
+    e = molgrid.ExampleProvider(data_root=str(tmpdir), duplicate_first=True)
+    e.populate(str(fname))
+    ex = e.next()
+    assert len(ex.coord_sets) == 4
+    assert [c.size() for c in ex.coord_sets] == [4, 1, 4, 2]
+    assert np.array_equal(ex.coord_sets[0].coords.tonumpy(), ex.coord_sets[2].coords.tonumpy())
+    assert ex.coord_sets[1].coords.tonumpy().tolist() == [[1, 1, 1]]
+    assert ex.coord_sets[3].coords.tonumpy().tolist() == [[3, 3, 3], [4, 3, 3]]
+
+def test_cropped_duplicate_example_provider(tmpdir):
+    #receptor spanning two ligands that are far apart
+    def write_gninatypes(name, coords):
+        with open(str(tmpdir.join(name)), 'wb') as f:
+            for (x, y, z) in coords:
+                f.write(struct.pack('fffi', x, y, z, 2))
+    rng = np.arange(-10, 10.1, 2.5)
+    write_gninatypes('rec.gninatypes', [(x, y, z) for x in np.arange(-10, 60.1, 2.5) for y in rng for z in rng])
+    write_gninatypes('lig1.gninatypes', [(0, 0, 0), (1.5, 0, 0), (1.5, 1.5, 0)])
+    write_gninatypes('lig2.gninatypes', [(50, 0, 0), (51.5, 0, 0), (51.5, 0, 1.5)])
+    fname = tmpdir.join('dup.types')
+    fname.write('1 rec.gninatypes lig1.gninatypes lig2.gninatypes\n')
+
+    gmaker = molgrid.GridMaker()
+    e = molgrid.ExampleProvider(data_root=str(tmpdir), duplicate_first=True)
+    e.populate(str(fname))
+    ce = molgrid.ExampleProvider(data_root=str(tmpdir), duplicate_first=True, crop_dimension=gmaker.get_dimension())
+    ce.populate(str(fname))
+    ex = e.next()
+    cex = ce.next()
+    assert len(ex.coord_sets) == 4 and len(cex.coord_sets) == 4
+
+    ntypes = ex.coord_sets[0].num_types() + ex.coord_sets[1].num_types()
+    grid = molgrid.MGrid4f(*gmaker.grid_dimensions(ntypes))
+    cgrid = molgrid.MGrid4f(*gmaker.grid_dimensions(ntypes))
+    for i in range(2):
+        rec, lig = ex.coord_sets[2*i], ex.coord_sets[2*i+1]
+        crec, clig = cex.coord_sets[2*i], cex.coord_sets[2*i+1]
+        assert crec.size() < rec.size()
+        assert clig.size() == lig.size()
+        gmaker.forward(lig.center(), molgrid.CoordinateSet(rec, lig), grid.cpu())
+        gmaker.forward(clig.center(), molgrid.CoordinateSet(crec, clig), cgrid.cpu())
+        assert grid.tonumpy().sum() > 0
+        assert np.array_equal(grid.tonumpy(), cgrid.tonumpy())
+
 def test_grouped_example_provider():
     fname = datadir+"/grouped.types"
     batch_size = 3
@@ -85,6 +85,190 @@ BOOST_AUTO_TEST_CASE(forward_cpu) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(forward_cpu_threads) {
+  //multithreaded forward must exactly reproduce the single threaded grid
+  size_t natoms = 500;
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 12, 12, 12);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+
+  GridMaker gmaker(0.5, 23.5);
+  float3 center = make_float3(0, 0, 0);
+  float3 dims = gmaker.get_grid_dims();
+  MGrid4f serial(ntypes, dims.x, dims.y, dims.z);
+  MGrid4f threaded(ntypes, dims.x, dims.y, dims.z);
+
+  gmaker.forward(center, c, serial.cpu());
+  gmaker.set_num_threads(4);
+  gmaker.forward(center, c, threaded.cpu());
+  BOOST_CHECK(std::equal(serial.data(), serial.data() + serial.size(), threaded.data()));
+
+  //same for vector types
+  c.make_vector_types();
+  gmaker.set_num_threads(1);
+  gmaker.forward(center, c.coords.cpu(), c.type_vector.cpu(), c.radii.cpu(), serial.cpu());
+  gmaker.set_num_threads(3);
+  gmaker.forward(center, c.coords.cpu(), c.type_vector.cpu(), c.radii.cpu(), threaded.cpu());
+  BOOST_CHECK(std::equal(serial.data(), serial.data() + serial.size(), threaded.data()));
+}
+
+BOOST_AUTO_TEST_CASE(calc_row_cpu) {
+  //vectorized row densities must agree with the scalar point calculation
+  GridMaker gmaker(0.5, 12, false, 1.0, 1.5);
+  float3 origin = gmaker.get_grid_origin(make_float3(0, 0, 0));
+  unsigned dim = gmaker.get_first_dim();
+  std::uniform_real_distribution<float> coord_dist(-4, 4);
+  std::uniform_real_distribution<float> radius_dist(0.9, 2.0);
+  std::vector<float> vals(dim);
+
+  for (unsigned t = 0; t < 100; t++) {
+    float ax = coord_dist(random_engine), ay = coord_dist(random_engine), az = coord_dist(random_engine);
+    float ar = radius_dist(random_engine);
+    unsigned i = t % dim, j = (t * 7) % dim;
+    unsigned kbegin = t % 5, n = dim - kbegin - t % 3; //exercise partial vectors
+    float3 pt = make_float3(origin.x + i * 0.5, origin.y + j * 0.5, 0);
+    float dx = pt.x - ax, dy = pt.y - ay;
+    gmaker.calc_row_cpu(az, ar, dx * dx + dy * dy, origin.z, kbegin, n, vals.data());
+    for (unsigned k = 0; k < n; k++) {
+      pt.z = origin.z + (kbegin + k) * 0.5;
+      float expected = gmaker.calc_point<false>(ax, ay, az, ar, pt);
+      BOOST_CHECK_SMALL(vals[k] - expected, 1e-5f);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(cell_list) {
+  //gridding small boxes of a large system with a cell list must match gridding all atoms
+  size_t natoms = 3000;
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 30, 30, 30);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+  CellList cells(c, 3.0);
+  BOOST_CHECK_EQUAL(cells.num_atoms(), natoms);
+
+  //every atom inside a box must be returned, in order
+  std::vector<unsigned> found;
+  float3 lo = make_float3(-5, 2, -11), hi = make_float3(4, 9, -3);
+  cells.query(lo, hi, found);
+  BOOST_CHECK(std::is_sorted(found.begin(), found.end()));
+  BOOST_CHECK_LT(found.size(), natoms / 4);
+  for (unsigned i = 0; i < natoms; i++) {
+    if (coords(i, 0) >= lo.x && coords(i, 0) <= hi.x && coords(i, 1) >= lo.y && coords(i, 1) <= hi.y &&
+        coords(i, 2) >= lo.z && coords(i, 2) <= hi.z) {
+      BOOST_CHECK(std::binary_search(found.begin(), found.end(), i));
+    }
+  }
+  cells.query(make_float3(100, 100, 100), make_float3(110, 110, 110), found);
+  BOOST_CHECK_EQUAL(found.size(), 0);
+
+  GridMaker gmaker(0.5, 8);
+  float3 dims = gmaker.get_grid_dims();
+  MGrid4f all(ntypes, dims.x, dims.y, dims.z);
+  MGrid4f near(ntypes, dims.x, dims.y, dims.z);
+  MGrid4f diff(ntypes, dims.x, dims.y, dims.z);
+  for (size_t i = 0; i < diff.size(); i++) diff.data()[i] = sin(i * 0.37);
+  MGrid2f grad_all(natoms, 3), grad_near(natoms, 3);
+  MGrid1f rel_all(natoms), rel_near(natoms);
+
+  std::vector<float3> centers = {make_float3(0, 0, 0), make_float3(27, -12, 5), make_float3(50, 50, 50)};
+  for (float3 center : centers) {
+    gmaker.forward(center, c, all.cpu());
+    gmaker.forward(center, c, cells, near.cpu());
+    BOOST_CHECK(std::equal(all.data(), all.data() + all.size(), near.data()));
+
+    gmaker.backward(center, c, diff.cpu(), grad_all.cpu());
+    gmaker.backward(center, c, cells, diff.cpu(), grad_near.cpu());
+    BOOST_CHECK(std::equal(grad_all.data(), grad_all.data() + grad_all.size(), grad_near.data()));
+
+    gmaker.backward_relevance(center, c, all.cpu(), diff.cpu(), rel_all.cpu());
+    gmaker.backward_relevance(center, c, cells, all.cpu(), diff.cpu(), rel_near.cpu());
+    BOOST_CHECK(std::equal(rel_all.data(), rel_all.data() + rel_all.size(), rel_near.data()));
+  }
+
+  //vector types
+  CoordinateSet cv = c.clone();
+  cv.make_vector_types();
+  MGrid2f tgrad_all(natoms, ntypes), tgrad_near(natoms, ntypes);
+  gmaker.forward(centers[1], cv, all.cpu());
+  gmaker.forward(centers[1], cv, cells, near.cpu());
+  BOOST_CHECK(std::equal(all.data(), all.data() + all.size(), near.data()));
+  gmaker.backward(centers[1], cv, diff.cpu(), grad_all.cpu(), tgrad_all.cpu());
+  gmaker.backward(centers[1], cv, cells, diff.cpu(), grad_near.cpu(), tgrad_near.cpu());
+  BOOST_CHECK(std::equal(grad_all.data(), grad_all.data() + grad_all.size(), grad_near.data()));
+  BOOST_CHECK(std::equal(tgrad_all.data(), tgrad_all.data() + tgrad_all.size(), tgrad_near.data()));
+
+  //cell list must match the coordinates
+  CellList empty;
+  BOOST_CHECK_THROW(gmaker.forward(centers[0], c, empty, near.cpu()), std::invalid_argument);
+
+  //non-finite atoms are never returned and a distant outlier doesn't break the cells
+  coords(0, 0) = NAN;
+  coords(1, 1) = INFINITY;
+  coords(2, 2) = 1e30;
+  CoordinateSet odd(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+  CellList oddcells(odd, 3.0);
+  BOOST_CHECK_EQUAL(oddcells.num_atoms(), natoms);
+  oddcells.query(lo, hi, found);
+  BOOST_CHECK(!std::binary_search(found.begin(), found.end(), 0U));
+  BOOST_CHECK(!std::binary_search(found.begin(), found.end(), 1U));
+  for (unsigned i = 3; i < natoms; i++) {
+    if (coords(i, 0) >= lo.x && coords(i, 0) <= hi.x && coords(i, 1) >= lo.y && coords(i, 1) <= hi.y &&
+        coords(i, 2) >= lo.z && coords(i, 2) <= hi.z) {
+      BOOST_CHECK(std::binary_search(found.begin(), found.end(), i));
+    }
+  }
+  oddcells.query(make_float3(-1e38, -1e38, -1e38), make_float3(1e38, 1e38, 1e38), found);
+  BOOST_CHECK_EQUAL(found.size(), natoms - 2);
+  oddcells.query(make_float3(NAN, 0, 0), make_float3(1, 1, 1), found);
+  BOOST_CHECK_EQUAL(found.size(), 0);
+
+  //types of atoms far from the grid are still checked
+  coords(3, 0) = 1000;
+  type_indices(3) = ntypes + 5;
+  CoordinateSet badtype(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes + 6);
+  CellList badcells(badtype, 3.0);
+  BOOST_CHECK_THROW(gmaker.forward(centers[0], badtype, badcells, near.cpu()), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(forward_batch_cpu) {
+  //threaded gridding of a batch must match gridding the examples one at a time
+  unsigned ntypes = GninaIndexTyper::NumTypes;
+  std::vector<Example> batch(5);
+  for (Example& ex : batch) {
+    for (unsigned s = 0; s < 2; s++) {
+      size_t natoms = 50 * (s + 1);
+      MGrid2f coords(natoms, 3);
+      MGrid1f type_indices(natoms);
+      MGrid1f radii(natoms);
+      make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 8, 8, 8);
+      ex.sets.push_back(CoordinateSet(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes));
+    }
+  }
+
+  GridMaker gmaker(0.5, 16);
+  float3 dims = gmaker.get_grid_dims();
+  MGrid5f serial(batch.size(), 2 * ntypes, dims.x, dims.y, dims.z);
+  MGrid5f batched(batch.size(), 2 * ntypes, dims.x, dims.y, dims.z);
+
+  random_engine.seed(0);
+  for (unsigned i = 0; i < batch.size(); i++) {
+    Grid4f g(serial.cpu()[i]);
+    gmaker.forward(batch[i], g, 2.0, true);
+  }
+
+  random_engine.seed(0);
+  gmaker.set_num_threads(3);
+  Grid5f bgrid(batched.cpu());
+  gmaker.forward<float, false>(batch, bgrid, 2.0, true);
+  BOOST_CHECK(std::equal(serial.data(), serial.data() + serial.size(), batched.data()));
+}
+
 //boost assert equality between to sets of coordinates
 static void same_coords(MGrid2f& a, MGrid2f& b) {
   BOOST_CHECK_EQUAL(a.dimension(0),b.dimension(0));
@@ -224,3 +408,245 @@ BOOST_AUTO_TEST_CASE(backward_vec) {
   BOOST_CHECK_EQUAL(cputypes[0][1],0);
 }
 
+
+BOOST_AUTO_TEST_CASE(backward_cpu_threads) {
+  //multithreaded backward must exactly reproduce single threaded gradients, and
+  //the fused type vector gradients must match the index and per point calculations
+  size_t natoms = 200;
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 8, 8, 8);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+
+  GridMaker gmaker(0.5, 12);
+  float3 center = make_float3(0, 0, 0);
+  float3 dims = gmaker.get_grid_dims();
+  MGrid4f diff(ntypes, dims.x, dims.y, dims.z);
+  std::uniform_real_distribution<float> diff_dist(-1, 1);
+  for (size_t i = 0; i < diff.size(); i++) {
+    diff.data()[i] = diff_dist(random_engine);
+  }
+
+  MGrid2f serial(natoms, 3);
+  MGrid2f threaded(natoms, 3);
+  gmaker.backward(center, c, diff.cpu(), serial.cpu());
+  gmaker.set_num_threads(4);
+  gmaker.backward(center, c, diff.cpu(), threaded.cpu());
+  BOOST_CHECK(std::equal(serial.data(), serial.data() + serial.size(), threaded.data()));
+
+  c.make_vector_types();
+  MGrid2f vserial(natoms, 3);
+  MGrid2f tserial(natoms, ntypes);
+  MGrid2f tthreaded(natoms, ntypes);
+  gmaker.set_num_threads(1);
+  gmaker.backward(center, c, diff.cpu(), vserial.cpu(), tserial.cpu());
+  gmaker.set_num_threads(3);
+  gmaker.backward(center, c, diff.cpu(), threaded.cpu(), tthreaded.cpu());
+  BOOST_CHECK(std::equal(vserial.data(), vserial.data() + vserial.size(), threaded.data()));
+  BOOST_CHECK(std::equal(tserial.data(), tserial.data() + tserial.size(), tthreaded.data()));
+
+  float3 origin = gmaker.get_grid_origin(center);
+  unsigned dim = gmaker.get_first_dim();
+  for (size_t a = 0; a < natoms; a++) {
+    for (unsigned d = 0; d < 3; d++) {
+      BOOST_CHECK_SMALL(vserial(a, d) - serial(a, d), 1e-4f);
+    }
+    if (a % 20) continue;
+    //spot check type gradients by brute force
+    float ax = coords(a, 0), ay = coords(a, 1), az = coords(a, 2);
+    for (unsigned t = 0; t < ntypes; t += 5) {
+      float expected = 0;
+      for (unsigned i = 0; i < dim; i++)
+        for (unsigned j = 0; j < dim; j++)
+          for (unsigned k = 0; k < dim; k++) {
+            float3 pt = make_float3(origin.x + i * 0.5, origin.y + j * 0.5, origin.z + k * 0.5);
+            expected += gmaker.calc_point<false>(ax, ay, az, radii(a), pt) * diff(t, i, j, k);
+          }
+      BOOST_CHECK_SMALL(tserial(a, t) - expected, 1e-3f);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(footprints) {
+  //forward recording footprints must produce the same grid, and backward from
+  //footprints must agree with recomputing the densities
+  size_t natoms = 150;
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 10, 10, 10);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+  CoordinateSet vc = c.clone();
+  vc.make_vector_types();
+
+  float3 center = make_float3(1, -1, 0.5);
+  AtomFootprints fp;
+  for (bool binary : {false, true}) {
+    GridMaker gmaker(0.5, 12, binary);
+    gmaker.set_num_threads(2);
+    float3 dims = gmaker.get_grid_dims();
+    MGrid4f expected(ntypes, dims.x, dims.y, dims.z);
+    MGrid4f out(ntypes, dims.x, dims.y, dims.z);
+
+    gmaker.forward(center, c, expected.cpu());
+    gmaker.forward(center, c, fp, out.cpu());
+    BOOST_CHECK(std::equal(expected.data(), expected.data() + expected.size(), out.data()));
+    BOOST_CHECK_EQUAL(fp.num_atoms(), natoms);
+    BOOST_CHECK_GT(fp.num_footprints(), 0);
+    BOOST_CHECK_LT(fp.num_footprints(), natoms); //some atoms are outside the grid
+
+    gmaker.forward(center, vc, expected.cpu());
+    gmaker.forward(center, vc, fp, out.cpu());
+    BOOST_CHECK(std::equal(expected.data(), expected.data() + expected.size(), out.data()));
+    if (binary) continue; //binary gradients are not meaningful
+
+    MGrid4f diff(ntypes, dims.x, dims.y, dims.z);
+    std::uniform_real_distribution<float> diff_dist(-1, 1);
+    for (size_t i = 0; i < diff.size(); i++) {
+      diff.data()[i] = diff_dist(random_engine);
+    }
+
+    MGrid2f agrad(natoms, 3), fagrad(natoms, 3);
+    MGrid2f tgrad(natoms, ntypes), ftgrad(natoms, ntypes);
+    gmaker.backward(center, vc, diff.cpu(), agrad.cpu(), tgrad.cpu());
+    gmaker.backward(center, vc, fp, diff.cpu(), fagrad.cpu(), ftgrad.cpu());
+    for (size_t i = 0; i < agrad.size(); i++) {
+      BOOST_CHECK_SMALL(agrad.data()[i] - fagrad.data()[i], 1e-3f);
+    }
+    for (size_t i = 0; i < tgrad.size(); i++) {
+      BOOST_CHECK_SMALL(tgrad.data()[i] - ftgrad.data()[i], 1e-3f);
+    }
+
+    gmaker.forward(center, c, fp, out.cpu());
+    gmaker.backward(center, c, diff.cpu(), agrad.cpu());
+    gmaker.backward(center, c, fp, diff.cpu(), fagrad.cpu());
+    for (size_t i = 0; i < agrad.size(); i++) {
+      BOOST_CHECK_SMALL(agrad.data()[i] - fagrad.data()[i], 1e-3f);
+    }
+
+    MGrid1f relevance(natoms), frelevance(natoms);
+    gmaker.backward_relevance(center, c, out.cpu(), diff.cpu(), relevance.cpu());
+    gmaker.backward_relevance(center, c, fp, out.cpu(), diff.cpu(), frelevance.cpu());
+    for (size_t i = 0; i < natoms; i++) {
+      BOOST_CHECK_SMALL(relevance[i] - frelevance[i], 1e-3f);
+    }
+
+    //footprints are only valid for the grid they were recorded on
+    BOOST_CHECK_THROW(gmaker.backward(make_float3(0, 0, 0), c, fp, diff.cpu(), fagrad.cpu()), std::invalid_argument);
+    //or gridding parameters, even when the number of grid points matches
+    GridMaker finer(0.25, 6);
+    BOOST_CHECK_EQUAL(finer.get_grid_dims().x, dims.x);
+    BOOST_CHECK_THROW(finer.backward(center, c, fp, diff.cpu(), fagrad.cpu()), std::invalid_argument);
+    GridMaker scaled(0.5, 12, false, 0.9);
+    BOOST_CHECK_THROW(scaled.backward(center, c, fp, diff.cpu(), fagrad.cpu()), std::invalid_argument);
+  }
+  BOOST_CHECK(fp.recorded());
+
+  //footprints larger than the limit aren't stored and the direct path is used
+  GridMaker gmaker(0.5, 12);
+  float3 dims = gmaker.get_grid_dims();
+  MGrid4f expected(ntypes, dims.x, dims.y, dims.z);
+  MGrid4f out(ntypes, dims.x, dims.y, dims.z);
+  AtomFootprints small(1000);
+  gmaker.forward(center, c, expected.cpu());
+  gmaker.forward(center, c, small, out.cpu());
+  BOOST_CHECK(!small.recorded());
+  BOOST_CHECK_EQUAL(small.num_footprints(), 0);
+  BOOST_CHECK(std::equal(expected.data(), expected.data() + expected.size(), out.data()));
+
+  MGrid2f agrad(natoms, 3), fagrad(natoms, 3);
+  gmaker.backward(center, c, out.cpu(), agrad.cpu());
+  gmaker.backward(center, c, small, out.cpu(), fagrad.cpu());
+  BOOST_CHECK(std::equal(agrad.data(), agrad.data() + agrad.size(), fagrad.data()));
+  BOOST_CHECK_THROW(gmaker.backward(make_float3(0, 0, 0), c, small, out.cpu(), fagrad.cpu()), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(channel_sparse) {
+  //densifying a channel-sparse grid must reproduce the dense grid
+  size_t natoms = 400;
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 20, 20, 20);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+  CoordinateSet vc = c.clone();
+  vc.make_vector_types();
+
+  GridMaker gmaker(0.5, 8);
+  float3 dims = gmaker.get_grid_dims();
+  MGrid4f expected(ntypes, dims.x, dims.y, dims.z);
+  MGrid4f out(ntypes, dims.x, dims.y, dims.z);
+  ChannelSparseGrid<float> sparse;
+
+  std::vector<float3> centers = {make_float3(0, 0, 0), make_float3(6, -5, 3)};
+  for (float3 center : centers) {
+    gmaker.forward(center, c, expected.cpu());
+    gmaker.forward(center, c, sparse);
+    BOOST_CHECK_EQUAL(sparse.num_channels(), ntypes);
+    BOOST_CHECK_GT(sparse.num_stored(), 0);
+    BOOST_CHECK_LT(sparse.num_stored(), ntypes);
+    BOOST_CHECK(std::is_sorted(sparse.get_channels().begin(), sparse.get_channels().end()));
+    out.fill_zero();
+    sparse.densify(out.cpu());
+    BOOST_CHECK(std::equal(expected.data(), expected.data() + expected.size(), out.data()));
+
+    gmaker.forward(center, vc, expected.cpu());
+    gmaker.forward(center, vc, sparse);
+    sparse.densify(out.cpu());
+    BOOST_CHECK(std::equal(expected.data(), expected.data() + expected.size(), out.data()));
+  }
+
+  //nothing near the grid
+  gmaker.forward(make_float3(100, 100, 100), c, sparse);
+  BOOST_CHECK_EQUAL(sparse.num_stored(), 0);
+  sparse.densify(out.cpu());
+  BOOST_CHECK(std::all_of(out.data(), out.data() + out.size(), [](float v) { return v == 0; }));
+
+  MGrid4f wrong(ntypes - 1, dims.x, dims.y, dims.z);
+  BOOST_CHECK_THROW(sparse.densify(wrong.cpu()), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(forward_reduced_precision) {
+  //reduced precision grids must equal the float grid rounded once
+  size_t natoms = 300;
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 12, 12, 12);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+  CoordinateSet vc = c.clone();
+  vc.make_vector_types();
+
+  float3 center = make_float3(0.5, -1, 0);
+  //slabs of several scratch blocks, a partial block and single planes
+  for (unsigned nthreads : {1, 3, 17}) {
+    GridMaker gmaker(0.5, 16);
+    gmaker.set_num_threads(nthreads);
+    float3 dims = gmaker.get_grid_dims();
+    MGrid4f expected(ntypes, dims.x, dims.y, dims.z);
+    MGrid4h half(ntypes, dims.x, dims.y, dims.z);
+#ifdef LIBMOLGRID_BFLOAT16
+    MGrid4bf bf(ntypes, dims.x, dims.y, dims.z);
+#endif
+
+    for (CoordinateSet *cs : {&c, &vc}) {
+      gmaker.forward(center, *cs, expected.cpu());
+      gmaker.forward(center, *cs, half.cpu());
+      BOOST_CHECK_EQUAL(grid_empty(expected.cpu()), false);
+      for (size_t i = 0; i < expected.size(); i++) {
+        BOOST_CHECK_EQUAL(__half2float(half.data()[i]), __half2float(__float2half_rn(expected.data()[i])));
+      }
+#ifdef LIBMOLGRID_BFLOAT16
+      gmaker.forward(center, *cs, bf.cpu());
+      for (size_t i = 0; i < expected.size(); i++) {
+        BOOST_CHECK_EQUAL(__bfloat162float(bf.data()[i]), __bfloat162float(__float2bfloat16_rn(expected.data()[i])));
+      }
+#endif
+    }
+  }
+}
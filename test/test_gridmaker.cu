@@ -144,3 +144,48 @@ BOOST_AUTO_TEST_CASE(forward_gpu) {
     }
   }
 }
+
+BOOST_AUTO_TEST_CASE(forward_gpu_reduced_precision) {
+  //reduced precision grids are accumulated in fp32, so they must equal the
+  //float grid rounded once
+  size_t natoms = 500;
+  random_engine.seed(0);
+  MGrid2f coords(natoms, 3);
+  MGrid1f type_indices(natoms);
+  MGrid1f radii(natoms);
+  make_mol(coords.cpu(), type_indices.cpu(), radii.cpu(), natoms, 0, 0, 12, 12, 12);
+  size_t ntypes = GninaIndexTyper::NumTypes;
+  CoordinateSet c(coords.cpu(), type_indices.cpu(), radii.cpu(), ntypes);
+  CoordinateSet vc = c.clone();
+  vc.make_vector_types();
+  c.togpu();
+  vc.togpu();
+
+  GridMaker gmaker(0.5, 23.5);
+  float3 dims = gmaker.get_grid_dims();
+  float3 center = make_float3(0, 0, 0);
+  MGrid4f expected(ntypes, dims.x, dims.y, dims.z);
+  MGrid4h half(ntypes, dims.x, dims.y, dims.z);
+#ifdef LIBMOLGRID_BFLOAT16
+  MGrid4bf bf(ntypes, dims.x, dims.y, dims.z);
+#endif
+
+  for (CoordinateSet *cs : {&c, &vc}) {
+    gmaker.forward(center, *cs, expected.gpu());
+    gmaker.forward(center, *cs, half.gpu());
+    BOOST_CHECK_EQUAL(cudaGetLastError(), cudaSuccess);
+    expected.tocpu();
+    half.tocpu();
+    BOOST_CHECK_EQUAL(grid_empty(expected.cpu()), false);
+    for (size_t i = 0; i < expected.size(); i++) {
+      BOOST_CHECK_EQUAL(__half2float(half.data()[i]), __half2float(__float2half_rn(expected.data()[i])));
+    }
+#ifdef LIBMOLGRID_BFLOAT16
+    gmaker.forward(center, *cs, bf.gpu());
+    bf.tocpu();
+    for (size_t i = 0; i < expected.size(); i++) {
+      BOOST_CHECK_EQUAL(__bfloat162float(bf.data()[i]), __bfloat162float(__float2bfloat16_rn(expected.data()[i])));
+    }
+#endif
+  }
+}
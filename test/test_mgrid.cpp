@@ -176,3 +176,48 @@ BOOST_AUTO_TEST_CASE(copyto)
   BOOST_CHECK_EQUAL(h(1,1),3);
 
 }
+
+BOOST_AUTO_TEST_CASE(external)
+{
+  auto mem = std::make_shared<std::vector<float> >(12);
+  for(unsigned i = 0; i < 12; i++) (*mem)[i] = i;
+  const float *orig = mem->data();
+  std::weak_ptr<std::vector<float> > alive(mem);
+
+  MGrid2f g(mem, mem->data(), 4, 3);
+  mem.reset(); //grid keeps memory alive
+  BOOST_CHECK(!alive.expired());
+
+  //reading does not copy
+  const MGrid2f& cg = g;
+  BOOST_CHECK_EQUAL(cg(2,1), 7);
+  BOOST_CHECK_EQUAL(cg.cpu().data(), orig);
+
+  MGrid2f alias = g;
+  MGrid1f row = g[1];
+  g(2,1) = 100; //copied on write
+  BOOST_CHECK_NE(cg.cpu().data(), orig);
+  BOOST_CHECK_EQUAL((*alive.lock())[7], 7);
+  BOOST_CHECK_EQUAL(alias(2,1), 100); //copies still share memory
+  BOOST_CHECK(alias == g);
+
+  row[0] = 50;
+  BOOST_CHECK_EQUAL(g(1,0), 50);
+  BOOST_CHECK_EQUAL(g(1,1), 4);
+
+  //views taken before the copy keep the external memory; fill_zero doesn't need its contents
+  MGrid2f z(alive.lock(), alive.lock()->data(), 4, 3);
+  Grid2f before = static_cast<const MGrid2f&>(z).cpu();
+  z.fill_zero();
+  BOOST_CHECK_NE(static_cast<const MGrid2f&>(z).cpu().data(), orig);
+  BOOST_CHECK_EQUAL(before.data(), orig);
+  BOOST_CHECK_EQUAL(before(2,1), 7);
+  BOOST_CHECK_EQUAL(z(2,1), 0);
+  BOOST_CHECK_EQUAL((*alive.lock())[7], 7);
+  z = MGrid2f();
+
+  g = MGrid2f();
+  alias = MGrid2f();
+  row = MGrid1f();
+  BOOST_CHECK(alive.expired());
+}
@@ -400,3 +400,18 @@ def test_callbackvector_typing():
         else: #hydrogen
             assert tvec[0] == 1
             assert tvec[1] == 1
+
+def test_molecule_typing():
+    m = pybel.readstring('smi','c1ccccc1CONC(=O)CSCl')
+    m.addh()
+    typers = [molgrid.GninaIndexTyper(), molgrid.GninaIndexTyper(True), molgrid.ElementIndexTyper(),
+              molgrid.ElementIndexTyper(8), molgrid.SubsettedGninaTyper([2,3,4,5,6]),
+              molgrid.SubsettedElementTyper([6,7,8]), molgrid.defaultGninaLigandTyper]
+    for t in typers:
+        # coordinate sets type whole molecules at once
+        typs = [t.get_atom_type_index(a.OBAtom) for a in m.atoms]
+        kept = [(ty, r) for ty, r in typs if ty >= 0]
+        c = molgrid.CoordinateSet(m, t)
+        assert c.size() == len(kept)
+        assert list(c.type_index.tonumpy()) == [ty for ty, r in kept]
+        assert list(c.radii.tonumpy()) == approx([r for ty, r in kept])
@@ -0,0 +1,38 @@
+/** \file index_molcache2.cpp
+ *  \brief Create the index files of molcache2 files.
+ *
+ *  Once a molcache2 file has an index (stored next to it with an .index
+ *  suffix) opening it no longer requires reading the names of all of its
+ *  molecules.  An index is ignored if the molcache2 file is later modified,
+ *  so it should be recreated whenever the cache is.
+ *
+ *  Created on: Oct 16, 2026
+ *      Author: dkoes
+ */
+
+#include <iostream>
+#include <string>
+
+#include "libmolgrid/molcache.h"
+
+using namespace libmolgrid;
+using namespace std;
+
+int main(int argc, char *argv[]) {
+  if(argc < 2) {
+    cerr << "Usage: " << argv[0] << " file.molcache2 [file.molcache2...]\n";
+    return 1;
+  }
+
+  for(int i = 1; i < argc; i++) {
+    string fname = argv[i];
+    try {
+      size_t n = MolCache2::create_index(fname);
+      cout << "Indexed " << n << " molecules of " << fname << " in " << MolCache2::index_file_name(fname) << "\n";
+    } catch(std::exception& e) {
+      cerr << e.what() << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}